@@ -0,0 +1,41 @@
+#ifndef SILO_BITMAP_VIEW_H
+#define SILO_BITMAP_VIEW_H
+
+#include "silo/roaring/roaring.hh"
+#include <algorithm>
+#include <memory>
+
+namespace silo {
+
+/// Rows covered by one roaring container
+constexpr uint32_t container_rows = 1u << 16;
+
+/// Zero-copy, read-only view on the containers of bm that hold the rows [begin, end).
+/// begin and end must be multiples of container_rows, except for an end past the last row.
+/// The view shares the container memory of bm and must not outlive it.
+inline std::shared_ptr<const roaring::Roaring> bitmap_view(const roaring::Roaring& bm, uint32_t begin, uint32_t end) {
+   const roaring::api::roaring_array_t& ra = bm.roaring.high_low_container;
+   const uint16_t* keys = ra.keys;
+   const uint16_t* first = std::lower_bound(keys, keys + ra.size, begin / container_rows);
+   const uint16_t* last = std::lower_bound(first, keys + ra.size, ((uint64_t) end + container_rows - 1) / container_rows);
+   const int32_t offset = first - keys;
+
+   auto view = new roaring::Roaring();
+   roaring::api::roaring_array_t& view_ra = view->roaring.high_low_container;
+   view_ra.size = view_ra.allocation_size = last - first;
+   if (view_ra.size > 0) {
+      view_ra.containers = ra.containers + offset;
+      view_ra.keys = ra.keys + offset;
+      view_ra.typecodes = ra.typecodes + offset;
+   }
+   view_ra.flags = ra.flags & ROARING_FLAG_COW;
+   /// Detach the borrowed containers before the destructor would free them
+   return {view, [](roaring::Roaring* v) {
+              roaring::api::roaring_bitmap_init_cleared(&v->roaring);
+              delete v;
+           }};
+}
+
+} // namespace silo
+
+#endif //SILO_BITMAP_VIEW_H
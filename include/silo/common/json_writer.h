@@ -0,0 +1,163 @@
+#ifndef SILO_JSON_WRITER_H
+#define SILO_JSON_WRITER_H
+
+#include <charconv>
+#include <cmath>
+#include <concepts>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace silo {
+
+/// Writes json to a stream through a fixed buffer, such that results are never built up in memory.
+/// Commas between the elements of arrays and objects are inserted automatically.
+class JsonWriter {
+   static constexpr size_t buffer_size = 1 << 16;
+   /// Longest number written by to_chars
+   static constexpr size_t max_number_length = 32;
+
+   std::ostream& out;
+   std::unique_ptr<char[]> buffer = std::make_unique<char[]>(buffer_size);
+   size_t used = 0;
+   /// Per open array or object, whether it has no element yet
+   std::vector<bool> empty;
+   bool after_key = false;
+
+   void reserve(size_t bytes) {
+      if (used + bytes > buffer_size) {
+         flush();
+      }
+   }
+
+   void put(char c) {
+      reserve(1);
+      buffer[used++] = c;
+   }
+
+   void put(std::string_view str) {
+      if (str.size() > buffer_size) {
+         flush();
+         out.write(str.data(), str.size());
+         return;
+      }
+      reserve(str.size());
+      memcpy(buffer.get() + used, str.data(), str.size());
+      used += str.size();
+   }
+
+   /// Separates the next element from the previous one in the enclosing array or object
+   void separate() {
+      if (after_key) {
+         after_key = false;
+         return;
+      }
+      if (!empty.empty()) {
+         if (!empty.back()) {
+            put(',');
+         }
+         empty.back() = false;
+      }
+   }
+
+   void put_string(std::string_view str) {
+      put('"');
+      size_t plain = 0;
+      for (size_t i = 0; i < str.size(); ++i) {
+         const char c = str[i];
+         if (c != '"' && c != '\\' && (unsigned char) c >= 0x20) {
+            continue;
+         }
+         put(str.substr(plain, i - plain));
+         plain = i + 1;
+         if (c == '"' || c == '\\') {
+            put('\\');
+            put(c);
+         } else {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            put(escaped);
+         }
+      }
+      put(str.substr(plain));
+      put('"');
+   }
+
+   public:
+   explicit JsonWriter(std::ostream& out) : out(out) {}
+
+   JsonWriter(const JsonWriter&) = delete;
+   JsonWriter& operator=(const JsonWriter&) = delete;
+
+   ~JsonWriter() {
+      flush();
+   }
+
+   void begin_array() {
+      separate();
+      put('[');
+      empty.push_back(true);
+   }
+
+   void end_array() {
+      empty.pop_back();
+      put(']');
+   }
+
+   void begin_object() {
+      separate();
+      put('{');
+      empty.push_back(true);
+   }
+
+   void end_object() {
+      empty.pop_back();
+      put('}');
+   }
+
+   void key(std::string_view name) {
+      separate();
+      put_string(name);
+      put(':');
+      after_key = true;
+   }
+
+   void value(std::string_view str) {
+      separate();
+      put_string(str);
+   }
+
+   void value(const char* str) {
+      value(std::string_view(str));
+   }
+
+   template <std::integral T>
+   void value(T number) {
+      separate();
+      reserve(max_number_length);
+      used = std::to_chars(buffer.get() + used, buffer.get() + buffer_size, number).ptr - buffer.get();
+   }
+
+   /// Shortest representation that parses back to the same double. Json has no infinity or NaN, these become null.
+   void value(double number) {
+      separate();
+      if (!std::isfinite(number)) {
+         put("null");
+         return;
+      }
+      reserve(max_number_length);
+      used = std::to_chars(buffer.get() + used, buffer.get() + buffer_size, number).ptr - buffer.get();
+   }
+
+   void flush() {
+      out.write(buffer.get(), used);
+      used = 0;
+   }
+};
+
+} // namespace silo
+
+#endif //SILO_JSON_WRITER_H
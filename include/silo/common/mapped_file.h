@@ -0,0 +1,75 @@
+#ifndef SILO_MAPPED_FILE_H
+#define SILO_MAPPED_FILE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <fcntl.h>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace silo {
+
+/// A file mapped read-only into memory. Its pages are loaded on access and shared between all processes mapping the file.
+class MappedFile {
+   const char* data_ = nullptr;
+   size_t size_ = 0;
+
+   public:
+   explicit MappedFile(const std::string& filename) {
+      const int fd = open(filename.c_str(), O_RDONLY);
+      if (fd < 0) {
+         throw std::runtime_error("Cannot open " + filename);
+      }
+      struct stat st {};
+      if (fstat(fd, &st) != 0) {
+         close(fd);
+         throw std::runtime_error("Cannot stat " + filename);
+      }
+      size_ = st.st_size;
+      if (size_ > 0) {
+         void* addr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+         if (addr == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Cannot map " + filename);
+         }
+         data_ = static_cast<const char*>(addr);
+      }
+      /// The mapping stays valid after closing
+      close(fd);
+   }
+
+   MappedFile(const MappedFile&) = delete;
+   MappedFile& operator=(const MappedFile&) = delete;
+
+   ~MappedFile() {
+      if (data_) {
+         munmap(const_cast<char*>(data_), size_);
+      }
+   }
+
+   /// Page aligned
+   [[nodiscard]] const char* data() const {
+      return data_;
+   }
+
+   [[nodiscard]] size_t size() const {
+      return size_;
+   }
+
+   /// Drops the pages that lie entirely within [offset, offset + length) from memory, they are read again on access
+   void release(size_t offset, size_t length) const {
+      const size_t page = sysconf(_SC_PAGESIZE);
+      const size_t begin = (offset + page - 1) / page * page;
+      const size_t end = std::min(offset + length, size_) / page * page;
+      if (begin < end) {
+         madvise(const_cast<char*>(data_) + begin, end - begin, MADV_DONTNEED);
+      }
+   }
+};
+
+} // namespace silo
+
+#endif //SILO_MAPPED_FILE_H
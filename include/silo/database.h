@@ -6,10 +6,13 @@
 #define SILO_DATABASE_H
 
 #include <silo/common/silo_symbols.h>
+#include <silo/query_engine/result_cache.h>
 #include <silo/storage/Dictionary.h>
+#include <silo/storage/lineage_tree.h>
 #include <silo/storage/meta_store.h>
 #include <silo/storage/sequence_store.h>
 
+#include <shared_mutex>
 #include <utility>
 
 namespace silo {
@@ -17,16 +20,24 @@ namespace silo {
 struct chunk_t {
    friend class boost::serialization::access;
    template <class Archive>
-   [[maybe_unused]] void serialize(Archive& ar, const unsigned int /* version */) {
+   [[maybe_unused]] void serialize(Archive& ar, const unsigned int version) {
       ar& prefix;
       ar& count;
       ar& offset;
       ar& pangos;
+      /// Version 0 archives have no zone maps, DatabasePartition rebuilds them after loading
+      if (version >= 1) {
+         ar& min_day;
+         ar& max_day;
+      }
    }
    std::string prefix;
    uint32_t count;
    uint32_t offset;
    std::vector<std::string> pangos;
+   /// Zone map of the dates in the chunk, computed in finalize
+   uint32_t min_day = UINT32_MAX;
+   uint32_t max_day = 0;
 };
 
 struct partition_t {
@@ -52,13 +63,36 @@ class DatabasePartition {
    friend class Database;
    friend class boost::serialization::access;
 
+   /// Version 0 archives have no sorted countries and regions, they are rebuilt from the bitmaps after loading
    template <class Archive>
-   void serialize(Archive& ar, [[maybe_unused]] const unsigned int version) {
+   void serialize(Archive& ar, const unsigned int version) {
       ar& meta_store;
       ar& seq_store;
       ar& sequenceCount;
       ar& chunks;
       ar& sorted_lineages;
+      if (version >= 1) {
+         ar& sorted_countries;
+         ar& sorted_regions;
+      }
+      if constexpr (Archive::is_loading::value) {
+         if (version == 0) {
+            sorted_countries = non_empty(meta_store.country_bitmaps);
+            sorted_regions = non_empty(meta_store.region_bitmaps);
+         }
+         build_zone_maps();
+      }
+   }
+
+   /// The ids whose bitmaps are not empty, in ascending order
+   static std::vector<uint32_t> non_empty(const std::vector<roaring::Roaring>& bitmaps) {
+      std::vector<uint32_t> ret;
+      for (uint32_t id = 0; id < bitmaps.size(); ++id) {
+         if (!bitmaps[id].isEmpty()) {
+            ret.push_back(id);
+         }
+      }
+      return ret;
    }
 
    std::vector<silo::chunk_t> chunks;
@@ -69,12 +103,19 @@ class DatabasePartition {
    unsigned sequenceCount;
    // Sorted Lineage ids that are contained in this partition (for expression simplification)
    std::vector<uint32_t> sorted_lineages;
+   /// Sorted country and region ids that are contained in this partition (for expression simplification).
+   /// The range of its dates is given by meta_store.sorted_days.
+   std::vector<uint32_t> sorted_countries;
+   std::vector<uint32_t> sorted_regions;
 
    const std::vector<silo::chunk_t>& get_chunks() const {
       return chunks;
    }
 
-   void finalize(const Dictionary& dict);
+   /// Computes the zone maps of the chunks from meta_store.sid_to_day
+   void build_zone_maps();
+
+   void finalize(const Dictionary& dict, const lineage_tree_t& lineage_tree, const std::string& reference, bool compress_edge_gaps, uint32_t n_run_min_length);
 };
 
 class Database {
@@ -85,6 +126,23 @@ class Database {
    std::unique_ptr<pango_descriptor_t> pango_def;
    std::unique_ptr<partitioning_descriptor_t> part_def;
    std::unique_ptr<Dictionary> dict;
+   /// Intermediate filter results, invalidated whenever the partitions change
+   std::unique_ptr<ResultCache> result_cache = std::make_unique<ResultCache>();
+   /// Minimal share of sequences with ambiguous symbols at a position for it to be in the ambiguity index
+   double ambiguity_index_density = 0.01;
+   /// Additional metadata columns that get a bitmap index, see build_col_indexes
+   std::vector<std::string> indexed_columns = {"division"};
+   double col_index_max_distinct_share = 0.05;
+   /// Whether finalize keeps only the extents of leading and trailing gaps instead of storing them in the gap bitmaps
+   bool compress_edge_gaps = false;
+   /// Minimal length of the runs of N that finalize keeps as intervals instead of in the N bitmaps, 0 keeps all in the bitmaps
+   uint32_t n_run_min_length = 0;
+   /// Whether load maps the position bitmaps on their first access instead of up front
+   bool lazy_positions = false;
+   /// Bytes of lazily mapped position bitmaps that stay loaded between queries, see trim_positions
+   size_t position_budget_bytes = SIZE_MAX;
+   /// Held shared by every running query, such that trim_positions never unloads bitmaps in use
+   std::unique_ptr<std::shared_mutex> positions_in_use = std::make_unique<std::shared_mutex>();
 
    const std::unordered_map<std::string, std::string> get_alias_key() {
       return alias_key;
@@ -124,6 +182,16 @@ class Database {
    int db_info(std::ostream& io);
    int db_info_detailed(std::ostream& io);
    void finalize();
+   /// (Re)builds the indexes that depend on the configuration above and are not serialized
+   void build_indexes();
+
+   /// Pins the position bitmaps for the duration of a query
+   [[nodiscard]] std::shared_lock<std::shared_mutex> pin_positions() const {
+      return std::shared_lock<std::shared_mutex>(*positions_in_use);
+   }
+
+   /// Unloads lazily mapped positions until position_budget_bytes are loaded. Does nothing while a query runs.
+   void trim_positions() const;
 
    void save(const std::string& save_dir);
 
@@ -145,4 +213,7 @@ partitioning_descriptor_t load_partitioning_descriptor(std::istream& in);
 
 } // namespace silo
 
+BOOST_CLASS_VERSION(silo::chunk_t, 1)
+BOOST_CLASS_VERSION(silo::DatabasePartition, 1)
+
 #endif //SILO_DATABASE_H
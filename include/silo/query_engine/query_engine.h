@@ -5,8 +5,14 @@
 #ifndef SILO_QUERY_ENGINE_H
 #define SILO_QUERY_ENGINE_H
 
+#include "silo/common/bitmap_view.h"
+#include "silo/common/json_writer.h"
 #include "silo/database.h"
+#include <functional>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <unordered_map>
 
 namespace silo {
 
@@ -23,17 +29,39 @@ struct QueryParseException : public std::exception {
 };
 
 struct result_s {
+   /// Errors and explanations. The results of the actions are written to res_out,
+   /// except for execute_queries, which returns them here.
    std::string return_message;
    int64_t parse_time;
    int64_t filter_time;
    int64_t action_time;
 };
 
+/// Rows [begin, end) of a partition that are evaluated together.
+/// Slices are aligned to the rows of a roaring container, such that the bitmaps of the partition
+/// can be restricted to a slice without copying, see bitmap_view.
+struct slice_t {
+   uint32_t begin;
+   uint32_t end;
+
+   [[nodiscard]] bool covers(const DatabasePartition& dbp) const {
+      return begin == 0 && end >= dbp.sequenceCount;
+   }
+};
+
+/// Number of rows in a slice, the unit of intra-partition parallelism
+constexpr uint32_t slice_size = container_rows;
+
 /// The return value of the BoolExpression::evaluate method.
 /// May return either a mutable or immutable bitmap.
+/// Immutable bitmaps that are not owned by the database (e.g. cached results) are kept alive by shared_res.
+/// A complemented result stands for the rows of the evaluated slice that are not in the bitmap,
+/// such that negations need not be materialized.
 struct filter_t {
    roaring::Roaring* mutable_res;
    const roaring::Roaring* immutable_res;
+   std::shared_ptr<const roaring::Roaring> shared_res = nullptr;
+   bool complemented = false;
 
    inline const roaring::Roaring* getAsConst() const {
       return mutable_res ? mutable_res : immutable_res;
@@ -41,6 +69,24 @@ struct filter_t {
 
    inline void free() {
       if (mutable_res) delete mutable_res;
+      shared_res.reset();
+   }
+
+   /// Number of rows in the result, given the rows [begin, end) it was evaluated for
+   [[nodiscard]] inline uint64_t cardinality(uint32_t begin, uint32_t end) const {
+      const uint64_t card = getAsConst()->cardinality();
+      return complemented ? end - begin - card : card;
+   }
+
+   /// Turns a complemented result into an explicit bitmap of its rows in [begin, end)
+   inline void materialize(uint32_t begin, uint32_t end) {
+      if (!complemented) return;
+      roaring::Roaring* ret = mutable_res ? mutable_res : new roaring::Roaring(*immutable_res);
+      ret->flip(begin, end);
+      shared_res.reset();
+      mutable_res = ret;
+      immutable_res = nullptr;
+      complemented = false;
    }
 };
 
@@ -52,7 +98,10 @@ enum ExType {
    INDEX_FILTER,
    PRED,
    EMPTY,
-   FULL
+   FULL,
+   CACHED,
+   PROFILED,
+   PARAM
 };
 
 struct BoolExpression {
@@ -67,18 +116,22 @@ struct BoolExpression {
    virtual ExType type() const = 0;
 
    /// Evaluate the expression by interpreting it.
+   /// Only the rows of the given slice are evaluated, all other rows are absent from the result.
    /// If mutable bitmap is returned, caller must free the result
-   virtual filter_t evaluate(const Database& /*db*/, const DatabasePartition& /*dbp*/) = 0;
+   virtual filter_t evaluate(const Database& /*db*/, const DatabasePartition& /*dbp*/, slice_t /*slice*/) = 0;
 
    /// Transforms the expression to a human readable string.
    virtual std::string to_string(const Database& db) = 0;
 
    virtual std::unique_ptr<BoolExpression> simplify(const Database& /*db*/, const DatabasePartition& /*dbp*/) const = 0;
 
-   /* Maybe generate code in the future
-      /// Build the expression LLVM IR code.
-      /// @args: all function arguments that can be referenced by an @Argument
-      virtual llvm::Value *build(llvm::IRBuilder<> &builder, llvm::Value *args);*/
+   /// Cheap estimate of the result cardinality, computed without evaluating the expression.
+   /// Used by plan() to order the evaluation of children.
+   virtual uint32_t estimate_cardinality(const Database& /*db*/, const DatabasePartition& /*dbp*/) const = 0;
+
+   /// Planning stage between simplify() and evaluate(). Reorders children such that the
+   /// most selective ones are evaluated first. Leaves have nothing to plan.
+   virtual void plan(const Database& /*db*/, const DatabasePartition& /*dbp*/) {}
 };
 
 struct EmptyEx : public BoolExpression {
@@ -87,7 +140,7 @@ struct EmptyEx : public BoolExpression {
    };
 
    /// EmptyEx should be simplified away.
-   filter_t evaluate(const Database& /*db*/, const DatabasePartition& /*dbp*/) override;
+   filter_t evaluate(const Database& /*db*/, const DatabasePartition& /*dbp*/, slice_t /*slice*/) override;
 
    std::string to_string(const Database& /*db*/) override {
       return "FALSE";
@@ -96,6 +149,10 @@ struct EmptyEx : public BoolExpression {
    std::unique_ptr<BoolExpression> simplify(const Database& /*db*/, const DatabasePartition& /*dbp*/) const override {
       return std::make_unique<silo::EmptyEx>();
    }
+
+   uint32_t estimate_cardinality(const Database& /*db*/, const DatabasePartition& /*dbp*/) const override {
+      return 0;
+   }
 };
 
 struct FullEx : public BoolExpression {
@@ -104,7 +161,7 @@ struct FullEx : public BoolExpression {
    };
 
    /// EmptyEx should be simplified away.
-   filter_t evaluate(const Database& /*db*/, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& /*db*/, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& /*db*/) override {
       return "TRUE";
@@ -113,6 +170,10 @@ struct FullEx : public BoolExpression {
    std::unique_ptr<BoolExpression> simplify(const Database& /*db*/, const DatabasePartition& /*dbp*/) const override {
       return std::make_unique<silo::FullEx>();
    }
+
+   uint32_t estimate_cardinality(const Database& /*db*/, const DatabasePartition& dbp) const override {
+      return dbp.sequenceCount;
+   }
 };
 
 struct AndEx : public BoolExpression {
@@ -125,7 +186,7 @@ struct AndEx : public BoolExpression {
       return ExType::AND;
    };
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& db) override {
       std::string res = "(";
@@ -142,6 +203,10 @@ struct AndEx : public BoolExpression {
    }
 
    std::unique_ptr<BoolExpression> simplify(const Database& db, const DatabasePartition& dbp) const override;
+
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override;
+
+   void plan(const Database& db, const DatabasePartition& dbp) override;
 };
 
 struct OrEx : public BoolExpression {
@@ -154,7 +219,7 @@ struct OrEx : public BoolExpression {
       return ExType::OR;
    };
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& db) override {
       std::string res = "(";
@@ -167,13 +232,37 @@ struct OrEx : public BoolExpression {
    }
 
    std::unique_ptr<BoolExpression> simplify(const Database& db, const DatabasePartition& dbp) const override;
+
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override;
+
+   void plan(const Database& db, const DatabasePartition& dbp) override;
+};
+
+/// The implementation chosen by NOfEx for one slice, with its estimated and measured cost
+struct nof_decision_t {
+   uint32_t slice_begin;
+   unsigned impl;
+   bool automatic;
+   double estimated_cost;
+   int64_t microseconds;
 };
 
 struct NOfEx : public BoolExpression {
+   /// Let the cost model choose the implementation per slice
+   static constexpr unsigned impl_auto = UINT32_MAX;
+   /// Bit-sliced adder over the chunk bitsets of the children, fused with the surrounding operators.
+   /// Only evaluate_compiled can run it, the interpreter falls back to impl 1.
+   static constexpr unsigned impl_fused = 4;
+
    std::vector<std::unique_ptr<BoolExpression>> children;
    unsigned n;
    unsigned impl;
    bool exactly;
+   /// Cardinality estimates of the children for the partition, computed in plan()
+   std::vector<uint32_t> child_estimates;
+
+   std::mutex decisions_mutex;
+   std::vector<nof_decision_t> decisions;
 
    ExType type() const override {
       return ExType::NOF;
@@ -181,7 +270,15 @@ struct NOfEx : public BoolExpression {
 
    explicit NOfEx(unsigned n, unsigned impl, bool exactly) : n(n), impl(impl), exactly(exactly) {}
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
+
+   filter_t evaluate_impl(unsigned chosen, const Database& db, const DatabasePartition& dbp, slice_t slice);
+
+   /// Estimated cost of evaluating the slice with the given implementation, in rough row operations
+   [[nodiscard]] double estimate_cost(unsigned impl, const DatabasePartition& dbp, slice_t slice) const;
+
+   /// The implementation with the lowest estimated cost for the slice, impl_fused is only considered if fusable
+   [[nodiscard]] unsigned choose_impl(const DatabasePartition& dbp, slice_t slice, bool fusable = false) const;
 
    std::string to_string(const Database& db) override {
       std::string res;
@@ -199,6 +296,10 @@ struct NOfEx : public BoolExpression {
    }
 
    std::unique_ptr<BoolExpression> simplify(const Database& db, const DatabasePartition& dbp) const override;
+
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override;
+
+   void plan(const Database& db, const DatabasePartition& dbp) override;
 };
 
 struct NegEx : public BoolExpression {
@@ -212,7 +313,7 @@ struct NegEx : public BoolExpression {
 
    explicit NegEx(std::unique_ptr<BoolExpression> child) : child(std::move(child)) {}
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& db) override {
       std::string res = "!" + child->to_string(db);
@@ -226,6 +327,14 @@ struct NegEx : public BoolExpression {
       }
       return ret;
    }
+
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override {
+      return dbp.sequenceCount - std::min(dbp.sequenceCount, child->estimate_cardinality(db, dbp));
+   }
+
+   void plan(const Database& db, const DatabasePartition& dbp) override {
+      child->plan(db, dbp);
+   }
 };
 
 struct DateBetwEx : public BoolExpression {
@@ -243,7 +352,7 @@ struct DateBetwEx : public BoolExpression {
    explicit DateBetwEx(time_t from, bool open_from, time_t to, bool open_to)
       : from(from), open_from(open_from), to(to), open_to(open_to) {}
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& /*db*/) override {
       std::string res = "[Date-between ";
@@ -254,9 +363,10 @@ struct DateBetwEx : public BoolExpression {
       return res;
    }
 
-   std::unique_ptr<BoolExpression> simplify(const Database& /*db*/, const DatabasePartition& /*dbp*/) const override {
-      return std::make_unique<DateBetwEx>(from, open_from, to, open_to);
-   }
+   /// Empty or full if the range of the dates of the partition lies outside or inside the bounds
+   std::unique_ptr<BoolExpression> simplify(const Database& db, const DatabasePartition& dbp) const override;
+
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override;
 };
 
 struct NucEqEx : public BoolExpression {
@@ -271,7 +381,7 @@ struct NucEqEx : public BoolExpression {
 
    explicit NucEqEx(unsigned position, Symbol value) : position(position), value(value) {}
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& /*db*/) override {
       std::string res = std::to_string(position) + symbol_rep[value];
@@ -286,6 +396,10 @@ struct NucEqEx : public BoolExpression {
          return ret;
       }
    }
+
+   uint32_t estimate_cardinality(const Database& /*db*/, const DatabasePartition& dbp) const override {
+      return dbp.seq_store.symbol_count(position, value);
+   }
 };
 
 struct NucMbEx : public BoolExpression {
@@ -301,7 +415,7 @@ struct NucMbEx : public BoolExpression {
 
    explicit NucMbEx(unsigned position, Symbol value) : position(position), value(value) {}
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& /*db*/) override {
       std::string res = "?" + std::to_string(position) + symbol_rep[value];
@@ -317,6 +431,37 @@ struct NucMbEx : public BoolExpression {
          return ret;
       }
    }
+
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override;
+};
+
+/// The sequences without N at any of the 1-indexed positions [from, to]
+struct CoveredEx : public BoolExpression {
+   unsigned from;
+   unsigned to;
+
+   ExType type() const override {
+      return ExType::INDEX_FILTER;
+   };
+
+   explicit CoveredEx(unsigned from, unsigned to) : from(from), to(to) {}
+
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
+
+   std::string to_string(const Database& /*db*/) override {
+      std::string res = "[Covered " + std::to_string(from) + "-" + std::to_string(to) + "]";
+      return res;
+   }
+
+   std::unique_ptr<BoolExpression> simplify(const Database& /*db*/, const DatabasePartition& /*dbp*/) const override {
+      return std::make_unique<CoveredEx>(from, to);
+   }
+
+   /// At most the sequences without N at either end of the range
+   uint32_t estimate_cardinality(const Database& /*db*/, const DatabasePartition& dbp) const override {
+      const uint64_t uncovered = std::max(dbp.seq_store.symbol_count(from, Symbol::N), dbp.seq_store.symbol_count(to, Symbol::N));
+      return dbp.sequenceCount - std::min<uint64_t>(dbp.sequenceCount, uncovered);
+   }
 };
 
 struct PangoLineageEx : public BoolExpression {
@@ -330,7 +475,7 @@ struct PangoLineageEx : public BoolExpression {
    explicit PangoLineageEx(uint32_t lineageKey, bool includeSubLineages)
       : lineageKey(lineageKey), includeSubLineages(includeSubLineages) {}
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& db) override {
       std::string res = db.dict->get_pango(lineageKey);
@@ -346,8 +491,24 @@ struct PangoLineageEx : public BoolExpression {
       }
       if (!this->includeSubLineages && !std::binary_search(dbp.sorted_lineages.begin(), dbp.sorted_lineages.end(), lineageKey)) {
          return std::make_unique<EmptyEx>();
+      }
+      /// Partitions are formed from lineages, such that they often contain only sublineages of the queried one
+      const roaring::Roaring& bm = includeSubLineages ? dbp.meta_store.sublineage_bitmap(lineageKey) : dbp.meta_store.lineage_bitmaps[lineageKey];
+      if (bm.isEmpty()) {
+         return std::make_unique<EmptyEx>();
+      }
+      if (bm.cardinality() == dbp.sequenceCount) {
+         return std::make_unique<FullEx>();
+      }
+      return std::make_unique<PangoLineageEx>(lineageKey, includeSubLineages);
+   }
+
+   uint32_t estimate_cardinality(const Database& /*db*/, const DatabasePartition& dbp) const override {
+      if (lineageKey == UINT32_MAX) return 0;
+      if (includeSubLineages) {
+         return dbp.meta_store.sublineage_bitmap(lineageKey).cardinality();
       } else {
-         return std::make_unique<PangoLineageEx>(lineageKey, includeSubLineages);
+         return dbp.meta_store.lineage_bitmaps[lineageKey].cardinality();
       }
    }
 };
@@ -361,15 +522,19 @@ struct CountryEx : public BoolExpression {
 
    explicit CountryEx(uint32_t countryKey) : countryKey(countryKey) {}
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& db) override {
       std::string res = "Country=" + db.dict->get_country(countryKey);
       return res;
    }
 
-   std::unique_ptr<BoolExpression> simplify(const Database& /*db*/, const DatabasePartition& /*dbp*/) const override {
-      return std::make_unique<CountryEx>(countryKey);
+   /// Empty if the country is not in the partition, full if it is the only one
+   std::unique_ptr<BoolExpression> simplify(const Database& db, const DatabasePartition& dbp) const override;
+
+   uint32_t estimate_cardinality(const Database& /*db*/, const DatabasePartition& dbp) const override {
+      if (countryKey >= dbp.meta_store.country_bitmaps.size()) return 0;
+      return dbp.meta_store.country_bitmaps[countryKey].cardinality();
    }
 };
 
@@ -383,15 +548,19 @@ struct RegionEx : public BoolExpression {
    explicit RegionEx(uint32_t regionKey) : regionKey(regionKey) {
    }
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& db) override {
       std::string res = "Region=" + db.dict->get_region(regionKey);
       return res;
    }
 
-   std::unique_ptr<BoolExpression> simplify(const Database& /*db*/, const DatabasePartition& /*dbp*/) const override {
-      return std::make_unique<RegionEx>(regionKey);
+   /// Empty if the region is not in the partition, full if it is the only one
+   std::unique_ptr<BoolExpression> simplify(const Database& db, const DatabasePartition& dbp) const override;
+
+   uint32_t estimate_cardinality(const Database& /*db*/, const DatabasePartition& dbp) const override {
+      if (regionKey >= dbp.meta_store.region_bitmaps.size()) return 0;
+      return dbp.meta_store.region_bitmaps[regionKey].cardinality();
    }
 };
 
@@ -405,18 +574,172 @@ struct StrEqEx : public BoolExpression {
 
    explicit StrEqEx(const std::string& column, const std::string& value) : column(column), value(value) {}
 
-   filter_t evaluate(const Database& db, const DatabasePartition& dbp) override;
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
 
    std::string to_string(const Database& /*db*/) override {
       std::string res = column + "=" + value;
       return res;
    }
 
-   std::unique_ptr<BoolExpression> simplify(const Database& /*db*/, const DatabasePartition& /*dbp*/) const override {
+   /// The rows of the value if the column is indexed in the partition, nullptr if it has to be scanned.
+   /// Unknown columns and values yield an empty bitmap.
+   const roaring::Roaring* index_lookup(const Database& db, const DatabasePartition& dbp) const;
+
+   std::unique_ptr<BoolExpression> simplify(const Database& db, const DatabasePartition& dbp) const override {
+      const roaring::Roaring* bm = index_lookup(db, dbp);
+      if (bm && bm->isEmpty()) {
+         return std::make_unique<EmptyEx>();
+      }
       return std::make_unique<StrEqEx>(column, value);
    }
+
+   /// Unknown without scanning a column that is not indexed, assume the worst case
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override {
+      const roaring::Roaring* bm = index_lookup(db, dbp);
+      return bm ? bm->cardinality() : dbp.sequenceCount;
+   }
 };
 
+/// Serves the result of the wrapped, simplified expression from a ResultCache, usually the one of the Database.
+/// Inserted by cache_subexpressions after planning, for a single partition.
+struct CachedEx : public BoolExpression {
+   std::unique_ptr<BoolExpression> child;
+   std::string key;
+   uint32_t partition;
+   ResultCache* cache;
+
+   ExType type() const override {
+      return ExType::CACHED;
+   };
+
+   explicit CachedEx(std::unique_ptr<BoolExpression> child, std::string key, uint32_t partition, ResultCache* cache)
+      : child(std::move(child)), key(std::move(key)), partition(partition), cache(cache) {}
+
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
+
+   std::string to_string(const Database& db) override {
+      return child->to_string(db);
+   }
+
+   std::unique_ptr<BoolExpression> simplify(const Database& db, const DatabasePartition& dbp) const override {
+      return child->simplify(db, dbp);
+   }
+
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override {
+      return child->estimate_cardinality(db, dbp);
+   }
+};
+
+/// Values of the parameters of a prepared query by name. An empty value binds an open date bound.
+using query_params_t = std::unordered_map<std::string, std::string>;
+
+/// Creates the leaf of a parameter slot for the values of the parameters, before simplification
+using param_slot_t = std::function<std::unique_ptr<BoolExpression>(const query_params_t&)>;
+
+/// Leaf of a prepared query whose value is a parameter. Stays a placeholder through simplification
+/// and planning, the leaf for the current values is bound by execute_prepared before every evaluation.
+struct ParamEx : public BoolExpression {
+   uint32_t slot;
+   /// The leaf of the slot for the current values, simplified for the partition
+   std::unique_ptr<BoolExpression> bound;
+
+   ExType type() const override {
+      return ExType::PARAM;
+   };
+
+   explicit ParamEx(uint32_t slot) : slot(slot) {}
+
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override {
+      return bound->evaluate(db, dbp, slice);
+   }
+
+   std::string to_string(const Database& db) override {
+      return bound ? bound->to_string(db) : "$" + std::to_string(slot);
+   }
+
+   std::unique_ptr<BoolExpression> simplify(const Database& /*db*/, const DatabasePartition& /*dbp*/) const override {
+      return std::make_unique<ParamEx>(slot);
+   }
+
+   /// Unknown until the parameter is bound, assume the worst case
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override {
+      return bound ? bound->estimate_cardinality(db, dbp) : dbp.sequenceCount;
+   }
+};
+
+/// Statistics of the evaluations of a node for EXPLAIN ANALYZE, summed over the evaluated slices
+struct node_stats_t {
+   uint32_t evaluations = 0;
+   int64_t microseconds = 0;
+   uint64_t cardinality = 0;
+   uint64_t array_containers = 0;
+   uint64_t bitset_containers = 0;
+   uint64_t run_containers = 0;
+   /// Size of the results that were newly allocated, as opposed to bitmaps owned by the database or the cache
+   uint64_t bytes_allocated = 0;
+};
+
+/// Records node_stats_t for the evaluations of the wrapped expression.
+/// Inserted by profile_subexpressions for EXPLAIN ANALYZE, after planning and caching.
+struct ProfiledEx : public BoolExpression {
+   std::unique_ptr<BoolExpression> child;
+   std::mutex mutex;
+   node_stats_t stats;
+
+   ExType type() const override {
+      return ExType::PROFILED;
+   };
+
+   explicit ProfiledEx(std::unique_ptr<BoolExpression> child) : child(std::move(child)) {}
+
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override;
+
+   std::string to_string(const Database& db) override {
+      return child->to_string(db);
+   }
+
+   std::unique_ptr<BoolExpression> simplify(const Database& db, const DatabasePartition& dbp) const override {
+      return child->simplify(db, dbp);
+   }
+
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override {
+      return child->estimate_cardinality(db, dbp);
+   }
+};
+
+/// Instead of generating code for the expression, evaluates its And, Or, NOf and Neg operators in one pass per 2^16-row chunk.
+/// The leaves are evaluated by the interpreter, the operators work on the chunk bitsets of the leaves
+/// without materializing intermediate bitmaps. Cached subexpressions that miss are fused as well, their results are collected
+/// chunk by chunk and put into their cache after the pass. The other operands of an And are not evaluated once one is empty.
+/// Falls back to the interpreter if there is no operator to fuse.
+filter_t evaluate_compiled(BoolExpression& filter, const Database& db, const DatabasePartition& dbp, slice_t slice);
+
+/// Evaluates the filter on all slices of the partition in parallel and concatenates the results
+filter_t evaluate_slices(BoolExpression& filter, const Database& db, const DatabasePartition& dbp, bool compiled = false);
+
+/// The name of the node, as the type of the query json if there is one
+std::string operator_name(const BoolExpression& ex);
+
+/// Canonical form of a simplified expression, independent of the order of commutative children.
+/// Leaves are prefixed with their type and name, such that leaves of different kinds with the same to_string never share a key.
+std::string canonical_key(BoolExpression& ex, const Database& db);
+
+/// Wraps all subexpressions of the simplified and planned expression, which need to compute their result, into CachedEx.
+/// cache_of selects the cache for the key of a subexpression, nullptr leaves the subexpression unwrapped.
+std::unique_ptr<BoolExpression> cache_subexpressions(std::unique_ptr<BoolExpression> ex, const Database& db, uint32_t partition,
+                                                     const std::function<ResultCache*(const std::string&)>& cache_of);
+
+/// Caches the subexpressions in the ResultCache of the Database
+std::unique_ptr<BoolExpression> cache_subexpressions(std::unique_ptr<BoolExpression> ex, const Database& db, uint32_t partition);
+
+/// Wraps every node of the planned expression into ProfiledEx. The operators are then evaluated one by one,
+/// because the wrappers keep evaluate_compiled from fusing them.
+std::unique_ptr<BoolExpression> profile_subexpressions(std::unique_ptr<BoolExpression> ex);
+
+/// JSON description of the planned expression of the partition, with the estimated cardinality of every node
+/// and the statistics recorded by ProfiledEx nodes, which are not shown as nodes of their own
+std::string explain(BoolExpression& filter, const Database& db, const DatabasePartition& dbp);
+
 class mutation_proportion {
    public:
    double proportion;
@@ -426,17 +749,74 @@ class mutation_proportion {
    char mut_to;
 
    mutation_proportion(char mut_from, unsigned position, char mut_to, double proportion, unsigned count)
-      : mut_from(mut_from), position(position), mut_to(mut_to), proportion(proportion), count(count) {}
+      : proportion(proportion), position(position), count(count), mut_from(mut_from), mut_to(mut_to) {}
+};
+
+/// Writes the implementations chosen by the NOfEx nodes of the evaluated filter to perf_out and resets them
+void report_nof_decisions(BoolExpression& filter, uint32_t partition, std::ostream& perf_out);
+
+/// The action of a query, parsed from its json
+struct action_t {
+   std::string type;
+   std::vector<std::string> group_by_fields;
+   std::optional<double> min_proportion;
+   /// List: the fields of the sequences, their order and the window of them
+   std::vector<std::string> fields = {"gisaid_epi_isl", "date", "pango_lineage", "region", "country"};
+   std::string order_by;
+   uint64_t offset = 0;
+   uint64_t limit = UINT64_MAX;
 };
 
+/// A query whose json is parsed and whose filter is simplified and planned for every partition once,
+/// such that executing it goes straight to evaluation. Leaves of the filter may take their value from
+/// a parameter, written as {"param": "<name>"} in place of the value of PangoLineage, StrEq or
+/// the bounds of DateBetw. Executions of one prepared query are serialized, because they bind the
+/// parameters in place; prepare the query once per thread to execute it concurrently.
+struct prepared_query_t {
+   action_t action;
+   std::vector<param_slot_t> slots;
+   std::vector<std::unique_ptr<BoolExpression>> partition_filters;
+   std::mutex mutex;
+};
+
+std::unique_ptr<prepared_query_t> prepare_query(const Database& db, const std::string& query);
+
+/// Binds the parameters and executes the prepared query. Subexpression results are not cached,
+/// the parse_time of the result is the time of binding the parameters.
+result_s execute_prepared(const Database& db, prepared_query_t& prepared, const query_params_t& params,
+                          std::ostream& res_out, std::ostream& perf_out, bool compile_filter = false);
+
 /// Filter then call action
-result_s execute_query(const Database& db, const std::string& query, std::ostream& res_out, std::ostream& perf_out);
+/// compile_filter opts into evaluate_compiled instead of the interpreter
+result_s execute_query(const Database& db, const std::string& query, std::ostream& res_out, std::ostream& perf_out, bool compile_filter = false);
+
+/// Executes the queries together. Filters and subexpressions that occur in several of them are evaluated only once
+/// per partition and their results are shared between the actions. The filter_time of every result is the time
+/// of the shared filter evaluation.
+std::vector<result_s> execute_queries(const Database& db, const std::vector<std::string>& queries, std::ostream& perf_out, bool compile_filter = false);
 
 /// Action
 std::vector<mutation_proportion> execute_mutations(const silo::Database&, std::vector<silo::filter_t>&, double proportion_threshold);
 
 uint64_t execute_count(const silo::Database& /*db*/, std::vector<silo::filter_t>& partition_filters);
 
+/// Action, writes the fields of the filtered sequences to out as a json array of objects, row by row.
+/// The sequences are in partition order, or ordered by date if order_by is "date". Of these,
+/// the first offset are skipped and at most limit are written.
+void execute_list(const silo::Database& db, std::vector<silo::filter_t>& partition_filters, const std::vector<std::string>& fields,
+                  const std::string& order_by, uint64_t offset, uint64_t limit, JsonWriter& out);
+
+/// The values of the grouped fields for a group of the filtered sequences, and its number of sequences
+struct group_count_t {
+   std::vector<std::string> values;
+   uint64_t count;
+};
+
+/// Action, counts the filtered sequences per distinct combination of the values of the fields. Fields are
+/// date, country, region, pango_lineage and the additional metadata columns. The groups are ordered by their ids.
+std::vector<group_count_t> execute_grouped_count(const silo::Database& db, std::vector<silo::filter_t>& partition_filters,
+                                                 const std::vector<std::string>& group_by_fields);
+
 } // namespace silo;
 
 #endif //SILO_QUERY_ENGINE_H
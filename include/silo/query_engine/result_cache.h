@@ -0,0 +1,77 @@
+#ifndef SILO_RESULT_CACHE_H
+#define SILO_RESULT_CACHE_H
+
+#include "silo/roaring/roaring.hh"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace silo {
+
+/// A cached result. If complemented, the result is the rows of the slice that are not in bitmap, as in filter_t.
+struct cached_result_t {
+   std::shared_ptr<const roaring::Roaring> bitmap;
+   bool complemented = false;
+
+   explicit operator bool() const {
+      return bitmap != nullptr;
+   }
+};
+
+/// Bounded LRU cache for intermediate filter results.
+/// Entries are keyed by the canonical form of a simplified BoolExpression and the index of the partition
+/// and slice it was evaluated on. The cached bitmaps are immutable and shared, such that an entry may be evicted
+/// while a query still holds on to it.
+class ResultCache {
+   public:
+   static constexpr size_t default_max_bytes = 1ul << 30;
+
+   private:
+   struct entry_t {
+      std::string key;
+      std::shared_ptr<const roaring::Roaring> bitmap;
+      bool complemented;
+      size_t bytes;
+   };
+
+   mutable std::mutex mutex;
+   std::list<entry_t> lru; // most recently used in front
+   std::unordered_map<std::string, std::list<entry_t>::iterator> lookup;
+   size_t size_in_bytes = 0;
+   size_t max_bytes;
+   uint64_t hits = 0;
+   uint64_t misses = 0;
+
+   static std::string partition_key(const std::string& key, uint32_t partition, uint32_t slice) {
+      return std::to_string(partition) + '.' + std::to_string(slice) + ':' + key;
+   }
+
+   /// Expects mutex to be held
+   void evict_until(size_t bytes);
+
+   public:
+   explicit ResultCache(size_t max_bytes = default_max_bytes) : max_bytes(max_bytes) {}
+
+   /// Returns an empty result if it is not cached
+   cached_result_t get(const std::string& key, uint32_t partition, uint32_t slice);
+
+   void put(const std::string& key, uint32_t partition, uint32_t slice, std::shared_ptr<const roaring::Roaring> bitmap, bool complemented = false);
+
+   /// Drops all entries. Must be called whenever the underlying partitions change.
+   void clear();
+
+   /// A budget of 0 disables the cache
+   void set_max_bytes(size_t bytes);
+
+   [[nodiscard]] bool enabled() const {
+      return max_bytes > 0;
+   }
+
+   void info(std::ostream& io) const;
+};
+
+} // namespace silo
+
+#endif //SILO_RESULT_CACHE_H
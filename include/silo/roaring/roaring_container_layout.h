@@ -0,0 +1,42 @@
+#ifndef SILO_ROARING_CONTAINER_LAYOUT_H
+#define SILO_ROARING_CONTAINER_LAYOUT_H
+
+#include <stdint.h>
+
+/// The container structs and typecodes of CRoaring 0.8.0, which are internal to roaring.c.
+/// Plain C, such that src/roaring/roaring_layout_check.c can assert them against the vendored roaring.c.
+
+#define SILO_ROARING_BITSET_TYPE 1
+#define SILO_ROARING_ARRAY_TYPE 2
+#define SILO_ROARING_RUN_TYPE 3
+#define SILO_ROARING_SHARED_TYPE 4
+
+typedef struct silo_bitset_container_s {
+   int32_t cardinality;
+   uint64_t* words;
+} silo_bitset_container_t;
+
+typedef struct silo_array_container_s {
+   int32_t cardinality;
+   int32_t capacity;
+   uint16_t* array;
+} silo_array_container_t;
+
+typedef struct silo_rle16_s {
+   uint16_t value;
+   uint16_t length;
+} silo_rle16_t;
+
+typedef struct silo_run_container_s {
+   int32_t n_runs;
+   int32_t capacity;
+   silo_rle16_t* runs;
+} silo_run_container_t;
+
+typedef struct silo_shared_container_s {
+   const void* container;
+   uint8_t typecode;
+   uint32_t counter;
+} silo_shared_container_t;
+
+#endif //SILO_ROARING_CONTAINER_LAYOUT_H
@@ -0,0 +1,223 @@
+#ifndef SILO_ROARING_CONTAINERS_H
+#define SILO_ROARING_CONTAINERS_H
+
+#include "silo/roaring/roaring.hh"
+#include "silo/roaring/roaring_container_layout.h"
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+
+/// Read-only access to the containers of a roaring bitmap.
+/// The container structs are internal to roaring.c, roaring_container_layout.h mirrors them and is checked against
+/// the vendored roaring.c when building.
+namespace silo::roaring_containers {
+
+constexpr uint8_t BITSET_TYPE = SILO_ROARING_BITSET_TYPE;
+constexpr uint8_t ARRAY_TYPE = SILO_ROARING_ARRAY_TYPE;
+constexpr uint8_t RUN_TYPE = SILO_ROARING_RUN_TYPE;
+constexpr uint8_t SHARED_TYPE = SILO_ROARING_SHARED_TYPE;
+
+/// Number of 64-bit words of a bitset holding one container
+constexpr uint32_t bitset_words = (1u << 16) / 64;
+
+using bitset_container_t = silo_bitset_container_t;
+using array_container_t = silo_array_container_t;
+using rle16_t = silo_rle16_t;
+using run_container_t = silo_run_container_t;
+using shared_container_t = silo_shared_container_t;
+
+/// Index of the first container with a key not less than the given key, starting the search at from.
+/// Returns ra.size if there is none.
+inline int32_t lower_bound_container(const roaring::api::roaring_array_t& ra, uint16_t key, int32_t from = 0) {
+   const uint16_t* keys = ra.keys;
+   return std::lower_bound(keys + from, keys + ra.size, key) - keys;
+}
+
+/// Sets the bits [begin, end) of the bitset
+inline void set_range(uint64_t* words, uint32_t begin, uint32_t end) {
+   if (begin >= end) return;
+   const uint32_t first = begin / 64;
+   const uint32_t last = (end - 1) / 64;
+   const uint64_t first_mask = ~0ull << (begin % 64);
+   const uint64_t last_mask = ~0ull >> (63 - (end - 1) % 64);
+   if (first == last) {
+      words[first] |= first_mask & last_mask;
+      return;
+   }
+   words[first] |= first_mask;
+   for (uint32_t w = first + 1; w < last; ++w) {
+      words[w] = ~0ull;
+   }
+   words[last] |= last_mask;
+}
+
+/// The container at index i and its type, looking through shared containers
+inline std::pair<const void*, uint8_t> resolve_container(const roaring::api::roaring_array_t& ra, int32_t i) {
+   const void* container = ra.containers[i];
+   uint8_t typecode = ra.typecodes[i];
+   while (typecode == SHARED_TYPE) {
+      const auto shared = static_cast<const shared_container_t*>(container);
+      typecode = shared->typecode;
+      container = shared->container;
+   }
+   return {container, typecode};
+}
+
+/// Overwrites the bitset with the container at index i
+inline void load_container(const roaring::api::roaring_array_t& ra, int32_t i, uint64_t* words) {
+   const auto [container, typecode] = resolve_container(ra, i);
+   if (typecode == BITSET_TYPE) {
+      std::memcpy(words, static_cast<const bitset_container_t*>(container)->words, bitset_words * sizeof(uint64_t));
+      return;
+   }
+   std::memset(words, 0, bitset_words * sizeof(uint64_t));
+   if (typecode == ARRAY_TYPE) {
+      const auto array = static_cast<const array_container_t*>(container);
+      for (int32_t j = 0; j < array->cardinality; ++j) {
+         const uint16_t v = array->array[j];
+         words[v / 64] |= 1ull << (v % 64);
+      }
+   } else {
+      const auto run = static_cast<const run_container_t*>(container);
+      for (int32_t j = 0; j < run->n_runs; ++j) {
+         set_range(words, run->runs[j].value, (uint32_t) run->runs[j].value + run->runs[j].length + 1);
+      }
+   }
+}
+
+/// Number of set bits of the bitset in [begin, end)
+inline uint32_t count_range(const uint64_t* words, uint32_t begin, uint32_t end) {
+   if (begin >= end) return 0;
+   const uint32_t first = begin / 64;
+   const uint32_t last = (end - 1) / 64;
+   const uint64_t first_mask = ~0ull << (begin % 64);
+   const uint64_t last_mask = ~0ull >> (63 - (end - 1) % 64);
+   if (first == last) {
+      return std::popcount(words[first] & first_mask & last_mask);
+   }
+   uint32_t ret = std::popcount(words[first] & first_mask) + std::popcount(words[last] & last_mask);
+   for (uint32_t w = first + 1; w < last; ++w) {
+      ret += std::popcount(words[w]);
+   }
+   return ret;
+}
+
+/// Cardinality of the intersection of a decoded bitset with a container
+inline uint32_t and_cardinality(const uint64_t* words, const void* container, uint8_t typecode) {
+   uint32_t ret = 0;
+   if (typecode == BITSET_TYPE) {
+      const uint64_t* other = static_cast<const bitset_container_t*>(container)->words;
+      for (uint32_t w = 0; w < bitset_words; ++w) {
+         ret += std::popcount(words[w] & other[w]);
+      }
+   } else if (typecode == ARRAY_TYPE) {
+      const auto array = static_cast<const array_container_t*>(container);
+      for (int32_t j = 0; j < array->cardinality; ++j) {
+         const uint16_t v = array->array[j];
+         ret += (words[v / 64] >> (v % 64)) & 1;
+      }
+   } else {
+      const auto run = static_cast<const run_container_t*>(container);
+      for (int32_t j = 0; j < run->n_runs; ++j) {
+         ret += count_range(words, run->runs[j].value, (uint32_t) run->runs[j].value + run->runs[j].length + 1);
+      }
+   }
+   return ret;
+}
+
+/// Cardinality of the intersection of the sorted values of an array container with a container
+inline uint32_t and_cardinality(const uint16_t* values, int32_t n, const void* container, uint8_t typecode) {
+   uint32_t ret = 0;
+   if (typecode == BITSET_TYPE) {
+      const uint64_t* words = static_cast<const bitset_container_t*>(container)->words;
+      for (int32_t j = 0; j < n; ++j) {
+         ret += (words[values[j] / 64] >> (values[j] % 64)) & 1;
+      }
+   } else if (typecode == ARRAY_TYPE) {
+      const auto array = static_cast<const array_container_t*>(container);
+      for (int32_t a = 0, b = 0; a < n && b < array->cardinality;) {
+         if (values[a] < array->array[b]) {
+            ++a;
+         } else if (values[a] > array->array[b]) {
+            ++b;
+         } else {
+            ++ret, ++a, ++b;
+         }
+      }
+   } else {
+      const auto run = static_cast<const run_container_t*>(container);
+      for (int32_t a = 0, r = 0; a < n && r < run->n_runs;) {
+         const uint32_t end = (uint32_t) run->runs[r].value + run->runs[r].length;
+         if (values[a] < run->runs[r].value) {
+            ++a;
+         } else if (values[a] > end) {
+            ++r;
+         } else {
+            ++ret, ++a;
+         }
+      }
+   }
+   return ret;
+}
+
+/// Maximal number of bitmaps of and_cardinalities
+constexpr uint32_t max_fused_bitmaps = 32;
+
+/// Cardinalities of the intersections of filter with each of the bitmaps, in one pass over the containers of filter.
+/// Each container of filter is decoded at most once and intersected with the containers of the same key in all bitmaps,
+/// instead of walking the containers of filter once per bitmap.
+/// If within is given, only the containers of filter with a key in within are visited. This is exact if all bitmaps
+/// are subsets of within, and bounds the work by the number of containers of within.
+inline void and_cardinalities(const roaring::Roaring& filter, const roaring::Roaring* const* bitmaps, uint32_t count, uint64_t* out,
+                              const roaring::Roaring* within = nullptr) {
+   assert(count <= max_fused_bitmaps);
+   std::fill(out, out + count, 0);
+   int32_t cursors[max_fused_bitmaps] = {0};
+   alignas(64) uint64_t decoded[bitset_words];
+   const roaring::api::roaring_array_t& fra = filter.roaring.high_low_container;
+   int32_t within_cursor = 0;
+   for (int32_t i = 0; i < fra.size; ++i) {
+      if (within) {
+         /// Leapfrog to the next key that is in both filter and within
+         const roaring::api::roaring_array_t& wra = within->roaring.high_low_container;
+         within_cursor = lower_bound_container(wra, fra.keys[i], within_cursor);
+         if (within_cursor == wra.size) {
+            break;
+         }
+         if (wra.keys[within_cursor] != fra.keys[i]) {
+            i = lower_bound_container(fra, wra.keys[within_cursor], i) - 1;
+            continue;
+         }
+      }
+      const uint16_t key = fra.keys[i];
+      const auto [container, typecode] = resolve_container(fra, i);
+      const uint64_t* words = nullptr;
+      for (uint32_t b = 0; b < count; ++b) {
+         const roaring::api::roaring_array_t& bra = bitmaps[b]->roaring.high_low_container;
+         cursors[b] = lower_bound_container(bra, key, cursors[b]);
+         if (cursors[b] == bra.size || bra.keys[cursors[b]] != key) {
+            continue;
+         }
+         const auto [other, other_typecode] = resolve_container(bra, cursors[b]);
+         if (typecode == ARRAY_TYPE) {
+            const auto array = static_cast<const array_container_t*>(container);
+            out[b] += and_cardinality(array->array, array->cardinality, other, other_typecode);
+            continue;
+         }
+         if (!words) {
+            if (typecode == BITSET_TYPE) {
+               words = static_cast<const bitset_container_t*>(container)->words;
+            } else {
+               load_container(fra, i, decoded);
+               words = decoded;
+            }
+         }
+         out[b] += and_cardinality(words, other, other_typecode);
+      }
+   }
+}
+
+} // namespace silo::roaring_containers
+
+#endif //SILO_ROARING_CONTAINERS_H
@@ -61,6 +61,10 @@ class Dictionary {
 
    uint64_t get_id(const std::string& str) const;
 
+   uint64_t get_general_count() const{
+      return general_count;
+   }
+
    const std::string& get_str(uint64_t id) const;
 
    uint32_t get_colid(const std::string& str) const;
@@ -0,0 +1,26 @@
+#ifndef SILO_LINEAGE_TREE_H
+#define SILO_LINEAGE_TREE_H
+
+#include <silo/storage/Dictionary.h>
+#include <cstdint>
+#include <vector>
+
+namespace silo {
+
+/// Hierarchy of the pango lineages of the dictionary. The parent of a lineage is its longest proper prefix
+/// that ends before a dot and is a lineage of the dictionary itself, such that B.1.1 is a sublineage of B.1, but B.11 is not.
+/// Built once per database, shared by all partitions.
+struct lineage_tree_t {
+   /// UINT32_MAX for the roots
+   std::vector<uint32_t> parent;
+   std::vector<std::vector<uint32_t>> children;
+   /// The lineages by their depth in the tree, roots first. The lineages of a level can be processed
+   /// in parallel once all deeper levels are done.
+   std::vector<std::vector<uint32_t>> levels;
+
+   static lineage_tree_t build(const Dictionary& dict);
+};
+
+} // namespace silo
+
+#endif //SILO_LINEAGE_TREE_H
@@ -10,21 +10,55 @@
 
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
+#include <algorithm>
+#include <boost/serialization/version.hpp>
+#include <optional>
 #include <silo/roaring/roaring_serialize.h>
+#include <unordered_map>
 
 namespace silo {
 
+/// Days since the epoch. Rounds to the nearest day, such that dates parsed to local midnight map to their own day.
+inline uint32_t to_day(time_t time) {
+   constexpr time_t seconds_per_day = 24 * 60 * 60;
+   return time < 0 ? 0 : (time + seconds_per_day / 2) / seconds_per_day;
+}
+
+/// The date of a day number as YYYY-MM-DD
+std::string day_to_string(uint32_t day);
+
+struct MetaStore;
+
+void build_date_index(MetaStore& mdb);
+
 struct MetaStore {
    friend class boost::serialization::access;
+
+   /// Version 0 archives hold the dates as time_t without the date index and materialize every sublineage bitmap.
+   /// Version 1 holds the day numbers with their index and the sublineage sources.
+   static constexpr unsigned archive_version = 1;
+
    template <class Archive>
-   [[maybe_unused]] void serialize(Archive& ar, const unsigned int /* version */) {
+   [[maybe_unused]] void serialize(Archive& ar, const unsigned int version) {
       ar& sid_to_epi;
 
-      ar& sid_to_date;
+      if (version == 0) {
+         std::vector<time_t> sid_to_date;
+         ar& sid_to_date;
+         sid_to_day.resize(sid_to_date.size());
+         std::transform(sid_to_date.begin(), sid_to_date.end(), sid_to_day.begin(), to_day);
+      } else {
+         ar& sid_to_day;
+         ar& sorted_days;
+         ar& until_day_bitmaps;
+      }
 
       ar& sid_to_lineage;
       ar& lineage_bitmaps;
       ar& sublineage_bitmaps;
+      if (version >= 1) {
+         ar& sublineage_source;
+      }
 
       ar& sid_to_region;
       ar& region_bitmaps;
@@ -33,15 +67,35 @@ struct MetaStore {
       ar& country_bitmaps;
 
       ar& cols;
+
+      if (version == 0) {
+         sublineage_source.assign(sublineage_bitmaps.size(), UINT32_MAX);
+         build_date_index(*this);
+      }
    }
 
    std::vector<uint64_t> sid_to_epi;
-   std::vector<time_t> sid_to_date;
+   /// Dates as day numbers, see to_day
+   std::vector<uint32_t> sid_to_day;
+   /// The distinct days of the partition in ascending order and, for each of them,
+   /// the rows with a date up to and including that day. Built by build_date_index.
+   std::vector<uint32_t> sorted_days;
+   std::vector<roaring::Roaring> until_day_bitmaps;
 
    // TODO only ints -> Dictionary:
    std::vector<uint32_t> sid_to_lineage;
    std::vector<roaring::Roaring> lineage_bitmaps;
+   /// The rows of a lineage and its sublineages are materialized in sublineage_bitmaps only where they stem
+   /// from more than one lineage. Otherwise sublineage_source names the single lineage they stem from,
+   /// and the bitmap is its entry in lineage_bitmaps. UINT32_MAX for materialized ones.
    std::vector<roaring::Roaring> sublineage_bitmaps;
+   std::vector<uint32_t> sublineage_source;
+
+   /// The rows of the lineage and its sublineages
+   const roaring::Roaring& sublineage_bitmap(uint32_t lineage) const {
+      const uint32_t source = sublineage_source[lineage];
+      return source == UINT32_MAX ? sublineage_bitmaps[lineage] : lineage_bitmaps[source];
+   }
 
    std::vector<uint32_t> sid_to_region;
    std::vector<roaring::Roaring> region_bitmaps;
@@ -50,6 +104,10 @@ struct MetaStore {
    std::vector<roaring::Roaring> country_bitmaps;
 
    std::vector<std::vector<uint64_t>> cols;
+
+   /// Per column of cols: the rows of each value, if the column is indexed. Not serialized,
+   /// rebuilt by build_col_indexes because the indexed columns are configurable.
+   std::vector<std::optional<std::unordered_map<uint64_t, roaring::Roaring>>> col_bitmaps;
 };
 
 void inputSequenceMeta(MetaStore& mdb, uint64_t epi, time_t date, uint32_t pango_lineage,
@@ -57,10 +115,19 @@ void inputSequenceMeta(MetaStore& mdb, uint64_t epi, time_t date, uint32_t pango
 
 void chunk_info(const MetaStore& mdb, std::ostream& out);
 
+/// The rows with a date up to and including day, nullptr if there are none
+const roaring::Roaring* rows_until_day(const MetaStore& mdb, uint32_t day);
+
+/// Builds the bitmap index of the given columns. Columns with more distinct values than
+/// max_distinct_share of the rows are left to a scan, their index would hardly be smaller.
+void build_col_indexes(MetaStore& mdb, const std::vector<uint32_t>& columns, double max_distinct_share);
+
 unsigned save_meta(const MetaStore& db, const std::string& db_filename);
 
 unsigned load_meta(MetaStore& db, const std::string& db_filename);
 
 } // namespace silo;
 
+BOOST_CLASS_VERSION(silo::MetaStore, silo::MetaStore::archive_version)
+
 #endif //SILO_META_STORE_H
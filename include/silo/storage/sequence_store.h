@@ -6,8 +6,16 @@
 #define SILO_SEQUENCE_STORE_H
 
 #include "meta_store.h"
+#include "silo/common/mapped_file.h"
 #include "silo/roaring/roaring.hh"
 #include "silo/roaring/roaring_serialize.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/serialization/version.hpp>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 namespace silo {
 
@@ -25,59 +33,117 @@ struct Position {
    uint32_t flipped_bitmap = UINT32_MAX;
 };
 
-struct CompressedPosition {
-   friend class boost::serialization::access;
-
-   template <class Archive>
-   void serialize(Archive& ar, [[maybe_unused]] const unsigned int version) {
-      ar& flipped_bitmap;
-      ar& bitmaps;
-   }
-
-   roaring::Roaring bitmaps[symbolCount];
-   // Reference bitmap is flipped
-   uint32_t flipped_bitmap;
+/// Header of the positions file of a partition, see SequenceStore::save_positions.
+/// It is followed by the positions_file_entry_t of every bitmap, ordered by position and symbol,
+/// the flipped_bitmap of every position, and the bitmaps in roaring's frozen format, each aligned to 32 bytes.
+struct positions_file_header_t {
+   char magic[8];
+   uint32_t version;
+   uint32_t genome_length;
+   uint32_t symbol_count;
+   uint32_t sequence_count;
 };
 
-class SequenceStore;
-
-class CompressedSequenceStore {
-   private:
-   unsigned sequence_count;
-
-   public:
-   friend class boost::serialization::access;
+/// A run of N of the sequence sid over the 0-indexed positions [start, end), see SequenceStore::compress_n_runs
+struct n_run_t {
+   uint32_t start;
+   uint32_t end;
+   uint32_t sid;
 
    template <class Archive>
    void serialize(Archive& ar, [[maybe_unused]] const unsigned int version) {
-      ar& sequence_count;
-      ar& positions;
-      ar& start_gaps;
-      ar& end_gaps;
+      ar& start;
+      ar& end;
+      ar& sid;
    }
+};
 
-   explicit CompressedSequenceStore(const SequenceStore& seq_store);
+struct positions_file_entry_t {
+   uint64_t offset;
+   uint64_t length;
+};
 
-   CompressedPosition positions[genomeLength];
-   std::vector<uint32_t> start_gaps;
-   std::vector<uint32_t> end_gaps;
+/// Positions that are mapped on first access, see SequenceStore::map_positions
+struct lazy_positions_t {
+   static constexpr uint32_t load_stripes = 64;
+
+   const positions_file_entry_t* entries;
+   std::atomic<bool> loaded[genomeLength] = {};
+   /// Set on access, cleared by the clock hand of evict_positions
+   std::atomic<bool> referenced[genomeLength] = {};
+   std::mutex load_mutex[load_stripes];
+   std::atomic<size_t> loaded_bytes = 0;
+   uint32_t clock_hand = 0;
 };
 
 class SequenceStore {
    private:
-   unsigned sequence_count;
+   unsigned sequence_count = 0;
+   /// Backs the bitmaps of the positions if they are mapped, see map_positions. Declared before the positions,
+   /// such that it outlives them.
+   std::shared_ptr<const MappedFile> positions_file;
+   std::unique_ptr<lazy_positions_t> lazy;
+
+   /// Maps the bitmaps of the 0-indexed position p, if it is not yet loaded
+   void load_position(uint32_t p) const;
 
    public:
-   friend class CompressedSequenceStore;
    friend class boost::serialization::access;
 
+   /// Version 0 archives hold the positions. Later versions leave them to the positions file, see save_positions.
+   /// Version 2 adds the edge gaps, version 3 the runs of N.
+   static constexpr unsigned archive_version = 3;
+   static constexpr uint32_t positions_file_version = 1;
+
    template <class Archive>
-   void serialize(Archive& ar, [[maybe_unused]] const unsigned int version) {
+   void serialize(Archive& ar, const unsigned int version) {
       ar& sequence_count;
-      ar& positions;
+      if (version == 0) {
+         ar& positions;
+      }
+      ar& variant_positions;
+      ar& variant_bitmaps;
+      if (version >= 2) {
+         ar& start_gaps;
+         ar& end_gaps;
+         ar& start_gap_order;
+         ar& end_gap_order;
+      }
+      if (version >= 3) {
+         ar& n_runs;
+      }
+      if constexpr (Archive::is_loading::value) {
+         positions_in_archive = version == 0;
+         build_n_run_index();
+      }
    }
    Position positions[genomeLength];
-
+   /// Whether the last archive this store was loaded from held the positions. Otherwise they must be mapped.
+   bool positions_in_archive = true;
+   /// Sorted 0-indexed positions at which some sequence has an A, C, G, T or gap differing from the reference,
+   /// see build_variant_index. All other positions cannot contribute to mutations of this partition.
+   std::vector<uint32_t> variant_positions;
+   /// Per entry of variant_positions, the sequences with an A, C, G, T or gap differing from the reference
+   std::vector<roaring::Roaring> variant_bitmaps;
+   /// Per sequence, the number of leading and trailing gaps that are not stored in the gap bitmaps, see compress_edge_gaps.
+   /// Empty if the edge gaps are stored in the bitmaps. The extents of a sequence do not overlap.
+   std::vector<uint32_t> start_gaps;
+   std::vector<uint32_t> end_gaps;
+   /// The sequences with leading (trailing) gaps, by descending start_gaps (end_gaps). The sequences whose edge gaps
+   /// cover a position are a prefix of each, see leading_gaps and trailing_gaps.
+   std::vector<uint32_t> start_gap_order;
+   std::vector<uint32_t> end_gap_order;
+   /// Runs of N that are not stored in the N bitmaps, see compress_n_runs. Sorted by start, the runs of a sequence do not overlap.
+   std::vector<n_run_t> n_runs;
+   /// Per n_run_stride positions, the indexes into n_runs of the runs covering the first of them, see for_each_n_run.
+   /// Not serialized, it is rebuilt after loading.
+   std::vector<std::vector<uint32_t>> n_run_checkpoints;
+   static constexpr uint32_t n_run_stride = 256;
+   /// Precomputed bma results of A, C, G and T per 0-indexed position, see build_ambiguity_index.
+   /// Not serialized, it is rebuilt after loading.
+   std::unordered_map<uint32_t, std::array<roaring::Roaring, 4>> ambiguity_index;
+
+   /// Only counts the loaded positions of lazily mapped stores
    [[nodiscard]] size_t computeSize() const {
       size_t result = 0;
       for (auto& p : positions) {
@@ -91,22 +157,165 @@ class SequenceStore {
    /// default constructor
    SequenceStore() {}
 
-   /// decompress sequence_store
-   explicit SequenceStore(const CompressedSequenceStore& c_seq_store);
+   /// Number of sequences in start_gap_order whose leading gaps cover the 0-indexed position p
+   [[nodiscard]] size_t leading_gaps(uint32_t p) const {
+      return std::partition_point(start_gap_order.begin(), start_gap_order.end(), [&](uint32_t sid) { return start_gaps[sid] > p; }) - start_gap_order.begin();
+   }
+
+   /// Number of sequences in end_gap_order whose trailing gaps cover the 0-indexed position p
+   [[nodiscard]] size_t trailing_gaps(uint32_t p) const {
+      return std::partition_point(end_gap_order.begin(), end_gap_order.end(), [&](uint32_t sid) { return end_gaps[sid] > genomeLength - 1 - p; }) - end_gap_order.begin();
+   }
+
+   /// Whether sequences have gaps at the 1-indexed position pos that are not in its gap bitmap
+   [[nodiscard]] bool has_edge_gaps(size_t pos) const {
+      return leading_gaps(pos - 1) > 0 || trailing_gaps(pos - 1) > 0;
+   }
+
+   /// Calls f with every run in n_runs that covers the 0-indexed position p. These are the runs of the checkpoint
+   /// before p that reach p, and the runs starting after the checkpoint up to p that reach p.
+   template <typename F>
+   void for_each_n_run(uint32_t p, F f) const {
+      if (n_runs.empty()) {
+         return;
+      }
+      const uint32_t checkpoint = p / n_run_stride * n_run_stride;
+      for (uint32_t r : n_run_checkpoints[p / n_run_stride]) {
+         if (n_runs[r].end > p) {
+            f(n_runs[r]);
+         }
+      }
+      auto it = std::upper_bound(n_runs.begin(), n_runs.end(), checkpoint, [](uint32_t v, const n_run_t& run) { return v < run.start; });
+      for (; it != n_runs.end() && it->start <= p; ++it) {
+         if (it->end > p) {
+            f(*it);
+         }
+      }
+   }
+
+   /// Number of runs in n_runs that cover the 0-indexed position p
+   [[nodiscard]] size_t n_run_count(uint32_t p) const {
+      size_t ret = 0;
+      for_each_n_run(p, [&](const n_run_t&) { ++ret; });
+      return ret;
+   }
+
+   /// Whether rows with the symbol at the 1-indexed position pos are stored outside of its bitmap,
+   /// as edge gaps or runs of N. bm(pos, s) then is incomplete and bma has to be used.
+   [[nodiscard]] bool has_extents(size_t pos, Symbol s) const {
+      return (s == Symbol::gap && has_edge_gaps(pos)) || (s == Symbol::N && n_run_count(pos - 1) > 0);
+   }
+
+   /// Number of sequences with the symbol at the 1-indexed position, including the edge gaps and runs of N.
+   /// For a flipped symbol this counts its bitmap, the sequences without it.
+   [[nodiscard]] uint64_t symbol_count(size_t pos, Symbol s) const {
+      uint64_t ret = bm(pos, s)->cardinality();
+      if (s == Symbol::gap) {
+         ret += leading_gaps(pos - 1) + trailing_gaps(pos - 1);
+      } else if (s == Symbol::N) {
+         ret += n_run_count(pos - 1);
+      }
+      return ret;
+   }
+
+   /// The 0-indexed position p, loaded first if the positions are mapped lazily.
+   /// The flipped_bitmap of positions[p] is always valid without loading it.
+   [[nodiscard]] const Position& position(uint32_t p) const {
+      if (lazy) {
+         if (!lazy->loaded[p].load(std::memory_order_acquire)) {
+            load_position(p);
+         }
+         lazy->referenced[p].store(true, std::memory_order_relaxed);
+      }
+      return positions[p];
+   }
 
    /// pos: 1 indexed position of the genome
    [[nodiscard]] const roaring::Roaring* bm(size_t pos, Symbol s) const {
-      return &positions[pos - 1].bitmaps[s];
+      return &position(pos - 1).bitmaps[s];
    }
 
+   /// pos: 1 indexed position of the genome
+   /// Adds the sequences in [begin, end) whose edge gaps cover the position to bitmap
+   void add_edge_gaps(size_t pos, roaring::Roaring& bitmap, uint32_t begin = 0, uint32_t end = UINT32_MAX) const;
+
+   /// pos: 1 indexed position of the genome
+   /// Adds the sequences in [begin, end) whose runs of N in n_runs cover the position to bitmap
+   void add_n_runs(size_t pos, roaring::Roaring& bitmap, uint32_t begin = 0, uint32_t end = UINT32_MAX) const;
+
+   /// Returns the sequences in [begin, end) with an N at any of the 1-indexed positions [from, to],
+   /// the complement of the sequences covered over the range
+   [[nodiscard]] roaring::Roaring* uncovered(size_t from, size_t to, uint32_t begin = 0, uint32_t end = UINT32_MAX) const;
+
    /// Returns an Roaring-bitmap which has the given residue r at the position pos,
    /// where the residue is interpreted in the _a_pproximate meaning
    /// That means a symbol matches all mixed symbols, which can indicate the residue
    /// pos: 1 indexed position of the genome
-   [[nodiscard]] roaring::Roaring* bma(size_t pos, Symbol r) const;
+   /// Only the rows [begin, end) are considered, see bitmap_view
+   [[nodiscard]] roaring::Roaring* bma(size_t pos, Symbol r, uint32_t begin = 0, uint32_t end = UINT32_MAX) const;
+
+   /// Same as before for flipped bitmaps for r, returns the complement of the result of bma
+   [[nodiscard]] roaring::Roaring* bma_neg(size_t pos, Symbol r, uint32_t begin = 0, uint32_t end = UINT32_MAX) const;
+
+   /// The result of bma(pos, r), or of bma_neg(pos, r) if the bitmap of r is flipped, without computing it.
+   /// Returns nullptr if the position is not in the ambiguity index and has ambiguous symbols for r.
+   [[nodiscard]] const roaring::Roaring* bma_precomputed(size_t pos, Symbol r) const;
+
+   /// Precomputes bma (bma_neg for the flipped symbol) of A, C, G and T for all positions at which
+   /// at least min_density of the sequences have an ambiguous symbol. A density above 1 drops the index.
+   /// Must be rebuilt whenever the bitmaps are flipped.
+   void build_ambiguity_index(double min_density);
+
+   /// Computes variant_positions and variant_bitmaps against the reference. Must be rebuilt whenever the bitmaps are flipped.
+   void build_variant_index(const std::string& reference);
+
+   /// Removes the leading and trailing gaps of every sequence from the gap bitmaps and keeps only their extents
+   /// in start_gaps and end_gaps. bm(pos, gap) then holds only the inner gaps, all other accessors include the edge gaps.
+   /// Flipped bitmaps are unchanged, they still hold the edge gaps as sequences without their symbol.
+   void compress_edge_gaps();
+
+   /// Moves every run of at least min_length N of a sequence from the N bitmaps to n_runs and indexes them.
+   /// bm(pos, N) then holds only the shorter runs, all other accessors include the runs in n_runs.
+   void compress_n_runs(uint32_t min_length);
+
+   /// Computes n_run_checkpoints from n_runs
+   void build_n_run_index();
+
+   /// The sequences with an A, C, G, T or gap differing from the reference at the 0-indexed position,
+   /// nullptr if there are none
+   [[nodiscard]] const roaring::Roaring* variants(uint32_t pos) const {
+      auto it = std::lower_bound(variant_positions.begin(), variant_positions.end(), pos);
+      if (it == variant_positions.end() || *it != pos) {
+         return nullptr;
+      }
+      return &variant_bitmaps[it - variant_positions.begin()];
+   }
+
+   /// Writes the positions in the versioned positions file format, which map_positions serves without copying
+   void save_positions(const std::string& filename) const;
 
-   /// Same as before for flipped bitmaps for r
-   [[nodiscard]] roaring::Roaring* bma_neg(size_t pos, Symbol r) const;
+   /// Maps the positions file and serves the bitmaps of all positions as read-only views into the mapping.
+   /// The bitmaps must not be modified afterwards. Throws std::runtime_error if the file does not fit this store.
+   /// If lazy, only the flipped symbols are read up front and the bitmaps of a position are mapped by its first access.
+   void map_positions(const std::string& filename, bool lazy = false);
+
+   [[nodiscard]] bool positions_mapped() const {
+      return positions_file != nullptr;
+   }
+
+   [[nodiscard]] bool positions_lazy() const {
+      return lazy != nullptr;
+   }
+
+   /// Bytes of the positions file backing the loaded positions of a lazily mapped store
+   [[nodiscard]] size_t loaded_position_bytes() const {
+      return lazy ? lazy->loaded_bytes.load() : 0;
+   }
+
+   /// Unloads lazily mapped positions that were not accessed recently, until at most budget bytes remain loaded.
+   /// Their pages are released and mapped again on the next access. Returns the number of released bytes.
+   /// Must not run concurrently with any access to the positions, see Database::trim_positions.
+   size_t evict_positions(size_t budget) const;
 
    void interpret(const std::vector<std::string>& genomes);
 
@@ -125,4 +334,6 @@ class SequenceStore {
 
 } //namespace silo;
 
+BOOST_CLASS_VERSION(silo::SequenceStore, silo::SequenceStore::archive_version)
+
 #endif //SILO_SEQUENCE_STORE_H
@@ -30,7 +30,7 @@ int silo::benchmark(const Database& db, std::istream& query_defs, const std::str
       return 0;
    }
 
-   count_perf_table << "test_name\tparse_time\tfilter_time\taction_time\n";
+   count_perf_table << "test_name\tparse_time\tfilter_time\taction_time\tinterpreted_filter_time\n";
    list_perf_table << "test_name\tparse_time\tfilter_time\taction_time\n";
    mutations_perf_table << "test_name\tparse_time\tfilter_time\taction_time\n";
 
@@ -50,34 +50,40 @@ int silo::benchmark(const Database& db, std::istream& query_defs, const std::str
       std::stringstream buffer;
       buffer << query_file.rdbuf();
 
-      // COUNT
+      const std::string count_query = "{\"action\": {\"type\": \"Aggregated\"" /*,\"groupByFields\": [\"date\",\"division\"]*/ "},\"filter\": " + buffer.str() + "}";
+      const std::string list_query = "{\"action\": {\"type\": \"List\"},\"filter\": " + buffer.str() + "}";
+      const std::string mutations_query = "{\"action\": {\"type\": \"Mutations\"},\"filter\": " + buffer.str() + "}";
+
+      /// Compare the compiled filter against the interpreter on the same query, both starting with an empty result cache
+      int64_t interpreted_filter_time;
+      {
+         db.result_cache->clear();
+         std::ofstream result_file(count_query_out_dir_str + test_name + ".interpreted.res");
+         std::ofstream performance_file(count_query_out_dir_str + test_name + ".interpreted.perf");
+         interpreted_filter_time = execute_query(db, count_query, result_file, performance_file, false).filter_time;
+      }
       {
-         std::string query = "{\"action\": {\"type\": \"Aggregated\"" /*,\"groupByFields\": [\"date\",\"division\"]*/ "},\"filter\": " + buffer.str() + "}";
+         db.result_cache->clear();
          std::ofstream result_file(count_query_out_dir_str + test_name + ".res");
          std::ofstream performance_file(count_query_out_dir_str + test_name + ".perf");
-         auto result = execute_query(db, query, result_file, performance_file);
+         auto result = execute_query(db, count_query, result_file, performance_file, true);
          std::cout << result.return_message << std::endl;
-         count_perf_table << test_name << "\t" << result.parse_time << "\t" << result.filter_time << "\t" << result.action_time << std::endl;
+         count_perf_table << test_name << "\t" << result.parse_time << "\t" << result.filter_time << "\t" << result.action_time
+                          << "\t" << interpreted_filter_time << std::endl;
       }
 
-      // LIST
-      {
-         std::string query = "{\"action\": {\"type\": \"List\"},\"filter\": " + buffer.str() + "}";
-         std::ofstream result_file(list_query_out_dir_str + test_name + ".res");
-         std::ofstream performance_file(list_query_out_dir_str + test_name + ".perf");
-         auto result = execute_query(db, query, result_file, performance_file);
-         std::cout << result.return_message << std::endl;
-         list_perf_table << test_name << "\t" << result.parse_time << "\t" << result.filter_time << "\t" << result.action_time << std::endl;
-      }
+      /// List and mutations share one evaluation of the filter, whose log is written once for both
+      db.result_cache->clear();
+      std::ofstream performance_file(query_dir_str + test_name + ".batch.perf");
+      std::vector<result_s> results = execute_queries(db, {list_query, mutations_query}, performance_file, true);
 
-      // MUTATIONS
-      {
-         std::string query = "{\"action\": {\"type\": \"Mutations\"},\"filter\": " + buffer.str() + "}";
-         std::ofstream result_file(mutations_query_out_dir_str + test_name + ".res");
-         std::ofstream performance_file(mutations_query_out_dir_str + test_name + ".perf");
-         auto result = execute_query(db, query, result_file, performance_file);
+      const std::string out_dirs[] = {list_query_out_dir_str, mutations_query_out_dir_str};
+      std::ofstream* perf_tables[] = {&list_perf_table, &mutations_perf_table};
+      for (size_t q = 0; q < results.size(); ++q) {
+         const result_s& result = results[q];
+         std::ofstream(out_dirs[q] + test_name + ".res") << result.return_message;
          std::cout << result.return_message << std::endl;
-         mutations_perf_table << test_name << "\t" << result.parse_time << "\t" << result.filter_time << "\t" << result.action_time << std::endl;
+         *perf_tables[q] << test_name << "\t" << result.parse_time << "\t" << result.filter_time << "\t" << result.action_time << std::endl;
       }
    }
    return 0;
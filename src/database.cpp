@@ -54,23 +54,22 @@ void silo::Database::build(const std::string& part_prefix, const std::string& me
    finalize();
 }
 
-void silo::DatabasePartition::finalize(const Dictionary& dict) {
+void silo::DatabasePartition::build_zone_maps() {
+   for (auto& chunk : chunks) {
+      auto begin = meta_store.sid_to_day.begin() + chunk.offset;
+      auto end = begin + chunk.count;
+      chunk.min_day = begin == end ? UINT32_MAX : *std::min_element(begin, end);
+      chunk.max_day = begin == end ? 0 : *std::max_element(begin, end);
+   }
+}
+
+void silo::DatabasePartition::finalize(const Dictionary& dict, const lineage_tree_t& lineage_tree, const std::string& reference, bool compress_edge_gaps, uint32_t n_run_min_length) {
    std::vector<std::vector<unsigned>> counts_per_pos_per_symbol;
    counts_per_pos_per_symbol.resize(genomeLength);
    for (std::vector<unsigned>& v : counts_per_pos_per_symbol) {
       v.resize(symbolCount);
    }
 
-   for (auto& chunk : chunks) {
-      for (auto& pango : chunk.pangos) {
-         uint32_t pango_id = dict.get_pangoid(pango);
-         if (pango_id != UINT32_MAX && std::find(sorted_lineages.begin(), sorted_lineages.end(), pango_id) != sorted_lineages.end()) {
-            sorted_lineages.push_back(pango_id);
-         }
-      }
-   }
-   std::sort(sorted_lineages.begin(), sorted_lineages.end());
-
    tbb::parallel_for((unsigned) 0, genomeLength, [&](unsigned p) {
       unsigned max_symbol = UINT32_MAX;
       unsigned max_count = 0;
@@ -87,6 +86,14 @@ void silo::DatabasePartition::finalize(const Dictionary& dict) {
          seq_store.positions[p].bitmaps[max_symbol].flip(0, sequenceCount);
       }
    });
+   /// The variants include the edge gaps, which are stripped from the bitmaps afterwards
+   seq_store.build_variant_index(reference);
+   if (compress_edge_gaps) {
+      seq_store.compress_edge_gaps();
+   }
+   if (n_run_min_length > 0) {
+      seq_store.compress_n_runs(n_run_min_length);
+   }
 
    { /// Precompute all bitmaps for pango_lineages and -sublineages
       const uint32_t pango_count = dict.get_pango_count();
@@ -101,31 +108,49 @@ void silo::DatabasePartition::finalize(const Dictionary& dict) {
          meta_store.lineage_bitmaps[pango].addMany(group_by_lineages[pango].size(), group_by_lineages[pango].data());
       }
 
-      meta_store.sublineage_bitmaps.resize(pango_count);
-
-      for (uint32_t pango1 = 0; pango1 < pango_count; ++pango1) {
-         // Initialize with all lineages that are in pango1
-         std::vector<uint32_t> group_by_lineages_sub(group_by_lineages[pango1]);
+      sorted_lineages.clear();
+      for (uint32_t pango = 0; pango < pango_count; ++pango) {
+         if (!group_by_lineages[pango].empty()) {
+            sorted_lineages.push_back(pango);
+         }
+      }
 
-         // Now add all lineages that I am a prefix of
-         for (uint32_t pango2 = 0; pango2 < pango_count; ++pango2) {
-            const std::string& str1 = dict.get_pango(pango1);
-            const std::string& str2 = dict.get_pango(pango2);
-            if (str1.length() >= str2.length()) {
-               continue;
+      /// Bottom-up along the lineage tree, the sublineages of a lineage are the union of its own rows
+      /// and the sublineages of its children
+      meta_store.sublineage_bitmaps.clear();
+      meta_store.sublineage_bitmaps.resize(pango_count);
+      meta_store.sublineage_source.assign(pango_count, UINT32_MAX);
+      for (auto level = lineage_tree.levels.rbegin(); level != lineage_tree.levels.rend(); ++level) {
+         tbb::parallel_for_each(level->begin(), level->end(), [&](uint32_t pango) {
+            std::vector<const roaring::Roaring*> parts;
+            uint32_t single_source = pango;
+            if (!group_by_lineages[pango].empty()) {
+               parts.push_back(&meta_store.lineage_bitmaps[pango]);
             }
-            // Check if str1 is a prefix of str2 -> str2 is a sublineage of str1
-            if (str2.starts_with(str1)) {
-               for (uint32_t pid : group_by_lineages[pango2])
-                  group_by_lineages_sub.push_back(pid);
+            for (uint32_t child : lineage_tree.children[pango]) {
+               const roaring::Roaring& child_bitmap = meta_store.sublineage_bitmap(child);
+               if (!child_bitmap.isEmpty()) {
+                  parts.push_back(&child_bitmap);
+                  single_source = meta_store.sublineage_source[child];
+               }
             }
-         }
-         // Sort, for roaring insert
-         std::sort(group_by_lineages_sub.begin(), group_by_lineages_sub.end());
-         meta_store.sublineage_bitmaps[pango1].addMany(group_by_lineages_sub.size(), group_by_lineages_sub.data());
+            if (parts.size() > 1 || (parts.size() == 1 && single_source == UINT32_MAX)) {
+               meta_store.sublineage_bitmaps[pango] = roaring::Roaring::fastunion(parts.size(), parts.data());
+               meta_store.sublineage_bitmaps[pango].runOptimize();
+               meta_store.sublineage_bitmaps[pango].shrinkToFit();
+            } else {
+               /// Without rows the source is the lineage itself, whose bitmap is empty
+               meta_store.sublineage_source[pango] = parts.empty() ? pango : single_source;
+            }
+         });
       }
    }
 
+   { /// Precompute the date index and the zone maps of the chunks
+      build_date_index(meta_store);
+      build_zone_maps();
+   }
+
    { /// Precompute all bitmaps for countries
       const uint32_t country_count = dict.get_country_count();
       std::vector<std::vector<uint32_t>> group_by_country(country_count);
@@ -135,8 +160,12 @@ void silo::DatabasePartition::finalize(const Dictionary& dict) {
       }
 
       meta_store.country_bitmaps.resize(country_count);
+      sorted_countries.clear();
       for (uint32_t country = 0; country < country_count; ++country) {
          meta_store.country_bitmaps[country].addMany(group_by_country[country].size(), group_by_country[country].data());
+         if (!group_by_country[country].empty()) {
+            sorted_countries.push_back(country);
+         }
       }
    }
 
@@ -149,15 +178,62 @@ void silo::DatabasePartition::finalize(const Dictionary& dict) {
       }
 
       meta_store.region_bitmaps.resize(region_count);
+      sorted_regions.clear();
       for (uint32_t region = 0; region < region_count; ++region) {
          meta_store.region_bitmaps[region].addMany(group_by_region[region].size(), group_by_region[region].data());
+         if (!group_by_region[region].empty()) {
+            sorted_regions.push_back(region);
+         }
       }
    }
 }
 
 void silo::Database::finalize() {
+   result_cache->clear();
+   const lineage_tree_t lineage_tree = lineage_tree_t::build(*dict);
+   tbb::parallel_for_each(partitions.begin(), partitions.end(), [&](DatabasePartition& p) {
+      p.finalize(*dict, lineage_tree, global_reference[0], compress_edge_gaps, n_run_min_length);
+   });
+   build_indexes();
+}
+
+void silo::Database::trim_positions() const {
+   if (position_budget_bytes == SIZE_MAX) {
+      return;
+   }
+   std::unique_lock<std::shared_mutex> lock(*positions_in_use, std::try_to_lock);
+   if (!lock.owns_lock()) {
+      /// A query is running, the next one trims
+      return;
+   }
+   size_t loaded = 0;
+   for (const DatabasePartition& dbp : partitions) {
+      loaded += dbp.seq_store.loaded_position_bytes();
+   }
+   if (loaded <= position_budget_bytes) {
+      return;
+   }
+   /// Every partition gives up its share of the excess, in proportion to what it has loaded
+   const double keep = (double) position_budget_bytes / (double) loaded;
+   tbb::parallel_for_each(partitions.begin(), partitions.end(), [&](const DatabasePartition& dbp) {
+      dbp.seq_store.evict_positions((size_t) (keep * (double) dbp.seq_store.loaded_position_bytes()));
+   });
+}
+
+void silo::Database::build_indexes() {
+   result_cache->clear();
+   std::vector<uint32_t> columns;
+   for (const std::string& column : indexed_columns) {
+      const uint32_t col = dict->get_colid(column);
+      if (col == UINT32_MAX) {
+         std::cerr << "Unknown column " << column << ", not indexed." << std::endl;
+      } else {
+         columns.push_back(col);
+      }
+   }
    tbb::parallel_for_each(partitions.begin(), partitions.end(), [&](DatabasePartition& p) {
-      p.finalize(*dict);
+      p.seq_store.build_ambiguity_index(ambiguity_index_density);
+      build_col_indexes(p.meta_store, columns, col_index_max_distinct_share);
    });
 }
 
@@ -207,6 +283,7 @@ int silo::Database::db_info(std::ostream& io) {
 
    std::osyncstream(io) << "sequence count: " << number_fmt(sequence_count) << std::endl;
    std::osyncstream(io) << "total size: " << number_fmt(total_size) << std::endl;
+   result_cache->info(io);
 
    return 0;
 }
@@ -216,8 +293,8 @@ int silo::Database::db_info_detailed(std::ostream& io) {
 
    tbb::parallel_for((unsigned) 0, symbolCount, [&](unsigned symbol) {
       for (const DatabasePartition& dbp : partitions) {
-         for (const auto& position : dbp.seq_store.positions) {
-            size_by_symbols[symbol] += position.bitmaps[symbol].getSizeInBytes();
+         for (unsigned pos = 0; pos < genomeLength; ++pos) {
+            size_by_symbols[symbol] += dbp.seq_store.position(pos).bitmaps[symbol].getSizeInBytes();
          }
       }
    });
@@ -248,7 +325,7 @@ int silo::Database::db_info_detailed(std::ostream& io) {
       {
          r_stat s;
          for (const auto& dbp : partitions) {
-            const Position& p = dbp.seq_store.positions[pos];
+            const Position& p = dbp.seq_store.position(pos);
             for (const roaring::Roaring& bm : p.bitmaps) {
                roaring_bitmap_statistics(&bm.roaring, &s);
                addStat(s_local, s);
@@ -461,10 +538,15 @@ void silo::Database::save(const std::string& save_dir) {
       }
    }
 
-   tbb::parallel_for((size_t) 0, part_def->partitions.size(), [&](size_t i) {
-      ::boost::archive::binary_oarchive oa(file_vec[i]);
-      oa << partitions[i];
-   });
+   try {
+      tbb::parallel_for((size_t) 0, part_def->partitions.size(), [&](size_t i) {
+         ::boost::archive::binary_oarchive oa(file_vec[i]);
+         oa << partitions[i];
+         partitions[i].seq_store.save_positions(save_dir + 'P' + std::to_string(i) + ".pos");
+      });
+   } catch (const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+   }
 }
 
 void silo::Database::load(const std::string& save_dir) {
@@ -490,6 +572,7 @@ void silo::Database::load(const std::string& save_dir) {
       dict = std::make_unique<Dictionary>(Dictionary::load_dict(dict_input));
    }
 
+   result_cache->clear();
    std::cout << "Loading partitions from " << save_dir << std::endl;
    std::vector<std::ifstream> file_vec;
    for (unsigned i = 0; i < part_def->partitions.size(); ++i) {
@@ -501,9 +584,22 @@ void silo::Database::load(const std::string& save_dir) {
       }
    }
 
+   /// Mapped bitmaps are read-only, the partitions are replaced instead of loaded into
+   partitions.clear();
    partitions.resize(part_def->partitions.size());
-   tbb::parallel_for((size_t) 0, part_def->partitions.size(), [&](size_t i) {
-      ::boost::archive::binary_iarchive ia(file_vec[i]);
-      ia >> partitions[i];
-   });
+   try {
+      tbb::parallel_for((size_t) 0, part_def->partitions.size(), [&](size_t i) {
+         ::boost::archive::binary_iarchive ia(file_vec[i]);
+         ia >> partitions[i];
+         /// Older archives still hold the positions
+         if (!partitions[i].seq_store.positions_in_archive) {
+            partitions[i].seq_store.map_positions(save_dir + 'P' + std::to_string(i) + ".pos", lazy_positions);
+         }
+      });
+   } catch (const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      partitions.clear();
+      return;
+   }
+   build_indexes();
 }
\ No newline at end of file
@@ -269,6 +269,40 @@ int handle_command(Database& db, std::vector<std::string> args) {
          saved += shrinkToFit(dbp.seq_store);
       }
       std::cout << "Saved " << saved << " bytes by call to shrink_to_fit." << std::endl;
+   } else if ("cache_size" == args[0]) {
+      if (args.size() > 1) {
+         db.result_cache->set_max_bytes(std::stoul(args[1]));
+      }
+      db.result_cache->info(cout);
+   } else if ("compress_edge_gaps" == args[0]) {
+      /// Takes effect with the next build
+      db.compress_edge_gaps = args.size() < 2 || args[1] != "0";
+   } else if ("compress_n_runs" == args[0]) {
+      /// Takes effect with the next build, 0 keeps all N in the bitmaps
+      db.n_run_min_length = args.size() > 1 ? std::stoul(args[1]) : 1;
+   } else if ("lazy_positions" == args[0]) {
+      /// Takes effect with the next load
+      db.lazy_positions = args.size() < 2 || args[1] != "0";
+   } else if ("position_budget" == args[0]) {
+      if (args.size() > 1) {
+         db.position_budget_bytes = std::stoul(args[1]);
+         db.trim_positions();
+      }
+      size_t loaded = 0;
+      for (const auto& dbp : db.partitions) {
+         loaded += dbp.seq_store.loaded_position_bytes();
+      }
+      std::cout << "Loaded position bytes: " << loaded << std::endl;
+   } else if ("ambiguity_index" == args[0]) {
+      if (args.size() > 1) {
+         db.ambiguity_index_density = std::stod(args[1]);
+      }
+      db.build_indexes();
+   } else if ("index_columns" == args[0]) {
+      db.indexed_columns.assign(args.begin() + 1, args.end());
+      db.build_indexes();
+   } else if ("clear_cache" == args[0]) {
+      db.result_cache->clear();
    } else if ("exit" == args[0] || "quit" == args[0]) {
       return 1;
    } else if ("help" == args[0] || "-h" == args[0] || "--help" == args[0]) {
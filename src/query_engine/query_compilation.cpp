@@ -0,0 +1,421 @@
+#include <bit>
+#include <silo/common/PerfEvent.hpp>
+#include <silo/query_engine/query_engine.h>
+#include <silo/roaring/roaring_containers.h>
+
+using namespace silo;
+using namespace silo::roaring_containers;
+using roaring::Roaring;
+
+namespace {
+
+enum class op_t : uint8_t {
+   LEAF,
+   FULL,
+   EMPTY,
+   AND,
+   OR,
+   NOT,
+   NOF,
+   CAPTURE
+};
+
+struct instruction_t {
+   op_t op;
+   /// LEAF: index of the leaf, NOF: n, CAPTURE: index of the capture
+   uint32_t arg = 0;
+   /// Number of operands for AND, OR, NOF
+   uint32_t operands = 0;
+   /// AND: number of trailing operands that are subtracted, NOF: index of its fused_nof_t
+   uint32_t negated = 0;
+   bool exactly = false;
+};
+
+/// An NOfEx evaluated by the program, whose decision is recorded once the program has run
+struct fused_nof_t {
+   NOfEx* nof_ex;
+   nof_decision_t decision;
+   int64_t nanoseconds = 0;
+};
+
+/// A cached subexpression that missed its cache and is fused into the program. The CAPTURE instruction collects its result
+/// chunk by chunk, which is put into the cache once the program has run.
+struct capture_t {
+   CachedEx* cached_ex;
+   std::unique_ptr<Roaring> bitmap;
+   /// The negations at the top of the subexpression are not captured, the entry is complemented instead
+   bool complemented;
+   /// Whether the captured result is empty in chunks in which all leaves are empty
+   bool zero_preserving;
+};
+
+bool is_fusable(const BoolExpression& ex) {
+   switch (ex.type()) {
+      case ExType::AND:
+      case ExType::OR:
+      case ExType::NOF:
+      case ExType::NEG:
+         return true;
+      default:
+         return false;
+   }
+}
+
+/// The expression below the negations at the top of ex, complemented is flipped for every negation
+BoolExpression& strip_negations(BoolExpression& ex, bool& complemented) {
+   BoolExpression* ret = &ex;
+   while (ret->type() == ExType::NEG) {
+      ret = dynamic_cast<NegEx*>(ret)->child.get();
+      complemented = !complemented;
+   }
+   return *ret;
+}
+
+/// Adds the rows of the chunk bitset to bitmap, values is a buffer that is left empty
+void add_chunk(Roaring& bitmap, const uint64_t* words, uint32_t base, std::vector<uint32_t>& values) {
+   for (uint32_t w = 0; w < bitset_words; ++w) {
+      for (uint64_t bits = words[w]; bits; bits &= bits - 1) {
+         values.push_back(base + w * 64 + std::countr_zero(bits));
+      }
+   }
+   bitmap.addMany(values.size(), values.data());
+   values.clear();
+}
+
+/// Postfix program over chunk bitsets, evaluated with a stack of bitsets
+struct program_t {
+   std::vector<instruction_t> instructions;
+   std::vector<filter_t> leaves;
+   std::vector<fused_nof_t> fused_nofs;
+   std::vector<capture_t> captures;
+   uint32_t depth = 0;
+   uint32_t max_depth = 0;
+
+   void emit(instruction_t instruction, uint32_t popped) {
+      instructions.push_back(instruction);
+      depth -= popped;
+      max_depth = std::max(max_depth, ++depth);
+   }
+
+   bool add_leaf(filter_t leaf) {
+      emit({op_t::LEAF, (uint32_t) leaves.size()}, 0);
+      leaves.push_back(leaf);
+      if (leaf.complemented) {
+         emit({op_t::NOT}, 1);
+         return false;
+      }
+      return true;
+   }
+
+   /// Whether the operand compiled from instructions_begin on is known to be empty
+   bool is_empty_operand(size_t instructions_begin) const {
+      if (instructions.size() != instructions_begin + 1) {
+         return false;
+      }
+      const instruction_t& instruction = instructions.back();
+      return instruction.op == op_t::EMPTY ||
+             (instruction.op == op_t::LEAF && leaves[instruction.arg].getAsConst()->isEmpty());
+   }
+
+   /// Returns whether the result is empty in every chunk in which all leaves are empty,
+   /// such chunks can then be skipped entirely
+   bool compile(BoolExpression& ex, const Database& db, const DatabasePartition& dbp, slice_t slice) {
+      switch (ex.type()) {
+         case ExType::CACHED: {
+            auto& cached_ex = dynamic_cast<CachedEx&>(ex);
+            bool complemented = false;
+            if (!is_fusable(strip_negations(*cached_ex.child, complemented))) {
+               /// Nothing to fuse, the interpreter looks it up and puts a miss into the cache
+               return add_leaf(ex.evaluate(db, dbp, slice));
+            }
+            if (auto cached = cached_ex.cache->get(cached_ex.key, cached_ex.partition, slice.begin / slice_size)) {
+               return add_leaf({nullptr, cached.bitmap.get(), cached.bitmap, cached.complemented});
+            }
+            return compile_capture(cached_ex, db, dbp, slice);
+         }
+         case ExType::AND: {
+            auto& and_ex = dynamic_cast<AndEx&>(ex);
+            const size_t instructions_begin = instructions.size();
+            const size_t leaves_begin = leaves.size();
+            const size_t fused_nofs_begin = fused_nofs.size();
+            const size_t captures_begin = captures.size();
+            const uint32_t depth_begin = depth;
+            bool zero_preserving = false;
+            for (auto& child : and_ex.children) {
+               const size_t child_begin = instructions.size();
+               zero_preserving |= compile(*child, db, dbp, slice);
+               if (is_empty_operand(child_begin)) {
+                  /// As in AndEx::evaluate, the remaining operands are not evaluated once one is empty
+                  for (size_t l = leaves_begin; l < leaves.size(); ++l) {
+                     leaves[l].free();
+                  }
+                  leaves.resize(leaves_begin);
+                  fused_nofs.resize(fused_nofs_begin);
+                  captures.resize(captures_begin);
+                  instructions.resize(instructions_begin);
+                  depth = depth_begin;
+                  emit({op_t::EMPTY}, 0);
+                  return true;
+               }
+            }
+            for (auto& child : and_ex.negated_children) {
+               compile(*child, db, dbp, slice);
+            }
+            const uint32_t operands = and_ex.children.size() + and_ex.negated_children.size();
+            emit({op_t::AND, 0, operands, (uint32_t) and_ex.negated_children.size()}, operands);
+            return zero_preserving;
+         }
+         case ExType::OR: {
+            auto& or_ex = dynamic_cast<OrEx&>(ex);
+            bool zero_preserving = true;
+            for (auto& child : or_ex.children) {
+               zero_preserving &= compile(*child, db, dbp, slice);
+            }
+            emit({op_t::OR, 0, (uint32_t) or_ex.children.size()}, or_ex.children.size());
+            return zero_preserving;
+         }
+         case ExType::NOF: {
+            auto& nof_ex = dynamic_cast<NOfEx&>(ex);
+            const bool automatic = nof_ex.impl == NOfEx::impl_auto;
+            const unsigned chosen = automatic ? nof_ex.choose_impl(dbp, slice, true) : nof_ex.impl;
+            if (chosen != NOfEx::impl_fused) {
+               /// The implementation chosen by the cost model or the query is run by the interpreter
+               return add_leaf(nof_ex.evaluate(db, dbp, slice));
+            }
+            bool zero_preserving = nof_ex.n > 0;
+            for (auto& child : nof_ex.children) {
+               zero_preserving &= compile(*child, db, dbp, slice);
+            }
+            const double estimated_cost = nof_ex.estimate_cost(NOfEx::impl_fused, dbp, slice);
+            fused_nofs.push_back({&nof_ex, {slice.begin, NOfEx::impl_fused, automatic, estimated_cost, 0}});
+            emit({op_t::NOF, nof_ex.n, (uint32_t) nof_ex.children.size(), (uint32_t) fused_nofs.size() - 1, nof_ex.exactly},
+                 nof_ex.children.size());
+            return zero_preserving;
+         }
+         case ExType::NEG:
+            compile(*dynamic_cast<NegEx&>(ex).child, db, dbp, slice);
+            emit({op_t::NOT}, 1);
+            return false;
+         case ExType::FULL:
+            emit({op_t::FULL}, 0);
+            return false;
+         case ExType::EMPTY:
+            emit({op_t::EMPTY}, 0);
+            return true;
+         default:
+            return add_leaf(ex.evaluate(db, dbp, slice));
+      }
+   }
+
+   /// Fuses a cached subexpression that missed its cache and captures its result
+   bool compile_capture(CachedEx& cached_ex, const Database& db, const DatabasePartition& dbp, slice_t slice) {
+      bool complemented = false;
+      const bool zero_preserving = compile(strip_negations(*cached_ex.child, complemented), db, dbp, slice);
+      captures.push_back({&cached_ex, std::make_unique<Roaring>(), complemented, zero_preserving});
+      emit({op_t::CAPTURE, (uint32_t) captures.size() - 1}, 1);
+      if (complemented) {
+         emit({op_t::NOT}, 1);
+         return false;
+      }
+      return zero_preserving;
+   }
+
+   /// Whether chunks in which all leaves are empty can be skipped, given whether the result is empty in them
+   bool skips_empty_chunks(bool zero_preserving) const {
+      return zero_preserving &&
+             std::all_of(captures.begin(), captures.end(), [](const capture_t& capture) { return capture.zero_preserving; });
+   }
+
+   /// Counts the set bits of the operands per row with a bit-sliced adder and compares the count to n
+   static void n_of(const instruction_t& instruction, uint64_t* operands, const uint64_t* mask) {
+      const uint32_t planes_count = std::bit_width(instruction.arg);
+      const uint32_t n = instruction.arg;
+      for (uint32_t w = 0; w < bitset_words; ++w) {
+         uint64_t planes[32] = {0};
+         uint64_t overflow = 0;
+         for (uint32_t j = 0; j < instruction.operands; ++j) {
+            uint64_t carry = operands[j * bitset_words + w];
+            for (uint32_t p = 0; p < planes_count && carry; ++p) {
+               const uint64_t next_carry = planes[p] & carry;
+               planes[p] ^= carry;
+               carry = next_carry;
+            }
+            overflow |= carry;
+         }
+         uint64_t greater = 0;
+         uint64_t equal = ~0ull;
+         for (uint32_t p = planes_count; p-- > 0;) {
+            if ((n >> p) & 1) {
+               equal &= planes[p];
+            } else {
+               greater |= equal & planes[p];
+               equal &= ~planes[p];
+            }
+         }
+         const uint64_t res = instruction.exactly ? equal & ~overflow : greater | equal | overflow;
+         operands[w] = res & mask[w];
+      }
+   }
+
+   filter_t run(slice_t slice, bool zero_preserving) {
+      Roaring* ret = new Roaring();
+      if (slice.begin >= slice.end) {
+         return {ret, nullptr};
+      }
+      std::vector<uint64_t> stack(max_depth * bitset_words);
+      std::vector<uint64_t> mask(bitset_words);
+      std::vector<int32_t> cursors(leaves.size(), 0);
+      std::vector<int32_t> present(leaves.size());
+      std::vector<uint32_t> values;
+
+      for (uint32_t key = slice.begin / container_rows; key <= (slice.end - 1) / container_rows; ++key) {
+         bool any_present = false;
+         for (uint32_t l = 0; l < leaves.size(); ++l) {
+            const auto& ra = leaves[l].getAsConst()->roaring.high_low_container;
+            cursors[l] = lower_bound_container(ra, key, cursors[l]);
+            present[l] = cursors[l] < ra.size && ra.keys[cursors[l]] == key ? cursors[l] : -1;
+            any_present |= present[l] >= 0;
+         }
+         if (!any_present && skips_empty_chunks(zero_preserving)) {
+            continue;
+         }
+
+         const uint32_t base = key * container_rows;
+         std::fill(mask.begin(), mask.end(), 0);
+         set_range(mask.data(), std::max(slice.begin, base) - base, (uint32_t) (std::min((uint64_t) slice.end, (uint64_t) base + container_rows) - base));
+
+         uint32_t sp = 0;
+         auto slot = [&](uint32_t i) { return stack.data() + (size_t) i * bitset_words; };
+         for (const instruction_t& instruction : instructions) {
+            switch (instruction.op) {
+               case op_t::LEAF: {
+                  uint64_t* out = slot(sp++);
+                  if (present[instruction.arg] >= 0) {
+                     load_container(leaves[instruction.arg].getAsConst()->roaring.high_low_container, present[instruction.arg], out);
+                  } else {
+                     std::fill(out, out + bitset_words, 0);
+                  }
+                  break;
+               }
+               case op_t::FULL:
+                  std::copy(mask.begin(), mask.end(), slot(sp++));
+                  break;
+               case op_t::EMPTY: {
+                  uint64_t* out = slot(sp++);
+                  std::fill(out, out + bitset_words, 0);
+                  break;
+               }
+               case op_t::AND: {
+                  sp -= instruction.operands;
+                  uint64_t* out = slot(sp++);
+                  const uint32_t positive = instruction.operands - instruction.negated;
+                  for (uint32_t w = 0; w < bitset_words; ++w) {
+                     uint64_t acc = positive ? out[w] : mask[w];
+                     for (uint32_t j = positive ? 1 : 0; j < positive; ++j) {
+                        acc &= out[j * bitset_words + w];
+                     }
+                     for (uint32_t j = positive; j < instruction.operands; ++j) {
+                        acc &= ~out[j * bitset_words + w];
+                     }
+                     out[w] = acc;
+                  }
+                  break;
+               }
+               case op_t::OR: {
+                  sp -= instruction.operands;
+                  uint64_t* out = slot(sp++);
+                  for (uint32_t j = 1; j < instruction.operands; ++j) {
+                     const uint64_t* operand = out + j * bitset_words;
+                     for (uint32_t w = 0; w < bitset_words; ++w) {
+                        out[w] |= operand[w];
+                     }
+                  }
+                  break;
+               }
+               case op_t::NOT: {
+                  uint64_t* out = slot(sp - 1);
+                  for (uint32_t w = 0; w < bitset_words; ++w) {
+                     out[w] = ~out[w] & mask[w];
+                  }
+                  break;
+               }
+               case op_t::NOF: {
+                  sp -= instruction.operands;
+                  int64_t nanoseconds;
+                  {
+                     BlockTimer<std::chrono::nanoseconds> timer(nanoseconds);
+                     n_of(instruction, slot(sp++), mask.data());
+                  }
+                  fused_nofs[instruction.negated].nanoseconds += nanoseconds;
+                  break;
+               }
+               case op_t::CAPTURE:
+                  add_chunk(*captures[instruction.arg].bitmap, slot(sp - 1), base, values);
+                  break;
+            }
+         }
+
+         add_chunk(*ret, slot(0), base, values);
+      }
+      return {ret, nullptr};
+   }
+
+   /// Puts the captured results into the caches of their subexpressions
+   void put_captures(slice_t slice) {
+      for (auto& capture : captures) {
+         capture.bitmap->shrinkToFit();
+         CachedEx& cached_ex = *capture.cached_ex;
+         cached_ex.cache->put(cached_ex.key, cached_ex.partition, slice.begin / slice_size, std::move(capture.bitmap), capture.complemented);
+      }
+   }
+
+   /// Hands the decisions of the fused NOfEx to report_nof_decisions, with the time spent in their adders
+   void record_decisions() {
+      for (auto& fused : fused_nofs) {
+         fused.decision.microseconds = fused.nanoseconds / 1000;
+         std::lock_guard<std::mutex> guard(fused.nof_ex->decisions_mutex);
+         fused.nof_ex->decisions.push_back(fused.decision);
+      }
+   }
+};
+
+} // namespace
+
+filter_t silo::evaluate_compiled(BoolExpression& filter, const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   if (filter.type() == ExType::NEG) {
+      /// A negation at the root is left to the consumer of the result
+      filter_t ret = evaluate_compiled(*dynamic_cast<NegEx&>(filter).child, db, dbp, slice);
+      ret.complemented = !ret.complemented;
+      return ret;
+   }
+   CachedEx* cached_root = filter.type() == ExType::CACHED ? dynamic_cast<CachedEx*>(&filter) : nullptr;
+   /// The negations at the top of a cached root are left to the consumer as well, and its entry is complemented
+   bool complemented = false;
+   BoolExpression& root = cached_root ? strip_negations(*cached_root->child, complemented) : filter;
+   if (!is_fusable(root)) {
+      return filter.evaluate(db, dbp, slice);
+   }
+   const uint32_t slice_index = slice.begin / slice_size;
+   if (cached_root) {
+      if (auto cached = cached_root->cache->get(cached_root->key, cached_root->partition, slice_index)) {
+         return {nullptr, cached.bitmap.get(), cached.bitmap, cached.complemented};
+      }
+   }
+
+   program_t program;
+   const bool zero_preserving = program.compile(root, db, dbp, slice);
+   filter_t ret = program.run(slice, zero_preserving);
+   program.record_decisions();
+   program.put_captures(slice);
+   for (auto& leaf : program.leaves) {
+      leaf.free();
+   }
+
+   if (cached_root) {
+      ret.mutable_res->shrinkToFit();
+      std::shared_ptr<const Roaring> shared(ret.mutable_res);
+      cached_root->cache->put(cached_root->key, cached_root->partition, slice_index, shared, complemented);
+      return {nullptr, shared.get(), shared, complemented};
+   }
+   return ret;
+}
@@ -5,13 +5,62 @@
 #include "tbb/parallel_for.h"
 #include "tbb/parallel_for_each.h"
 #include <silo/common/PerfEvent.hpp>
+#include <bit>
+#include <cassert>
+#include <iomanip>
 #include <syncstream>
 
 namespace silo {
 
 using roaring::Roaring;
 
-std::unique_ptr<BoolExpression> to_ex(const Database& db, const rapidjson::Value& js, int exact) {
+static time_t parse_date(const std::string& date) {
+   struct std::tm tm {};
+   std::istringstream ss(date);
+   ss >> std::get_time(&tm, "%Y-%m-%d");
+   return mktime(&tm);
+}
+
+static std::unique_ptr<BoolExpression> lineage_ex(const Database& db, std::string lineage, bool includeSubLineages) {
+   std::transform(lineage.begin(), lineage.end(), lineage.begin(), ::toupper);
+   lineage = resolve_alias(db.alias_key, lineage);
+   uint32_t lineageKey = db.dict->get_pangoid(lineage);
+   return std::make_unique<PangoLineageEx>(lineageKey, includeSubLineages);
+}
+
+static std::unique_ptr<BoolExpression> str_eq_ex(const Database& db, const std::string& col, const std::string& value) {
+   if (col == "country") {
+      return std::make_unique<CountryEx>(db.dict->get_countryid(value));
+   } else if (col == "region") {
+      return std::make_unique<RegionEx>(db.dict->get_regionid(value));
+   } else {
+      return std::make_unique<StrEqEx>(col, value);
+   }
+}
+
+/// Whether the value is a parameter of a prepared query
+static bool is_param(const rapidjson::Value& js) {
+   return js.IsObject() && js.HasMember("param") && js["param"].IsString();
+}
+
+static const std::string& param_value(const query_params_t& params, const std::string& name) {
+   auto it = params.find(name);
+   if (it == params.end()) {
+      throw QueryParseException("Missing value for a parameter of the prepared query.");
+   }
+   return it->second;
+}
+
+/// Adds the slot of a parameter leaf, slots is nullptr unless the query is prepared
+static std::unique_ptr<BoolExpression> add_param(std::vector<param_slot_t>* slots, param_slot_t slot) {
+   if (!slots) {
+      throw QueryParseException("Parameters are only allowed in prepared queries.");
+   }
+   slots->push_back(std::move(slot));
+   return std::make_unique<ParamEx>(slots->size() - 1);
+}
+
+std::unique_ptr<BoolExpression> to_ex(const Database& db, const rapidjson::Value& js, int exact, std::vector<param_slot_t>* slots = nullptr) {
    assert(js.HasMember("type"));
    assert(js["type"].IsString());
    std::string type = js["type"].GetString();
@@ -20,14 +69,14 @@ std::unique_ptr<BoolExpression> to_ex(const Database& db, const rapidjson::Value
       assert(js.HasMember("children"));
       assert(js["children"].IsArray());
       std::transform(js["children"].GetArray().begin(), js["children"].GetArray().end(),
-                     std::back_inserter(ret->children), [&](const rapidjson::Value& js) { return to_ex(db, js, exact); });
+                     std::back_inserter(ret->children), [&](const rapidjson::Value& js) { return to_ex(db, js, exact, slots); });
       return ret;
    } else if (type == "Or") {
       auto ret = std::make_unique<OrEx>();
       assert(js.HasMember("children"));
       assert(js["children"].IsArray());
       std::transform(js["children"].GetArray().begin(), js["children"].GetArray().end(),
-                     std::back_inserter(ret->children), [&](const rapidjson::Value& js) { return to_ex(db, js, exact); });
+                     std::back_inserter(ret->children), [&](const rapidjson::Value& js) { return to_ex(db, js, exact, slots); });
       return ret;
    } else if (type == "N-Of") {
       assert(js.HasMember("children"));
@@ -35,39 +84,55 @@ std::unique_ptr<BoolExpression> to_ex(const Database& db, const rapidjson::Value
       assert(js.HasMember("n"));
       assert(js["n"].IsUint());
 
-      auto ret = std::make_unique<NOfEx>(js["n"].GetUint(), 0, js["exactly"].GetBool());
+      auto ret = std::make_unique<NOfEx>(js["n"].GetUint(), NOfEx::impl_auto, js["exactly"].GetBool());
       std::transform(js["children"].GetArray().begin(), js["children"].GetArray().end(),
-                     std::back_inserter(ret->children), [&](const rapidjson::Value& js) { return to_ex(db, js, exact); });
+                     std::back_inserter(ret->children), [&](const rapidjson::Value& js) { return to_ex(db, js, exact, slots); });
       if (js.HasMember("impl") && js["impl"].IsUint()) {
          ret->impl = js["impl"].GetUint();
       }
       return ret;
    } else if (type == "Neg") {
       auto ret = std::make_unique<NegEx>();
-      ret->child = to_ex(db, js["child"], -exact);
+      ret->child = to_ex(db, js["child"], -exact, slots);
       return ret;
    } else if (type == "DateBetw") {
+      if (is_param(js["from"]) || is_param(js["to"])) {
+         /// A fixed bound is parsed once, a parameter on every execution
+         auto bound = [](const rapidjson::Value& js) -> std::pair<std::string, std::optional<time_t>> {
+            if (is_param(js)) return {js["param"].GetString(), std::nullopt};
+            if (js.IsNull()) return {"", std::nullopt};
+            return {"", parse_date(js.GetString())};
+         };
+         return add_param(slots, [from = bound(js["from"]), to = bound(js["to"])](const query_params_t& params) {
+            auto ret = std::make_unique<DateBetwEx>();
+            auto bind = [&](const std::pair<std::string, std::optional<time_t>>& bound, bool& open, time_t& date) {
+               if (bound.first.empty()) {
+                  open = !bound.second;
+                  date = bound.second.value_or(0);
+                  return;
+               }
+               const std::string& value = param_value(params, bound.first);
+               open = value.empty();
+               date = open ? 0 : parse_date(value);
+            };
+            bind(from, ret->open_from, ret->from);
+            bind(to, ret->open_to, ret->to);
+            return ret;
+         });
+      }
       auto ret = std::make_unique<DateBetwEx>();
       if (js["from"].IsNull()) {
          ret->open_from = true;
       } else {
          ret->open_from = false;
-
-         struct std::tm tm {};
-         std::istringstream ss(js["from"].GetString());
-         ss >> std::get_time(&tm, "%Y-%m-%d");
-         ret->from = mktime(&tm);
+         ret->from = parse_date(js["from"].GetString());
       }
 
       if (js["to"].IsNull()) {
          ret->open_to = true;
       } else {
          ret->open_to = false;
-
-         struct std::tm tm {};
-         std::istringstream ss(js["to"].GetString());
-         ss >> std::get_time(&tm, "%Y-%m-%d");
-         ret->to = mktime(&tm);
+         ret->to = parse_date(js["to"].GetString());
       }
       return ret;
    } else if (type == "NucEq") {
@@ -104,168 +169,221 @@ std::unique_ptr<BoolExpression> to_ex(const Database& db, const rapidjson::Value
       } else {
          return std::make_unique<NegEx>(std::make_unique<NucMbEx>(pos, silo::to_symbol(ref_symbol)));
       }
+   } else if (type == "Covered") {
+      const unsigned from = js["from"].GetUint();
+      const unsigned to = js["to"].GetUint();
+      if (from < 1 || from > to || to > genomeLength) {
+         throw QueryParseException("Covered needs 1 <= from <= to <= genome length.");
+      }
+      return std::make_unique<CoveredEx>(from, to);
    } else if (type == "PangoLineage") {
       bool includeSubLineages = js["includeSubLineages"].GetBool();
-      std::string lineage = js["value"].GetString();
-      std::transform(lineage.begin(), lineage.end(), lineage.begin(), ::toupper);
-      lineage = resolve_alias(db.alias_key, lineage);
-      uint32_t lineageKey = db.dict->get_pangoid(lineage);
-      return std::make_unique<PangoLineageEx>(lineageKey, includeSubLineages);
+      if (is_param(js["value"])) {
+         return add_param(slots, [&db, name = std::string(js["value"]["param"].GetString()), includeSubLineages](const query_params_t& params) {
+            return lineage_ex(db, param_value(params, name), includeSubLineages);
+         });
+      }
+      return lineage_ex(db, js["value"].GetString(), includeSubLineages);
    } else if (type == "StrEq") {
       const std::string& col = js["column"].GetString();
-      if (col == "country") {
-         return std::make_unique<CountryEx>(db.dict->get_countryid(js["value"].GetString()));
-      } else if (col == "region") {
-         return std::make_unique<RegionEx>(db.dict->get_regionid(js["value"].GetString()));
-      } else {
-         return std::make_unique<StrEqEx>(js["column"].GetString(), js["value"].GetString());
+      if (is_param(js["value"])) {
+         return add_param(slots, [&db, col, name = std::string(js["value"]["param"].GetString())](const query_params_t& params) {
+            return str_eq_ex(db, col, param_value(params, name));
+         });
       }
+      return str_eq_ex(db, col, js["value"].GetString());
    } else if (type == "Maybe") {
       auto ret = std::make_unique<NegEx>();
-      ret->child = to_ex(db, js["child"], -1);
+      ret->child = to_ex(db, js["child"], -1, slots);
       return ret;
    } else if (type == "Exact") {
       auto ret = std::make_unique<NegEx>();
-      ret->child = to_ex(db, js["child"], 1);
+      ret->child = to_ex(db, js["child"], 1, slots);
       return ret;
    } else {
       throw QueryParseException("Unknown object type");
    }
 }
 
-filter_t AndEx::evaluate(const Database& db, const DatabasePartition& dbp) {
-   std::vector<filter_t> children_bm;
-   children_bm.reserve(children.size());
-   std::transform(children.begin(), children.end(), std::back_inserter(children_bm),
-                  [&](const auto& child) { return child->evaluate(db, dbp); });
-   std::vector<filter_t> negated_children_bm;
-   negated_children.reserve(negated_children.size());
-   std::transform(negated_children.begin(), negated_children.end(), std::back_inserter(negated_children_bm),
-                  [&](const auto& child) { return child->evaluate(db, dbp); });
-   /// Sort ascending, such that intermediate results are kept small
-   std::sort(children_bm.begin(), children_bm.end(),
-             [](const filter_t& a, const filter_t& b) { return a.getAsConst()->cardinality() < b.getAsConst()->cardinality(); });
-
-   Roaring* ret;
-   if (children_bm.empty()) {
-      const unsigned n = negated_children_bm.size();
-      const Roaring* union_tmp[n];
-      for (unsigned i = 0; i < n; i++) {
-         union_tmp[i] = negated_children_bm[i].getAsConst();
-      }
-      ret = new Roaring(Roaring::fastunion(n, union_tmp));
-      ret->flip(0, dbp.sequenceCount);
-      for (auto& bm : negated_children_bm) {
-         bm.free();
-      }
-      return {ret, nullptr};
-   } else if (children_bm.size() == 1) {
-      assert(negated_children_bm.size() >= 1);
-      if (children_bm[0].mutable_res) {
-         ret = children_bm[0].mutable_res;
+/// Evaluates ex and flips a complemented result, for operators that need the rows of their operands
+static filter_t evaluate_materialized(BoolExpression& ex, const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   filter_t ret = ex.evaluate(db, dbp, slice);
+   ret.materialize(slice.begin, slice.end);
+   return ret;
+}
+
+/// Intersects acc with bm, or subtracts bm from acc. Reuses a mutable operand for the result.
+static void and_into(filter_t& acc, filter_t& bm, bool subtract) {
+   if (acc.mutable_res) {
+      if (subtract) {
+         roaring::api::roaring_bitmap_andnot_inplace(&acc.mutable_res->roaring, &bm.getAsConst()->roaring);
       } else {
-         auto tmp = roaring::api::roaring_bitmap_andnot(&children_bm[0].immutable_res->roaring, &negated_children_bm[0].getAsConst()->roaring);
-         ret = new Roaring(tmp);
-      }
-      /// Sort negated children descending by size
-      std::sort(negated_children_bm.begin(), negated_children_bm.end(),
-                [](const filter_t& a, const filter_t& b) { return a.getAsConst()->cardinality() > b.getAsConst()->cardinality(); });
-      for (auto neg_bm : negated_children_bm) {
-         roaring::api::roaring_bitmap_andnot_inplace(&ret->roaring, &neg_bm.getAsConst()->roaring);
-         neg_bm.free();
+         *acc.mutable_res &= *bm.getAsConst();
       }
-      return {ret, nullptr};
-   } else {
-      if (children_bm[0].mutable_res) {
-         ret = children_bm[0].mutable_res;
-         *ret &= *children_bm[1].getAsConst();
-         children_bm[1].free();
-      } else if (children_bm[1].mutable_res) {
-         ret = children_bm[1].mutable_res;
-         *ret &= *children_bm[0].getAsConst();
+      bm.free();
+      return;
+   }
+   if (!subtract && bm.mutable_res) {
+      *bm.mutable_res &= *acc.immutable_res;
+      acc.free();
+      acc = bm;
+      return;
+   }
+   Roaring* ret = new Roaring(subtract ? roaring::api::roaring_bitmap_andnot(&acc.immutable_res->roaring, &bm.getAsConst()->roaring) :
+                                         roaring::api::roaring_bitmap_and(&acc.immutable_res->roaring, &bm.getAsConst()->roaring));
+   acc.free();
+   bm.free();
+   acc = {ret, nullptr};
+}
+
+filter_t AndEx::evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   /// The children were ordered by plan(), most selective first. Intersect them one at a time,
+   /// such that intermediate results are kept small and we can stop as soon as the result is empty.
+   /// Complemented results of children are subtracted and complemented results of negated children
+   /// are intersected, so that no negation is materialized.
+   filter_t acc;
+   bool has_acc = false;
+   std::vector<filter_t> subtracted;
+   auto add_operand = [&](filter_t bm, bool negated) {
+      const bool subtract = negated != bm.complemented;
+      bm.complemented = false;
+      if (has_acc) {
+         and_into(acc, bm, subtract);
+      } else if (subtract) {
+         /// Nothing to subtract from yet
+         subtracted.push_back(bm);
       } else {
-         auto x = roaring_bitmap_and(&children_bm[0].immutable_res->roaring, &children_bm[1].immutable_res->roaring);
-         ret = new Roaring(x);
+         acc = bm;
+         has_acc = true;
       }
-      for (unsigned i = 2; i < children.size(); i++) {
-         auto bm = children_bm[i];
-         *ret &= *bm.getAsConst();
-         bm.free();
+   };
+   auto is_empty = [&]() { return has_acc && acc.getAsConst()->isEmpty(); };
+
+   for (auto child_it = children.begin(); child_it != children.end() && !is_empty(); ++child_it) {
+      add_operand((*child_it)->evaluate(db, dbp, slice), false);
+   }
+   for (auto negated_it = negated_children.begin(); negated_it != negated_children.end() && !is_empty(); ++negated_it) {
+      add_operand((*negated_it)->evaluate(db, dbp, slice), true);
+   }
+
+   if (has_acc) {
+      for (auto& bm : subtracted) {
+         if (is_empty()) {
+            bm.free();
+         } else {
+            and_into(acc, bm, true);
+         }
       }
-      /// Sort negated children descending by size
-      std::sort(negated_children_bm.begin(), negated_children_bm.end(),
-                [](const filter_t& a, const filter_t& b) { return a.getAsConst()->cardinality() > b.getAsConst()->cardinality(); });
-      for (auto neg_bm : negated_children_bm) {
-         roaring::api::roaring_bitmap_andnot_inplace(&ret->roaring, &neg_bm.getAsConst()->roaring);
-         neg_bm.free();
+      return acc;
+   }
+   /// Only subtractions: the result is the complement of their union
+   if (subtracted.size() == 1) {
+      subtracted[0].complemented = true;
+      return subtracted[0];
+   }
+   std::vector<const Roaring*> union_tmp;
+   for (const auto& bm : subtracted) {
+      union_tmp.push_back(bm.getAsConst());
+   }
+   Roaring* ret = new Roaring(Roaring::fastunion(union_tmp.size(), union_tmp.data()));
+   for (auto& bm : subtracted) {
+      bm.free();
+   }
+   return {ret, nullptr, nullptr, true};
+}
+
+filter_t OrEx::evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   /// Complemented children are combined by De Morgan: the union is the complement of the
+   /// intersection of their bitmaps, minus the rows of the other children.
+   std::vector<filter_t> child_res;
+   std::vector<filter_t> complemented_res;
+   for (auto& child : children) {
+      filter_t res = child->evaluate(db, dbp, slice);
+      (res.complemented ? complemented_res : child_res).push_back(res);
+   }
+   std::vector<const Roaring*> union_tmp;
+   for (const auto& res : child_res) {
+      union_tmp.push_back(res.getAsConst());
+   }
+   if (complemented_res.empty()) {
+      Roaring* ret = new Roaring(Roaring::fastunion(union_tmp.size(), union_tmp.data()));
+      for (auto& res : child_res) {
+         res.free();
       }
       return {ret, nullptr};
    }
-}
 
-filter_t OrEx::evaluate(const Database& db, const DatabasePartition& dbp) {
-   unsigned n = children.size();
-   const Roaring* union_tmp[n];
-   filter_t child_res[n];
-   for (unsigned i = 0; i < n; i++) {
-      auto tmp = children[i]->evaluate(db, dbp);
-      child_res[i] = tmp;
-      union_tmp[i] = tmp.getAsConst();
+   filter_t acc = complemented_res[0];
+   acc.complemented = false;
+   for (unsigned i = 1; i < complemented_res.size(); i++) {
+      complemented_res[i].complemented = false;
+      and_into(acc, complemented_res[i], false);
    }
-   Roaring* ret = new Roaring(Roaring::fastunion(children.size(), union_tmp));
-   for (unsigned i = 0; i < n; i++) {
-      child_res[i].free();
+   if (!child_res.empty()) {
+      filter_t positive{new Roaring(Roaring::fastunion(union_tmp.size(), union_tmp.data())), nullptr};
+      for (auto& res : child_res) {
+         res.free();
+      }
+      and_into(acc, positive, true);
    }
-   return {ret, nullptr};
+   acc.complemented = true;
+   return acc;
 }
 
 inline void vec_and_not(std::vector<uint32_t>& dest, const std::vector<uint32_t>& v1, const std::vector<uint32_t>& v2) {
    std::set_difference(v1.begin(), v1.end(), v2.begin(), v2.end(), std::back_inserter(dest));
 }
 
-filter_t NOfEx_evaluateImpl0(const NOfEx* self, const Database& db, const DatabasePartition& dbp) {
+filter_t NOfEx_evaluateImpl0(const NOfEx* self, const Database& db, const DatabasePartition& dbp, slice_t slice) {
    if (self->exactly) {
       std::vector<uint16_t> count;
       std::vector<uint32_t> at_least;
       std::vector<uint32_t> too_much;
-      count.resize(dbp.sequenceCount);
+      count.resize(slice.end - slice.begin);
       for (auto& child : self->children) {
-         auto bm = child->evaluate(db, dbp);
+         auto bm = evaluate_materialized(*child, db, dbp, slice);
          for (uint32_t id : *bm.getAsConst()) {
-            ++count[id];
-            if (count[id] == self->n + 1) {
+            uint16_t& id_count = count[id - slice.begin];
+            ++id_count;
+            if (id_count == self->n + 1) {
                too_much.push_back(id);
-            } else if (count[id] == self->n) {
+            } else if (id_count == self->n) {
                at_least.push_back(id);
             }
          }
          bm.free();
       }
+      /// The ids were collected in the order in which their counts were reached
+      std::sort(at_least.begin(), at_least.end());
+      std::sort(too_much.begin(), too_much.end());
       std::vector<uint32_t> correct;
       vec_and_not(correct, at_least, too_much);
-      return {new Roaring(correct.size(), &correct[0]), nullptr};
+      return {new Roaring(correct.size(), correct.data()), nullptr};
    } else {
       std::vector<uint16_t> count;
       std::vector<uint32_t> correct;
-      count.resize(dbp.sequenceCount);
+      count.resize(slice.end - slice.begin);
       for (auto& child : self->children) {
-         auto bm = child->evaluate(db, dbp);
+         auto bm = evaluate_materialized(*child, db, dbp, slice);
          for (uint32_t id : *bm.getAsConst()) {
-            if (++count[id] == self->n) {
+            if (++count[id - slice.begin] == self->n) {
                correct.push_back(id);
             }
          }
          bm.free();
       }
-      return {new Roaring(correct.size(), &correct[0]), nullptr};
+      return {new Roaring(correct.size(), correct.data()), nullptr};
    }
 }
 
 // DPLoop
-filter_t NOfEx_evaluateImpl1(const NOfEx* self, const Database& db, const DatabasePartition& dbp) {
-   std::vector<Roaring*> dp(self->n);
+filter_t NOfEx_evaluateImpl1(const NOfEx* self, const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   /// dp[j] holds the rows matching at least j+1 of the children seen so far.
+   /// For exact queries, dp[n] holds the rows that have too many matches.
+   const unsigned dp_size = self->exactly ? self->n + 1 : self->n;
+   std::vector<Roaring*> dp(dp_size);
    /// Copy bm of first child if immutable, otherwise use it directly
-   auto tmp = self->children[0]->evaluate(db, dbp);
+   auto tmp = evaluate_materialized(*self->children[0], db, dbp, slice);
    if (tmp.mutable_res) {
       /// Do not need to delete tmp.mutable_res later, because dp[0] will be deleted
       dp[0] = tmp.mutable_res;
@@ -273,31 +391,33 @@ filter_t NOfEx_evaluateImpl1(const NOfEx* self, const Database& db, const Databa
       dp[0] = new Roaring(*tmp.immutable_res);
    }
    /// Initialize all bitmaps. Delete them later.
-   for (unsigned i = 1; i < self->n; ++i)
+   for (unsigned i = 1; i < dp_size; ++i)
       dp[i] = new Roaring();
 
-   for (unsigned i = 1; i < self->n; ++i) {
-      auto bm = self->children[i]->evaluate(db, dbp);
-      /// positions higher than (i-1) cannot have been reached yet, are therefore all 0s and the conjunction would return 0
-      for (unsigned j = std::min(self->n - 1, i); j >= 1; ++j) {
+   for (unsigned i = 1; i < self->children.size(); ++i) {
+      auto bm = evaluate_materialized(*self->children[i], db, dbp, slice);
+      /// positions higher than i cannot have been reached yet, are therefore all 0s and the conjunction would return 0
+      for (unsigned j = std::min(dp_size - 1, i); j >= 1; --j) {
          *dp[j] |= *dp[j - 1] & *bm.getAsConst();
       }
       *dp[0] |= *bm.getAsConst();
-      if (self->exactly && i >= self->n) {
-         roaring::api::roaring_bitmap_andnot_inplace(&dp[self->n - 1]->roaring, &bm.getAsConst()->roaring);
-      }
       bm.free();
    }
 
+   Roaring* ret = dp[self->n - 1];
+   if (self->exactly) {
+      *ret -= *dp[self->n];
+   }
    /// Delete
-   for (unsigned i = 0; i < self->n - 1; ++i)
-      delete dp[i];
+   for (unsigned i = 0; i < dp_size; ++i) {
+      if (dp[i] != ret) delete dp[i];
+   }
 
-   return {dp.back(), nullptr};
+   return {ret, nullptr};
 }
 
 // N-Way Heap-Merge, for threshold queries
-filter_t NOfEx_evaluateImpl2threshold(const NOfEx* self, const Database& db, const DatabasePartition& dbp) {
+filter_t NOfEx_evaluateImpl2threshold(const NOfEx* self, const Database& db, const DatabasePartition& dbp, slice_t slice) {
    std::vector<filter_t> child_maps;
    struct bitmap_iterator {
       roaring::RoaringSetBitForwardIterator cur;
@@ -305,7 +425,7 @@ filter_t NOfEx_evaluateImpl2threshold(const NOfEx* self, const Database& db, con
    };
    std::vector<bitmap_iterator> iterator_heap;
    for (const auto& child : self->children) {
-      auto tmp = child->evaluate(db, dbp);
+      auto tmp = evaluate_materialized(*child, db, dbp, slice);
       child_maps.push_back(tmp);
       if (tmp.getAsConst()->begin() != tmp.getAsConst()->end())
          iterator_heap.push_back({tmp.getAsConst()->begin(), tmp.getAsConst()->end()});
@@ -331,20 +451,19 @@ filter_t NOfEx_evaluateImpl2threshold(const NOfEx* self, const Database& db, con
       std::pop_heap(iterator_heap.begin(), iterator_heap.end(), sorter);
       uint32_t val = *iterator_heap.back().cur;
       cur_count = val == last_val ? cur_count + 1 : 1;
+      last_val = val;
       if (cur_count == self->n) {
          buffer.push_back(val);
          if (buffer.size() == BUFFER_SIZE) {
             ret->addMany(BUFFER_SIZE, &buffer[0]);
             buffer.clear();
          }
+      }
+      iterator_heap.back().cur++;
+      if (iterator_heap.back().cur == iterator_heap.back().end) {
+         iterator_heap.pop_back();
       } else {
-         last_val = val;
-         iterator_heap.back().cur++;
-         if (iterator_heap.back().cur == iterator_heap.back().end) {
-            iterator_heap.pop_back();
-         } else {
-            std::push_heap(iterator_heap.begin(), iterator_heap.end(), sorter);
-         }
+         std::push_heap(iterator_heap.begin(), iterator_heap.end(), sorter);
       }
    }
 
@@ -359,7 +478,7 @@ filter_t NOfEx_evaluateImpl2threshold(const NOfEx* self, const Database& db, con
 }
 
 // N-Way Heap-Merge, for exact queries
-filter_t NOfEx_evaluateImpl2exact(const NOfEx* self, const Database& db, const DatabasePartition& dbp) {
+filter_t NOfEx_evaluateImpl2exact(const NOfEx* self, const Database& db, const DatabasePartition& dbp, slice_t slice) {
    std::vector<filter_t> child_maps;
    struct bitmap_iterator {
       roaring::RoaringSetBitForwardIterator cur;
@@ -367,7 +486,7 @@ filter_t NOfEx_evaluateImpl2exact(const NOfEx* self, const Database& db, const D
    };
    std::vector<bitmap_iterator> iterator_heap;
    for (const auto& child : self->children) {
-      auto tmp = child->evaluate(db, dbp);
+      auto tmp = evaluate_materialized(*child, db, dbp, slice);
       child_maps.push_back(tmp);
       if (tmp.getAsConst()->begin() != tmp.getAsConst()->end())
          iterator_heap.push_back({tmp.getAsConst()->begin(), tmp.getAsConst()->end()});
@@ -392,24 +511,30 @@ filter_t NOfEx_evaluateImpl2exact(const NOfEx* self, const Database& db, const D
    while (!iterator_heap.empty()) {
       std::pop_heap(iterator_heap.begin(), iterator_heap.end(), sorter);
       uint32_t val = *iterator_heap.back().cur;
-      if (cur_count == self->n && val != last_val) {
-         cur_count = 1;
-         buffer.push_back(val);
-         if (buffer.size() == BUFFER_SIZE) {
-            ret->addMany(BUFFER_SIZE, &buffer[0]);
-            buffer.clear();
+      if (val != last_val) {
+         /// All occurrences of last_val have been counted
+         if (cur_count == self->n) {
+            buffer.push_back(last_val);
+            if (buffer.size() == BUFFER_SIZE) {
+               ret->addMany(BUFFER_SIZE, &buffer[0]);
+               buffer.clear();
+            }
          }
-      } else {
-         cur_count = val == last_val ? cur_count + 1 : 1;
+         cur_count = 1;
          last_val = val;
-         iterator_heap.back().cur++;
-         if (iterator_heap.back().cur == iterator_heap.back().end) {
-            iterator_heap.pop_back();
-         } else {
-            std::push_heap(iterator_heap.begin(), iterator_heap.end(), sorter);
-         }
+      } else {
+         ++cur_count;
+      }
+      iterator_heap.back().cur++;
+      if (iterator_heap.back().cur == iterator_heap.back().end) {
+         iterator_heap.pop_back();
+      } else {
+         std::push_heap(iterator_heap.begin(), iterator_heap.end(), sorter);
       }
    }
+   if (cur_count == self->n) {
+      buffer.push_back(last_val);
+   }
 
    if (buffer.size() > 0) {
       ret->addMany(buffer.size(), &buffer[0]);
@@ -421,116 +546,500 @@ filter_t NOfEx_evaluateImpl2exact(const NOfEx* self, const Database& db, const D
    return {ret, nullptr};
 }
 
-filter_t NOfEx::evaluate(const Database& db, const DatabasePartition& dbp) {
-   switch (impl) {
-      default:
+// Bit-sliced counter, for large n
+filter_t NOfEx_evaluateImpl3(const NOfEx* self, const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   assert(self->n > 0);
+   /// planes[p] holds the rows whose count of matching children has bit p set. With ceil(log2(n+1)) planes,
+   /// a carry out of the highest plane means that the count exceeds n, these rows are kept in overflow.
+   const unsigned plane_count = std::bit_width(self->n);
+   std::vector<Roaring> planes(plane_count);
+   Roaring overflow;
+   for (auto& child : self->children) {
+      auto bm = evaluate_materialized(*child, db, dbp, slice);
+      /// Full adder on every plane: the sum bit is plane ^ carry, the next carry is plane & carry
+      Roaring carry = planes[0] & *bm.getAsConst();
+      planes[0] ^= *bm.getAsConst();
+      bm.free();
+      for (unsigned p = 1; p < plane_count && !carry.isEmpty(); ++p) {
+         Roaring next_carry = planes[p] & carry;
+         planes[p] ^= carry;
+         carry = std::move(next_carry);
+      }
+      overflow |= carry;
+   }
+
+   /// Compare the counts to n from the most significant bit, which is set in n
+   Roaring* equal = new Roaring(std::move(planes[plane_count - 1]));
+   Roaring greater;
+   for (unsigned p = plane_count - 1; p-- > 0;) {
+      if ((self->n >> p) & 1) {
+         *equal &= planes[p];
+      } else {
+         greater |= *equal & planes[p];
+         *equal -= planes[p];
+      }
+   }
+   if (self->exactly) {
+      *equal -= overflow;
+   } else {
+      *equal |= greater;
+      *equal |= overflow;
+   }
+   return {equal, nullptr};
+}
+
+filter_t NOfEx::evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   const bool automatic = impl == impl_auto;
+   /// Unknown implementations and impl_fused, which needs evaluate_compiled, fall back to the DP loop
+   const unsigned chosen = automatic ? choose_impl(dbp, slice) : impl <= 3 ? impl : 1;
+   nof_decision_t decision{slice.begin, chosen, automatic, estimate_cost(chosen, dbp, slice), 0};
+   filter_t ret;
+   {
+      BlockTimer timer(decision.microseconds);
+      ret = evaluate_impl(chosen, db, dbp, slice);
+   }
+   std::lock_guard<std::mutex> guard(decisions_mutex);
+   decisions.push_back(decision);
+   return ret;
+}
+
+filter_t NOfEx::evaluate_impl(unsigned chosen, const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   /// simplify rewrites n == 0, which none of the implementations handle. For expressions that are not simplified,
+   /// every row matches at least 0 children, and the rows matching exactly 0 are the complement of the union.
+   if (n == 0) {
+      if (!exactly) {
+         Roaring* ret = new Roaring();
+         ret->addRange(slice.begin, slice.end);
+         return {ret, nullptr};
+      }
+      Roaring* ret = new Roaring();
+      for (const auto& child : children) {
+         auto bm = evaluate_materialized(*child, db, dbp, slice);
+         *ret |= *bm.getAsConst();
+         bm.free();
+      }
+      return {ret, nullptr, nullptr, true};
+   }
+   switch (chosen) {
       case 1:
-         return NOfEx_evaluateImpl1(this, db, dbp);
+         return NOfEx_evaluateImpl1(this, db, dbp, slice);
       case 0:
-         return NOfEx_evaluateImpl0(this, db, dbp);
+         return NOfEx_evaluateImpl0(this, db, dbp, slice);
       case 2:
          if (exactly) {
-            return NOfEx_evaluateImpl2exact(this, db, dbp);
+            return NOfEx_evaluateImpl2exact(this, db, dbp, slice);
          } else {
-            return NOfEx_evaluateImpl2threshold(this, db, dbp);
+            return NOfEx_evaluateImpl2threshold(this, db, dbp, slice);
          }
+      case 3:
+         return NOfEx_evaluateImpl3(this, db, dbp, slice);
+      default:
+         throw std::logic_error("Unknown NOfEx implementation " + std::to_string(chosen));
    }
 }
 
-filter_t NegEx::evaluate(const Database& db, const DatabasePartition& dbp) {
-   auto tmp = child->evaluate(db, dbp);
-   auto ret = tmp.mutable_res ? tmp.mutable_res : new Roaring(*tmp.immutable_res);
-   ret->flip(0, dbp.sequenceCount);
-   return {ret, nullptr};
+filter_t NegEx::evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   filter_t ret = child->evaluate(db, dbp, slice);
+   ret.complemented = !ret.complemented;
+   return ret;
 }
 
-filter_t DateBetwEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp) {
+filter_t CachedEx::evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   const uint32_t slice_index = slice.begin / slice_size;
+   if (auto cached = cache->get(key, partition, slice_index)) {
+      return {nullptr, cached.bitmap.get(), cached.bitmap, cached.complemented};
+   }
+   /// Complemented results are cached as they are, the consumer of the result materializes them if it has to
+   filter_t res = child->evaluate(db, dbp, slice);
+   if (!res.mutable_res) {
+      /// Owned by the database or already shared, nothing to gain from caching
+      return res;
+   }
+   res.mutable_res->shrinkToFit();
+   std::shared_ptr<const Roaring> shared(res.mutable_res);
+   cache->put(key, partition, slice_index, shared, res.complemented);
+   return {nullptr, shared.get(), shared, res.complemented};
+}
+
+/// Restricts a bitmap of the partition to the slice, without copying
+static filter_t slice_of(const Roaring& bm, const DatabasePartition& dbp, slice_t slice) {
+   if (slice.covers(dbp)) {
+      return {nullptr, &bm};
+   }
+   auto view = bitmap_view(bm, slice.begin, slice.end);
+   return {nullptr, view.get(), view};
+}
+
+filter_t DateBetwEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp, slice_t slice) {
+   const uint32_t first_day = open_from ? 0 : to_day(from);
+   const uint32_t last_day = open_to ? UINT32_MAX : to_day(to);
+   if (first_day > last_day) {
+      return {new Roaring(), nullptr};
+   }
    if (open_from && open_to) {
       auto ret = new Roaring();
-      ret->addRange(0, dbp.sequenceCount);
+      ret->addRange(slice.begin, slice.end);
       return {ret, nullptr};
    }
 
-   auto ret = new Roaring;
-   auto base = &dbp.meta_store.sid_to_date[0];
+   /// The zone maps decide most chunks: those entirely in the range are added as a whole
+   auto ret = new Roaring();
+   bool undecided = dbp.get_chunks().empty();
    for (const chunk_t& chunk : dbp.get_chunks()) {
-      auto begin = &dbp.meta_store.sid_to_date[chunk.offset];
-      auto end = &dbp.meta_store.sid_to_date[chunk.offset + chunk.count];
-      uint32_t lower = open_to ? begin - base : std::lower_bound(begin, end, this->from) - base;
-      uint32_t upper = open_to ? end - base : std::upper_bound(begin, end, this->to) - base;
-      ret->addRange(lower, upper);
+      const uint32_t chunk_begin = std::max(chunk.offset, slice.begin);
+      const uint32_t chunk_end = std::min(chunk.offset + chunk.count, slice.end);
+      if (chunk_begin >= chunk_end || chunk.max_day < first_day || chunk.min_day > last_day) {
+         continue;
+      }
+      if (chunk.min_day >= first_day && chunk.max_day <= last_day) {
+         ret->addRange(chunk_begin, chunk_end);
+      } else {
+         undecided = true;
+         break;
+      }
+   }
+   if (!undecided) {
+      return {ret, nullptr};
    }
+   delete ret;
+
+   /// Otherwise, the rows until last_day without the rows before first_day
+   const Roaring* until_to = rows_until_day(dbp.meta_store, last_day);
+   if (!until_to) {
+      return {new Roaring(), nullptr};
+   }
+   const Roaring* before_from = first_day > 0 ? rows_until_day(dbp.meta_store, first_day - 1) : nullptr;
+   filter_t upper = slice_of(*until_to, dbp, slice);
+   if (!before_from) {
+      return upper;
+   }
+   filter_t lower = slice_of(*before_from, dbp, slice);
+   ret = new Roaring(roaring::api::roaring_bitmap_andnot(&upper.getAsConst()->roaring, &lower.getAsConst()->roaring));
+   upper.free();
+   lower.free();
    return {ret, nullptr};
 }
 
-filter_t NucEqEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp) {
-   return {nullptr, dbp.seq_store.bm(position, value)};
+filter_t NucEqEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp, slice_t slice) {
+   if (dbp.seq_store.has_extents(position, value)) {
+      /// The bitmap together with the edge gaps or runs of N covering the position
+      return {dbp.seq_store.bma(position, value, slice.begin, slice.end), nullptr};
+   }
+   return slice_of(*dbp.seq_store.bm(position, value), dbp, slice);
 }
 
-filter_t NucMbEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp) {
+filter_t NucMbEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp, slice_t slice) {
+   if (const Roaring* precomputed = dbp.seq_store.bma_precomputed(position, value)) {
+      return slice_of(*precomputed, dbp, slice);
+   }
    if (!negated) {
       /// Normal case
-      return {dbp.seq_store.bma(position, value), nullptr};
+      return {dbp.seq_store.bma(position, value, slice.begin, slice.end), nullptr};
    } else {
       /// The bitmap of this->value has been flipped... still have to union it with the other symbols
-      return {dbp.seq_store.bma_neg(position, value), nullptr};
+      return {dbp.seq_store.bma_neg(position, value, slice.begin, slice.end), nullptr};
    }
 }
 
-filter_t PangoLineageEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp) {
+filter_t CoveredEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp, slice_t slice) {
+   return {dbp.seq_store.uncovered(from, to, slice.begin, slice.end), nullptr, nullptr, true};
+}
+
+filter_t PangoLineageEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp, slice_t slice) {
    if (lineageKey == UINT32_MAX) return {new Roaring(), nullptr};
    if (includeSubLineages) {
-      return {nullptr, &dbp.meta_store.sublineage_bitmaps[lineageKey]};
+      return slice_of(dbp.meta_store.sublineage_bitmap(lineageKey), dbp, slice);
    } else {
-      return {nullptr, &dbp.meta_store.lineage_bitmaps[lineageKey]};
+      return slice_of(dbp.meta_store.lineage_bitmaps[lineageKey], dbp, slice);
    }
 }
 
-filter_t CountryEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp) {
-   return {nullptr, &dbp.meta_store.country_bitmaps[countryKey]};
+filter_t CountryEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp, slice_t slice) {
+   return slice_of(dbp.meta_store.country_bitmaps[countryKey], dbp, slice);
+}
+
+filter_t RegionEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp, slice_t slice) {
+   return slice_of(dbp.meta_store.region_bitmaps[regionKey], dbp, slice);
 }
 
-filter_t RegionEx::evaluate(const Database& /*db*/, const DatabasePartition& dbp) {
-   return {nullptr, &dbp.meta_store.region_bitmaps[regionKey]};
+const Roaring* StrEqEx::index_lookup(const Database& db, const DatabasePartition& dbp) const {
+   static const Roaring empty;
+   const uint32_t col = db.dict->get_colid(column);
+   const uint64_t value_id = db.dict->get_id(value);
+   if (col >= dbp.meta_store.cols.size() || value_id == UINT64_MAX) {
+      return &empty;
+   }
+   if (col >= dbp.meta_store.col_bitmaps.size() || !dbp.meta_store.col_bitmaps[col]) {
+      return nullptr;
+   }
+   const auto& index = *dbp.meta_store.col_bitmaps[col];
+   auto it = index.find(value_id);
+   return it == index.end() ? &empty : &it->second;
 }
 
-filter_t StrEqEx::evaluate(const Database& db, const DatabasePartition& dbp) {
-   unsigned columnIndex = db.dict->get_colid(this->column);
-   constexpr unsigned BUFFER_SIZE = 1024;
-   std::vector<uint32_t> buffer(BUFFER_SIZE);
+filter_t StrEqEx::evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   if (const Roaring* bm = index_lookup(db, dbp)) {
+      return slice_of(*bm, dbp, slice);
+   }
+   /// Column with too many distinct values for an index: scan the slice, appending every row to the
+   /// buffer but only advancing past the matching ones, such that the loop has no branches
+   const std::vector<uint64_t>& values = dbp.meta_store.cols[db.dict->get_colid(column)];
+   const uint64_t value_id = db.dict->get_id(value);
+   constexpr uint32_t BUFFER_SIZE = 1024;
+   uint32_t buffer[BUFFER_SIZE];
    Roaring* ret = new Roaring();
-   for (uint32_t seq : dbp.meta_store.cols[columnIndex]) {
-      buffer.push_back(seq);
-      if (buffer.size() == BUFFER_SIZE) {
-         ret->addMany(BUFFER_SIZE, buffer.data());
-         buffer.clear();
+   for (uint32_t block = slice.begin; block < slice.end; block += BUFFER_SIZE) {
+      const uint32_t block_end = std::min(block + BUFFER_SIZE, slice.end);
+      uint32_t n = 0;
+      for (uint32_t sid = block; sid < block_end; ++sid) {
+         buffer[n] = sid;
+         n += values[sid] == value_id;
       }
-   }
-   if (buffer.size() > 0) {
-      ret->addMany(buffer.size(), buffer.data());
+      ret->addMany(n, buffer);
    }
    return {ret, nullptr};
 }
 
-filter_t FullEx::evaluate(const Database&, const DatabasePartition& dbp) {
+filter_t FullEx::evaluate(const Database&, const DatabasePartition&, slice_t slice) {
    Roaring* ret = new Roaring();
-   ret->addRange(0, dbp.sequenceCount);
+   ret->addRange(slice.begin, slice.end);
    return {ret, nullptr};
 }
 
-filter_t EmptyEx::evaluate(const Database&, const DatabasePartition&) {
+filter_t EmptyEx::evaluate(const Database&, const DatabasePartition&, slice_t) {
    return {new Roaring(), nullptr};
 }
 } // namespace silo;
 
-silo::result_s silo::execute_query(const silo::Database& db, const std::string& query, std::ostream& res_out, std::ostream& perf_out) {
-   std::cout << "Executing query: " << query << std::endl;
+silo::filter_t silo::evaluate_slices(BoolExpression& filter, const Database& db, const DatabasePartition& dbp, bool compiled) {
+   auto evaluate = [&](slice_t slice) {
+      return compiled ? evaluate_compiled(filter, db, dbp, slice) : filter.evaluate(db, dbp, slice);
+   };
+   /// Partitions pruned by simplify need no slices
+   if (filter.type() == ExType::EMPTY || filter.type() == ExType::FULL) {
+      return filter.evaluate(db, dbp, {0, dbp.sequenceCount});
+   }
+   const uint32_t slice_count = (dbp.sequenceCount + slice_size - 1) / slice_size;
+   if (slice_count <= 1) {
+      return evaluate({0, dbp.sequenceCount});
+   }
+   std::vector<filter_t> slice_filters(slice_count);
+   auto slice_of_index = [&](uint32_t s) -> slice_t {
+      return {s * slice_size, (uint32_t) std::min((uint64_t) (s + 1) * slice_size, (uint64_t) dbp.sequenceCount)};
+   };
+   tbb::parallel_for((uint32_t) 0, slice_count, [&](uint32_t s) {
+      slice_filters[s] = evaluate(slice_of_index(s));
+   });
+   /// The complement over the partition is the union of the complements over the slices,
+   /// if all slices are complemented. Otherwise the complemented slices are materialized.
+   const bool complemented = std::all_of(slice_filters.begin(), slice_filters.end(), [](const filter_t& f) { return f.complemented; });
+   if (!complemented) {
+      tbb::parallel_for((uint32_t) 0, slice_count, [&](uint32_t s) {
+         slice_filters[s].materialize(slice_of_index(s).begin, slice_of_index(s).end);
+      });
+   }
+   /// The slices are disjoint, the union concatenates their containers
+   std::vector<const Roaring*> union_tmp;
+   for (const auto& slice_filter : slice_filters) {
+      union_tmp.push_back(slice_filter.getAsConst());
+   }
+   Roaring* ret = new Roaring(Roaring::fastunion(union_tmp.size(), union_tmp.data()));
+   for (auto& slice_filter : slice_filters) {
+      slice_filter.free();
+   }
+   return {ret, nullptr, nullptr, complemented};
+}
 
-   rapidjson::Document doc;
+void silo::report_nof_decisions(BoolExpression& filter, uint32_t partition, std::ostream& perf_out) {
+   switch (filter.type()) {
+      case ExType::CACHED:
+         report_nof_decisions(*dynamic_cast<CachedEx&>(filter).child, partition, perf_out);
+         break;
+      case ExType::PROFILED:
+         report_nof_decisions(*dynamic_cast<ProfiledEx&>(filter).child, partition, perf_out);
+         break;
+      case ExType::AND: {
+         auto& and_ex = dynamic_cast<AndEx&>(filter);
+         for (auto& child : and_ex.children) {
+            report_nof_decisions(*child, partition, perf_out);
+         }
+         for (auto& child : and_ex.negated_children) {
+            report_nof_decisions(*child, partition, perf_out);
+         }
+         break;
+      }
+      case ExType::OR:
+         for (auto& child : dynamic_cast<OrEx&>(filter).children) {
+            report_nof_decisions(*child, partition, perf_out);
+         }
+         break;
+      case ExType::NEG:
+         report_nof_decisions(*dynamic_cast<NegEx&>(filter).child, partition, perf_out);
+         break;
+      case ExType::NOF: {
+         auto& nof_ex = dynamic_cast<NOfEx&>(filter);
+         std::sort(nof_ex.decisions.begin(), nof_ex.decisions.end(),
+                   [](const nof_decision_t& a, const nof_decision_t& b) { return a.slice_begin < b.slice_begin; });
+         for (const auto& decision : nof_ex.decisions) {
+            std::osyncstream(perf_out) << "N-Of (n=" << nof_ex.n << ", children=" << nof_ex.children.size()
+                                       << ") partition " << partition << " slice " << decision.slice_begin / slice_size
+                                       << ": impl " << (decision.impl == NOfEx::impl_fused ? "fused" : std::to_string(decision.impl))
+                                       << (decision.automatic ? " (auto)" : " (fixed)")
+                                       << ", estimated cost " << std::fixed << std::setprecision(0) << decision.estimated_cost
+                                       << ", " << decision.microseconds << " microseconds\n";
+         }
+         nof_ex.decisions.clear();
+         for (auto& child : nof_ex.children) {
+            report_nof_decisions(*child, partition, perf_out);
+         }
+         break;
+      }
+      default:
+         break;
+   }
+}
+
+/// The explanations of the partitions, together with the times of the phases of the query
+static std::string explain_partitions(const silo::Database& db, const std::vector<std::string>& explanations, const silo::result_s& result) {
+   std::string ret = "{\"parseTime\":" + std::to_string(result.parse_time) + ",\"filterTime\":" + std::to_string(result.filter_time) +
+      ",\"actionTime\":" + std::to_string(result.action_time) + ",\"partitions\":[";
+   for (size_t i = 0; i < explanations.size(); ++i) {
+      if (i > 0) ret += ",";
+      ret += "{\"partition\":" + std::to_string(i) + ",\"sequenceCount\":" + std::to_string(db.partitions[i].sequenceCount) +
+         ",\"filter\":" + explanations[i] + "}";
+   }
+   ret += "]}";
+   return ret;
+}
+
+static void parse_query(rapidjson::Document& doc, const std::string& query) {
    doc.Parse(query.c_str());
    if (!doc.HasMember("filter") || !doc["filter"].IsObject() ||
        !doc.HasMember("action") || !doc["action"].IsObject()) {
-      throw QueryParseException("Query json must contain filter and action.");
+      throw silo::QueryParseException("Query json must contain filter and action.");
+   }
+}
+
+static silo::action_t parse_action(const rapidjson::Value& action) {
+   assert(action.HasMember("type"));
+   assert(action["type"].IsString());
+   silo::action_t ret;
+   ret.type = action["type"].GetString();
+   if (action.HasMember("groupByFields")) {
+      assert(action["groupByFields"].IsArray());
+      for (const auto& it : action["groupByFields"].GetArray()) {
+         ret.group_by_fields.push_back(it.GetString());
+      }
+   }
+   if (action.HasMember("minProportion") && action["minProportion"].IsDouble()) {
+      ret.min_proportion = action["minProportion"].GetDouble();
+   }
+   if (action.HasMember("fields") && action["fields"].IsArray()) {
+      ret.fields.clear();
+      for (const auto& it : action["fields"].GetArray()) {
+         ret.fields.push_back(it.GetString());
+      }
+   }
+   if (action.HasMember("orderBy") && action["orderBy"].IsString()) {
+      ret.order_by = action["orderBy"].GetString();
+   }
+   if (action.HasMember("offset") && action["offset"].IsUint()) {
+      ret.offset = action["offset"].GetUint();
+   }
+   if (action.HasMember("limit") && action["limit"].IsUint()) {
+      ret.limit = action["limit"].GetUint();
+   }
+   return ret;
+}
+
+/// Writes the json result of the action to res_out. Errors are returned in ret.return_message instead.
+static void execute_action(const silo::Database& db, const silo::action_t& action, std::vector<silo::filter_t>& partition_filters, silo::result_s& ret,
+                           std::ostream& res_out) {
+   const std::string& action_type = action.type;
+   silo::JsonWriter out(res_out);
+
+   if (!action.group_by_fields.empty()) {
+      if (action_type == "Aggregated") {
+         std::vector<silo::group_count_t> groups = execute_grouped_count(db, partition_filters, action.group_by_fields);
+         out.begin_array();
+         for (const auto& group : groups) {
+            out.begin_object();
+            for (size_t f = 0; f < group.values.size(); ++f) {
+               out.key(action.group_by_fields[f]);
+               out.value(group.values[f]);
+            }
+            out.key("count");
+            out.value(group.count);
+            out.end_object();
+         }
+         out.end_array();
+      } else if (action_type == "List") {
+      } else if (action_type == "Mutations") {
+      } else {
+         ret.return_message = "Unknown action ";
+         ret.return_message += action_type;
+      }
+   } else {
+      if (action_type == "Aggregated") {
+         out.begin_object();
+         out.key("count");
+         out.value(execute_count(db, partition_filters));
+         out.end_object();
+      } else if (action_type == "List") {
+         execute_list(db, partition_filters, action.fields, action.order_by, action.offset, action.limit, out);
+      } else if (action_type == "Mutations") {
+         double min_proportion = 0.02;
+         if (action.min_proportion) {
+            if (*action.min_proportion <= 0.0) {
+               ret.return_message = "{\"message\": \"minProportion must be in interval (0.0,1.0]\"}";
+               for (auto& filter : partition_filters) {
+                  filter.free();
+               }
+               return;
+            }
+            min_proportion = *action.min_proportion;
+         }
+         std::vector<silo::mutation_proportion> mutations = execute_mutations(db, partition_filters, min_proportion);
+         out.begin_array();
+         for (auto& s : mutations) {
+            char mutation[16];
+            mutation[0] = s.mut_from;
+            char* end = std::to_chars(mutation + 1, mutation + sizeof(mutation) - 1, s.position).ptr;
+            *end++ = s.mut_to;
+            out.begin_object();
+            out.key("mutation");
+            out.value(std::string_view(mutation, end - mutation));
+            out.key("proportion");
+            out.value(s.proportion);
+            out.key("count");
+            out.value(s.count);
+            out.end_object();
+         }
+         out.end_array();
+      } else {
+         ret.return_message = "Unknown action ";
+         ret.return_message += action_type;
+      }
+   }
+}
+
+silo::result_s silo::execute_query(const silo::Database& db, const std::string& query, std::ostream& res_out, std::ostream& perf_out, bool compile_filter) {
+   /// Trims the positions loaded by earlier queries, before pinning those of this one
+   db.trim_positions();
+   const auto pin = db.pin_positions();
+   std::cout << "Executing query: " << query << std::endl;
+
+   rapidjson::Document doc;
+   parse_query(doc, query);
+
+   /// "plan" returns the planned filter per partition instead of the result,
+   /// "analyze" additionally evaluates the query and returns the statistics of every node
+   std::string explain_mode;
+   if (doc.HasMember("explain")) {
+      if (!doc["explain"].IsString() || (doc["explain"].GetString() != std::string("plan") && doc["explain"].GetString() != std::string("analyze"))) {
+         throw QueryParseException("explain must be \"plan\" or \"analyze\".");
+      }
+      explain_mode = doc["explain"].GetString();
    }
 
    result_s ret;
@@ -544,67 +1053,246 @@ silo::result_s silo::execute_query(const silo::Database& db, const std::string&
    perf_out << "Parse: " << std::to_string(ret.parse_time) << " microseconds\n";
 
    std::vector<silo::filter_t> partition_filters(db.partitions.size());
+   std::vector<std::string> explanations(db.partitions.size());
    {
       BlockTimer timer(ret.filter_time);
       tbb::blocked_range<size_t> r(0, db.partitions.size(), 1);
       tbb::parallel_for(r.begin(), r.end(), [&](const size_t& i) {
          std::unique_ptr<BoolExpression> part_filter = filter->simplify(db, db.partitions[i]);
+         part_filter->plan(db, db.partitions[i]);
+         if (db.result_cache->enabled()) {
+            part_filter = cache_subexpressions(std::move(part_filter), db, i);
+         }
          std::osyncstream(std::cout) << "Simplified query: " << part_filter->to_string(db) << std::endl;
-         partition_filters[i] = part_filter->evaluate(db, db.partitions[i]);
+         if (explain_mode == "plan") {
+            explanations[i] = explain(*part_filter, db, db.partitions[i]);
+            partition_filters[i] = {new Roaring(), nullptr};
+            return;
+         }
+         if (explain_mode == "analyze") {
+            part_filter = profile_subexpressions(std::move(part_filter));
+         }
+         partition_filters[i] = evaluate_slices(*part_filter, db, db.partitions[i], compile_filter);
+         report_nof_decisions(*part_filter, i, perf_out);
+         if (explain_mode == "analyze") {
+            explanations[i] = explain(*part_filter, db, db.partitions[i]);
+         }
       });
    }
    perf_out << "Execution (filter): " << std::to_string(ret.filter_time) << " microseconds\n";
 
+   if (explain_mode == "plan") {
+      for (auto& partition_filter : partition_filters) {
+         partition_filter.free();
+      }
+      ret.action_time = 0;
+      ret.return_message = explain_partitions(db, explanations, ret);
+      res_out << ret.return_message;
+      return ret;
+   }
+
    {
       BlockTimer timer(ret.action_time);
-      const auto& action = doc["action"];
-      assert(action.HasMember("type"));
-      assert(action["type"].IsString());
-      const auto& action_type = action["type"].GetString();
-
-      if (action.HasMember("groupByFields")) {
-         assert(action["groupByFields"].IsArray());
-         std::vector<std::string> groupByFields;
-         for (const auto& it : action["groupByFields"].GetArray()) {
-            groupByFields.push_back(it.GetString());
-         }
-         if (strcmp(action_type, "Aggregated") == 0) {
-         } else if (strcmp(action_type, "List") == 0) {
-         } else if (strcmp(action_type, "Mutations") == 0) {
-         } else {
-            ret.return_message = "Unknown action ";
-            ret.return_message += action_type;
-         }
-      } else {
-         if (strcmp(action_type, "Aggregated") == 0) {
-            unsigned count = execute_count(db, partition_filters);
-            ret.return_message = "{\"count\": " + std::to_string(count) + "}";
-         } else if (strcmp(action_type, "List") == 0) {
-         } else if (strcmp(action_type, "Mutations") == 0) {
-            double min_proportion = 0.02;
-            if (action.HasMember("minProportion") && action["minProportion"].IsDouble()) {
-               if (action["minProportion"].GetDouble() <= 0.0) {
-                  ret.return_message = "{\"message\": \"minProportion must be in interval (0.0,1.0]\"}";
-               }
-               min_proportion = action["minProportion"].GetDouble();
+      /// The result of the action is replaced by the statistics for analyze
+      std::ostream discard(nullptr);
+      execute_action(db, parse_action(doc["action"]), partition_filters, ret, explain_mode == "analyze" ? discard : res_out);
+   }
+
+   perf_out << "Execution (action): " << std::to_string(ret.action_time) << " microseconds\n";
+
+   if (explain_mode == "analyze") {
+      /// The result of the action is replaced by the statistics, its time is still reported
+      ret.return_message = explain_partitions(db, explanations, ret);
+   }
+
+   res_out << ret.return_message;
+
+   return ret;
+}
+
+/// Turns an owned result into a shared one, such that it can be handed to several actions
+static silo::filter_t share(silo::filter_t& filter) {
+   if (filter.mutable_res) {
+      filter.shared_res = std::shared_ptr<const roaring::Roaring>(filter.mutable_res);
+      filter.immutable_res = filter.mutable_res;
+      filter.mutable_res = nullptr;
+   }
+   return filter;
+}
+
+std::vector<silo::result_s> silo::execute_queries(const silo::Database& db, const std::vector<std::string>& queries, std::ostream& perf_out, bool compile_filter) {
+   db.trim_positions();
+   const auto pin = db.pin_positions();
+   const size_t query_count = queries.size();
+   std::vector<result_s> ret(query_count);
+   std::vector<rapidjson::Document> docs(query_count);
+   std::vector<std::unique_ptr<BoolExpression>> filters(query_count);
+   for (size_t q = 0; q < query_count; ++q) {
+      std::cout << "Executing query: " << queries[q] << std::endl;
+      BlockTimer timer(ret[q].parse_time);
+      parse_query(docs[q], queries[q]);
+      if (docs[q].HasMember("explain")) {
+         throw QueryParseException("explain is not supported for a batch of queries.");
+      }
+      filters[q] = to_ex(db, docs[q]["filter"], 0);
+   }
+
+   /// Results of subexpressions that occur more than once in the batch, for the duration of the batch
+   ResultCache memo(SIZE_MAX);
+   std::vector<std::vector<filter_t>> partition_filters(query_count, std::vector<filter_t>(db.partitions.size()));
+   int64_t filter_time = 0;
+   {
+      BlockTimer timer(filter_time);
+      tbb::blocked_range<size_t> r(0, db.partitions.size(), 1);
+      tbb::parallel_for(r.begin(), r.end(), [&](const size_t& i) {
+         const DatabasePartition& dbp = db.partitions[i];
+         std::vector<std::unique_ptr<BoolExpression>> part_filters(query_count);
+         /// Queries with the same filter on this partition take the result of the first of them
+         std::vector<size_t> same_as(query_count);
+         std::unordered_map<std::string, size_t> first_with_filter;
+         std::unordered_map<std::string, uint32_t> occurrences;
+         for (size_t q = 0; q < query_count; ++q) {
+            part_filters[q] = filters[q]->simplify(db, dbp);
+            part_filters[q]->plan(db, dbp);
+            same_as[q] = first_with_filter.emplace(canonical_key(*part_filters[q], db), q).first->second;
+            if (same_as[q] == q) {
+               part_filters[q] = cache_subexpressions(std::move(part_filters[q]), db, i, [&](const std::string& key) -> ResultCache* {
+                  ++occurrences[key];
+                  return nullptr;
+               });
             }
-            std::vector<mutation_proportion> mutations = execute_mutations(db, partition_filters, min_proportion);
-            ret.return_message = "";
-            for (auto& s : mutations) {
-               ret.return_message += "{\"mutation\":\"";
-               ret.return_message += s.mut_from;
-               ret.return_message += std::to_string(s.position);
-               ret.return_message += s.mut_to;
-               ret.return_message += "\",\"proportion\":" + std::to_string(s.proportion) +
-                  ",\"count\":" + std::to_string(s.count) + "},";
+         }
+         for (size_t q = 0; q < query_count; ++q) {
+            if (same_as[q] != q) {
+               partition_filters[q][i] = share(partition_filters[same_as[q]][i]);
+               continue;
             }
-         } else {
-            ret.return_message = "Unknown action ";
-            ret.return_message += action_type;
+            part_filters[q] = cache_subexpressions(std::move(part_filters[q]), db, i, [&](const std::string& key) -> ResultCache* {
+               if (occurrences[key] > 1) {
+                  return &memo;
+               }
+               return db.result_cache->enabled() ? db.result_cache.get() : nullptr;
+            });
+            std::osyncstream(std::cout) << "Simplified query: " << part_filters[q]->to_string(db) << std::endl;
+            /// The compiled filter also looks up every interior CachedEx and puts the misses, so the memo is shared either way
+            partition_filters[q][i] = evaluate_slices(*part_filters[q], db, dbp, compile_filter);
+            report_nof_decisions(*part_filters[q], i, perf_out);
          }
+      });
+   }
+   perf_out << "Execution (filter, shared by " << query_count << " queries): " << std::to_string(filter_time) << " microseconds\n";
+
+   for (size_t q = 0; q < query_count; ++q) {
+      ret[q].filter_time = filter_time;
+      {
+         BlockTimer timer(ret[q].action_time);
+         std::stringstream res_out;
+         execute_action(db, parse_action(docs[q]["action"]), partition_filters[q], ret[q], res_out);
+         ret[q].return_message += res_out.str();
       }
+      perf_out << "Execution (action " << q << "): " << std::to_string(ret[q].action_time) << " microseconds\n";
    }
+   return ret;
+}
+
+std::unique_ptr<silo::prepared_query_t> silo::prepare_query(const silo::Database& db, const std::string& query) {
+   db.trim_positions();
+   const auto pin = db.pin_positions();
+   std::cout << "Preparing query: " << query << std::endl;
 
+   rapidjson::Document doc;
+   parse_query(doc, query);
+   if (doc.HasMember("explain")) {
+      throw QueryParseException("explain is not supported for a prepared query.");
+   }
+
+   auto ret = std::make_unique<prepared_query_t>();
+   ret->action = parse_action(doc["action"]);
+   std::unique_ptr<BoolExpression> filter = to_ex(db, doc["filter"], 0, &ret->slots);
+   std::cout << "Parsed query: " << filter->to_string(db) << std::endl;
+
+   ret->partition_filters.resize(db.partitions.size());
+   tbb::parallel_for((size_t) 0, db.partitions.size(), [&](size_t i) {
+      ret->partition_filters[i] = filter->simplify(db, db.partitions[i]);
+      ret->partition_filters[i]->plan(db, db.partitions[i]);
+   });
+   return ret;
+}
+
+/// Binds the leaves of the parameter slots, simplified for the partition, to the ParamEx nodes of the filter
+static void bind_parameters(silo::BoolExpression& ex, const std::vector<std::unique_ptr<silo::BoolExpression>>& leaves,
+                            const silo::Database& db, const silo::DatabasePartition& dbp) {
+   using namespace silo;
+   switch (ex.type()) {
+      case ExType::PARAM: {
+         auto& param_ex = dynamic_cast<ParamEx&>(ex);
+         param_ex.bound = leaves[param_ex.slot]->simplify(db, dbp);
+         break;
+      }
+      case ExType::AND: {
+         auto& and_ex = dynamic_cast<AndEx&>(ex);
+         for (auto& child : and_ex.children) {
+            bind_parameters(*child, leaves, db, dbp);
+         }
+         for (auto& child : and_ex.negated_children) {
+            bind_parameters(*child, leaves, db, dbp);
+         }
+         break;
+      }
+      case ExType::OR:
+         for (auto& child : dynamic_cast<OrEx&>(ex).children) {
+            bind_parameters(*child, leaves, db, dbp);
+         }
+         break;
+      case ExType::NOF:
+         for (auto& child : dynamic_cast<NOfEx&>(ex).children) {
+            bind_parameters(*child, leaves, db, dbp);
+         }
+         break;
+      case ExType::NEG:
+         bind_parameters(*dynamic_cast<NegEx&>(ex).child, leaves, db, dbp);
+         break;
+      default:
+         break;
+   }
+}
+
+silo::result_s silo::execute_prepared(const silo::Database& db, prepared_query_t& prepared, const query_params_t& params,
+                                      std::ostream& res_out, std::ostream& perf_out, bool compile_filter) {
+   db.trim_positions();
+   const auto pin = db.pin_positions();
+   std::lock_guard<std::mutex> lock(prepared.mutex);
+
+   result_s ret;
+   std::vector<std::unique_ptr<BoolExpression>> leaves;
+   {
+      BlockTimer timer(ret.parse_time);
+      for (const param_slot_t& slot : prepared.slots) {
+         leaves.push_back(slot(params));
+      }
+   }
+   perf_out << "Bind parameters: " << std::to_string(ret.parse_time) << " microseconds\n";
+
+   std::vector<silo::filter_t> partition_filters(db.partitions.size());
+   {
+      BlockTimer timer(ret.filter_time);
+      tbb::parallel_for((size_t) 0, db.partitions.size(), [&](size_t i) {
+         BoolExpression& part_filter = *prepared.partition_filters[i];
+         if (!leaves.empty()) {
+            /// The estimates of the bound leaves change the order of evaluation
+            bind_parameters(part_filter, leaves, db, db.partitions[i]);
+            part_filter.plan(db, db.partitions[i]);
+         }
+         partition_filters[i] = evaluate_slices(part_filter, db, db.partitions[i], compile_filter);
+         report_nof_decisions(part_filter, i, perf_out);
+      });
+   }
+   perf_out << "Execution (filter): " << std::to_string(ret.filter_time) << " microseconds\n";
+
+   {
+      BlockTimer timer(ret.action_time);
+      execute_action(db, prepared.action, partition_filters, ret, res_out);
+   }
    perf_out << "Execution (action): " << std::to_string(ret.action_time) << " microseconds\n";
 
    res_out << ret.return_message;
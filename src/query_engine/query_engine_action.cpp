@@ -3,93 +3,483 @@
 //
 
 #include "silo/query_engine/query_engine.h"
+#include "silo/roaring/roaring_containers.h"
 #include <cmath>
 #include <silo/common/PerfEvent.hpp>
 #include <tbb/blocked_range.h>
+#include <tbb/blocked_range2d.h>
+#include <tbb/enumerable_thread_specific.h>
 #include <tbb/parallel_for.h>
 #include <tbb/parallel_for_each.h>
 
-uint64_t silo::execute_count(const silo::Database& /*db*/, std::vector<silo::filter_t>& partition_filters) {
+uint64_t silo::execute_count(const silo::Database& db, std::vector<silo::filter_t>& partition_filters) {
    std::atomic<uint32_t> count = 0;
-   tbb::parallel_for_each(partition_filters.begin(), partition_filters.end(), [&](auto& filter) {
-      count += filter.getAsConst()->cardinality();
-      filter.free();
+   tbb::parallel_for((size_t) 0, partition_filters.size(), [&](size_t i) {
+      count += partition_filters[i].cardinality(0, db.partitions[i].sequenceCount);
+      partition_filters[i].free();
    });
    return count;
 }
 
+namespace {
+
+enum class field_kind_t {
+   EPI,
+   DATE,
+   COUNTRY,
+   REGION,
+   LINEAGE,
+   COLUMN
+};
+
+/// A metadata field of the sequences, as selected by name in groupByFields or the fields of List.
+/// Its ids are below domain, such that the ids of several fields combine into one key in mixed radix.
+struct metadata_field_t {
+   field_kind_t kind;
+   uint32_t col = 0;
+   uint64_t domain;
+
+   /// Values of additional columns are shifted by one, such that unknown values (UINT64_MAX) become 0
+   uint64_t id(const silo::DatabasePartition& dbp, uint32_t sid) const {
+      switch (kind) {
+         case field_kind_t::EPI:
+            return dbp.meta_store.sid_to_epi[sid];
+         case field_kind_t::DATE:
+            return dbp.meta_store.sid_to_day[sid];
+         case field_kind_t::COUNTRY:
+            return dbp.meta_store.sid_to_country[sid];
+         case field_kind_t::REGION:
+            return dbp.meta_store.sid_to_region[sid];
+         case field_kind_t::LINEAGE:
+            return dbp.meta_store.sid_to_lineage[sid];
+         case field_kind_t::COLUMN:
+            return dbp.meta_store.cols[col][sid] + 1;
+      }
+      return 0;
+   }
+
+   std::string value(const silo::Database& db, uint64_t id) const {
+      switch (kind) {
+         case field_kind_t::EPI:
+            return "EPI_ISL_" + std::to_string(id);
+         case field_kind_t::DATE:
+            return silo::day_to_string(id);
+         case field_kind_t::COUNTRY:
+            return db.dict->get_country(id);
+         case field_kind_t::REGION:
+            return db.dict->get_region(id);
+         case field_kind_t::LINEAGE:
+            return db.dict->get_pango(id);
+         case field_kind_t::COLUMN:
+            return db.dict->get_str(id - 1);
+      }
+      return "";
+   }
+};
+
+metadata_field_t parse_field(const silo::Database& db, const std::string& name) {
+   if (name == "gisaid_epi_isl") {
+      return {field_kind_t::EPI, 0, UINT64_MAX};
+   } else if (name == "date") {
+      uint32_t max_day = 0;
+      for (const auto& dbp : db.partitions) {
+         if (!dbp.meta_store.sorted_days.empty()) {
+            max_day = std::max(max_day, dbp.meta_store.sorted_days.back());
+         }
+      }
+      return {field_kind_t::DATE, 0, (uint64_t) max_day + 1};
+   } else if (name == "country") {
+      return {field_kind_t::COUNTRY, 0, std::max<uint64_t>(db.dict->get_country_count(), 1)};
+   } else if (name == "region") {
+      return {field_kind_t::REGION, 0, std::max<uint64_t>(db.dict->get_region_count(), 1)};
+   } else if (name == "pango_lineage") {
+      return {field_kind_t::LINEAGE, 0, std::max<uint64_t>(db.dict->get_pango_count(), 1)};
+   }
+   const uint32_t col = db.dict->get_colid(name);
+   if (col == UINT32_MAX) {
+      throw silo::QueryParseException("Unknown metadata field.");
+   }
+   return {field_kind_t::COLUMN, col, db.dict->get_general_count() + 1};
+}
+
+/// Counts per combined key of a partition or of several merged partitions
+using group_counts_t = std::unordered_map<uint64_t, uint64_t>;
+
+/// Below this many keys, a scan aggregates into an array instead of a hash map
+constexpr uint64_t dense_group_limit = 1 << 16;
+/// A bitmap intersection costs about as much as scanning this many filtered rows
+constexpr uint64_t bitmap_group_cost = 64;
+
+/// Counts the groups of a single field by intersecting the filter with the bitmap of each value.
+/// Returns false if the partition has no bitmaps for the field.
+bool count_by_bitmaps(const metadata_field_t& field, const silo::DatabasePartition& dbp, const silo::filter_t& filter,
+                      group_counts_t& counts) {
+   const roaring::Roaring& bm = *filter.getAsConst();
+   /// For a complemented filter, the rows of a value that are not in bm
+   auto count = [&](const roaring::Roaring& value_bm) -> uint64_t {
+      const uint64_t both = bm.and_cardinality(value_bm);
+      return filter.complemented ? value_bm.cardinality() - both : both;
+   };
+   auto count_values = [&](const std::vector<uint32_t>& sorted_ids, const std::vector<roaring::Roaring>& bitmaps) {
+      for (uint32_t id : sorted_ids) {
+         if (uint64_t c = count(bitmaps[id])) {
+            counts[id] += c;
+         }
+      }
+   };
+   switch (field.kind) {
+      case field_kind_t::EPI:
+         return false;
+      case field_kind_t::DATE: {
+         /// The bitmaps are cumulative, a day has the rows until it without those until the day before
+         const auto& days = dbp.meta_store.sorted_days;
+         uint64_t until_before = 0;
+         for (size_t i = 0; i < days.size(); ++i) {
+            const uint64_t until = count(dbp.meta_store.until_day_bitmaps[i]);
+            if (until > until_before) {
+               counts[days[i]] += until - until_before;
+            }
+            until_before = until;
+         }
+         return true;
+      }
+      case field_kind_t::COUNTRY:
+         count_values(dbp.sorted_countries, dbp.meta_store.country_bitmaps);
+         return true;
+      case field_kind_t::REGION:
+         count_values(dbp.sorted_regions, dbp.meta_store.region_bitmaps);
+         return true;
+      case field_kind_t::LINEAGE:
+         count_values(dbp.sorted_lineages, dbp.meta_store.lineage_bitmaps);
+         return true;
+      case field_kind_t::COLUMN: {
+         const auto& col_bitmaps = dbp.meta_store.col_bitmaps;
+         if (field.col >= col_bitmaps.size() || !col_bitmaps[field.col]) {
+            return false;
+         }
+         for (const auto& [value_id, value_bm] : *col_bitmaps[field.col]) {
+            if (uint64_t c = count(value_bm)) {
+               counts[value_id + 1] += c;
+            }
+         }
+         return true;
+      }
+   }
+   return false;
+}
+
+/// Number of distinct values of the field in the partition, which is the number of intersections of count_by_bitmaps
+uint64_t bitmap_count(const metadata_field_t& field, const silo::DatabasePartition& dbp) {
+   switch (field.kind) {
+      case field_kind_t::EPI:
+         return UINT64_MAX;
+      case field_kind_t::DATE:
+         return dbp.meta_store.sorted_days.size();
+      case field_kind_t::COUNTRY:
+         return dbp.sorted_countries.size();
+      case field_kind_t::REGION:
+         return dbp.sorted_regions.size();
+      case field_kind_t::LINEAGE:
+         return dbp.sorted_lineages.size();
+      case field_kind_t::COLUMN: {
+         const auto& col_bitmaps = dbp.meta_store.col_bitmaps;
+         return field.col < col_bitmaps.size() && col_bitmaps[field.col] ? col_bitmaps[field.col]->size() : UINT64_MAX;
+      }
+   }
+   return UINT64_MAX;
+}
+
+/// Counts the groups by scanning the columns of the filtered rows
+void count_by_scan(const std::vector<metadata_field_t>& fields, uint64_t key_domain, const silo::DatabasePartition& dbp,
+                   silo::filter_t& filter, group_counts_t& counts) {
+   filter.materialize(0, dbp.sequenceCount);
+   std::vector<uint64_t> dense;
+   if (key_domain <= dense_group_limit) {
+      dense.resize(key_domain);
+   }
+   constexpr uint32_t BUFFER_SIZE = 1024;
+   uint32_t buffer[BUFFER_SIZE];
+   roaring::api::roaring_uint32_iterator_t it;
+   roaring::api::roaring_init_iterator(&filter.getAsConst()->roaring, &it);
+   while (uint32_t n = roaring::api::roaring_read_uint32_iterator(&it, buffer, BUFFER_SIZE)) {
+      for (uint32_t i = 0; i < n; ++i) {
+         uint64_t key = 0;
+         for (const metadata_field_t& field : fields) {
+            key = key * field.domain + field.id(dbp, buffer[i]);
+         }
+         if (!dense.empty()) {
+            ++dense[key];
+         } else {
+            ++counts[key];
+         }
+      }
+   }
+   for (uint64_t key = 0; key < dense.size(); ++key) {
+      if (dense[key]) {
+         counts[key] += dense[key];
+      }
+   }
+}
+
+} // namespace
+
+std::vector<silo::group_count_t> silo::execute_grouped_count(const silo::Database& db, std::vector<silo::filter_t>& partition_filters,
+                                                             const std::vector<std::string>& group_by_fields) {
+   std::vector<metadata_field_t> fields;
+   uint64_t key_domain = 1;
+   for (const std::string& name : group_by_fields) {
+      const metadata_field_t field = parse_field(db, name);
+      if (key_domain > UINT64_MAX / field.domain) {
+         throw QueryParseException("Too many combinations of the values of groupByFields.");
+      }
+      key_domain *= field.domain;
+      fields.push_back(field);
+   }
+
+   /// Every partition aggregates into its own partial, such that no locks are needed
+   std::vector<group_counts_t> partials(db.partitions.size());
+   tbb::parallel_for((size_t) 0, partition_filters.size(), [&](size_t i) {
+      const DatabasePartition& dbp = db.partitions[i];
+      filter_t& filter = partition_filters[i];
+      const uint64_t filtered = filter.cardinality(0, dbp.sequenceCount);
+      /// Few values are counted with one intersection each, many by a scan of the filtered rows
+      const bool by_bitmaps = fields.size() == 1 && bitmap_count(fields[0], dbp) <= filtered / bitmap_group_cost;
+      if (filtered > 0 && !(by_bitmaps && count_by_bitmaps(fields[0], dbp, filter, partials[i]))) {
+         count_by_scan(fields, key_domain, dbp, filter, partials[i]);
+      }
+      filter.free();
+   });
+
+   /// Merge the partials pairwise in a tree, the merges of one round touch disjoint partials
+   for (size_t step = 1; step < partials.size(); step *= 2) {
+      tbb::parallel_for((size_t) 0, (partials.size() + 2 * step - 1) / (2 * step), [&](size_t pair) {
+         const size_t into = pair * 2 * step;
+         if (into + step >= partials.size()) {
+            return;
+         }
+         group_counts_t& a = partials[into];
+         group_counts_t& b = partials[into + step];
+         if (a.size() < b.size()) {
+            std::swap(a, b);
+         }
+         for (const auto& [key, count] : b) {
+            a[key] += count;
+         }
+         group_counts_t().swap(b);
+      });
+   }
+
+   std::vector<std::pair<uint64_t, uint64_t>> sorted;
+   if (!partials.empty()) {
+      sorted.assign(partials[0].begin(), partials[0].end());
+   }
+   std::sort(sorted.begin(), sorted.end());
+
+   std::vector<group_count_t> ret;
+   ret.reserve(sorted.size());
+   for (const auto& [key, count] : sorted) {
+      group_count_t group{std::vector<std::string>(fields.size()), count};
+      uint64_t rest = key;
+      for (size_t f = fields.size(); f-- > 0;) {
+         group.values[f] = fields[f].value(db, rest % fields[f].domain);
+         rest /= fields[f].domain;
+      }
+      ret.push_back(std::move(group));
+   }
+   return ret;
+}
+
 std::vector<silo::mutation_proportion> silo::execute_mutations(const silo::Database& db, std::vector<silo::filter_t>& partition_filters, double proportion_threshold) {
    using roaring::Roaring;
 
-   std::vector<uint32_t> N_per_pos(silo::genomeLength);
-   std::vector<uint32_t> C_per_pos(silo::genomeLength);
-   std::vector<uint32_t> T_per_pos(silo::genomeLength);
-   std::vector<uint32_t> A_per_pos(silo::genomeLength);
-   std::vector<uint32_t> G_per_pos(silo::genomeLength);
-   std::vector<uint32_t> gap_per_pos(silo::genomeLength);
+   /// Counters of a position, indexed by the slots below
+   using counts_t = std::array<uint32_t, 6>;
+   enum slot_t : uint32_t { N_SLOT, C_SLOT, T_SLOT, A_SLOT, G_SLOT, GAP_SLOT };
+   /// Positions per tile, see below
+   constexpr size_t position_block = 64;
+
+   std::vector<uint64_t> filter_cardinalities(db.partitions.size());
+   /// Partitions with an empty filter contribute nothing
+   std::vector<unsigned> active_partitions;
+   for (unsigned i = 0; i < db.partitions.size(); ++i) {
+      filter_cardinalities[i] = partition_filters[i].getAsConst()->cardinality();
+      if (filter_cardinalities[i] > 0 || partition_filters[i].complemented) {
+         active_partitions.push_back(i);
+      }
+   }
+
+   /// Positions without variants in any partition cannot reach a positive threshold and are skipped outright
+   std::vector<uint32_t> candidate_positions;
+   for (const silo::DatabasePartition& dbp : db.partitions) {
+      const auto& variant_positions = dbp.seq_store.variant_positions;
+      std::vector<uint32_t> merged;
+      std::set_union(candidate_positions.begin(), candidate_positions.end(), variant_positions.begin(), variant_positions.end(), std::back_inserter(merged));
+      candidate_positions = std::move(merged);
+   }
+
+   /// Per partition, how many of the first sequences of start_gap_order (end_gap_order) are in the filter. The filtered
+   /// edge gaps at a position are read off at leading_gaps (trailing_gaps), see SequenceStore::compress_edge_gaps.
+   struct edge_gap_filter_t {
+      std::vector<uint32_t> leading;
+      std::vector<uint32_t> trailing;
+   };
+   std::vector<edge_gap_filter_t> edge_gap_filters(db.partitions.size());
+   /// Per thread, the filtered runs of N that start minus those that end at each 0-indexed position.
+   /// Their prefix sums are the N at a position that are not in its N bitmap, see SequenceStore::compress_n_runs.
+   tbb::enumerable_thread_specific<std::vector<int32_t>> local_n_run_deltas;
+   tbb::parallel_for_each(active_partitions.begin(), active_partitions.end(), [&](unsigned i) {
+      const silo::SequenceStore& seq_store = db.partitions[i].seq_store;
+      const Roaring& bm = *partition_filters[i].getAsConst();
+      if (!seq_store.n_runs.empty()) {
+         std::vector<int32_t>& deltas = local_n_run_deltas.local();
+         deltas.resize(genomeLength + 1);
+         for (const silo::n_run_t& run : seq_store.n_runs) {
+            if (bm.contains(run.sid) != partition_filters[i].complemented) {
+               ++deltas[run.start];
+               --deltas[run.end];
+            }
+         }
+      }
+      auto prefix_counts = [&](const std::vector<uint32_t>& order, std::vector<uint32_t>& out) {
+         out.assign(order.size() + 1, 0);
+         for (size_t k = 0; k < order.size(); ++k) {
+            out[k + 1] = out[k] + bm.contains(order[k]);
+         }
+      };
+      prefix_counts(seq_store.start_gap_order, edge_gap_filters[i].leading);
+      prefix_counts(seq_store.end_gap_order, edge_gap_filters[i].trailing);
+   });
 
+   std::vector<uint32_t> n_runs_per_pos;
+   if (!local_n_run_deltas.empty()) {
+      n_runs_per_pos.resize(genomeLength);
+      int64_t running = 0;
+      for (uint32_t pos = 0; pos < genomeLength; ++pos) {
+         for (const std::vector<int32_t>& deltas : local_n_run_deltas) {
+            running += deltas[pos];
+         }
+         n_runs_per_pos[pos] = running;
+      }
+   }
+
+   /// Per candidate position
+   std::vector<counts_t> counts(candidate_positions.size());
    int64_t microseconds = 0;
    {
       BlockTimer timer(microseconds);
 
-      tbb::blocked_range<uint32_t> range(0, silo::genomeLength, /*grain_size=*/300);
-      tbb::parallel_for(range.begin(), range.end(), [&](uint32_t pos) {
-         for (unsigned i = 0; i < db.partitions.size(); ++i) {
+      /// Each thread accumulates into its own counters, no tile synchronizes with another
+      tbb::enumerable_thread_specific<std::vector<counts_t>> local_counts([&] {
+         return std::vector<counts_t>(candidate_positions.size());
+      });
+
+      /// A tile is a range of partitions and a block of positions. A task sweeps its block partition by partition,
+      /// such that the filter of the partition stays in cache. TBB splits tiles along both dimensions and balances them by work stealing.
+      tbb::blocked_range2d<size_t> tiles(0, active_partitions.size(), 1, 0, candidate_positions.size(), position_block);
+      tbb::parallel_for(tiles, [&](const tbb::blocked_range2d<size_t>& tile) {
+         std::vector<counts_t>& local = local_counts.local();
+         for (size_t a = tile.rows().begin(); a != tile.rows().end(); ++a) {
+            const unsigned i = active_partitions[a];
             const silo::DatabasePartition& dbp = db.partitions[i];
-            silo::filter_t filter = partition_filters[i];
+            const silo::filter_t& filter = partition_filters[i];
             const Roaring& bm = *filter.getAsConst();
 
-            N_per_pos[pos] += bm.and_cardinality(dbp.seq_store.positions[pos].bitmaps[silo::Symbol::N]);
+            for (size_t c = tile.cols().begin(); c != tile.cols().end(); ++c) {
+               const uint32_t pos = candidate_positions[c];
+               const auto& position = dbp.seq_store.position(pos);
+               const Roaring* variants = dbp.seq_store.variants(pos);
 
-            char pos_ref = db.global_reference[0].at(pos);
-            if (pos_ref != 'C') {
-               if (dbp.seq_store.positions[pos].flipped_bitmap != silo::Symbol::C) { /// everything fine
-                  C_per_pos[pos] += bm.and_cardinality(dbp.seq_store.positions[pos].bitmaps[silo::Symbol::C]);
-               } else { /// Bitmap was flipped
-                  C_per_pos[pos] +=
-                     roaring::api::roaring_bitmap_andnot_cardinality(&bm.roaring, &dbp.seq_store.positions[pos].bitmaps[silo::Symbol::C].roaring);
+               char pos_ref = db.global_reference[0].at(pos);
+               /// The symbols counted at this position, with the slot of each. Unflipped symbols other
+               /// than the reference are subsets of the variants and are bounded to its containers.
+               struct needed_t {
+                  silo::Symbol symbol;
+                  slot_t slot;
+                  bool bounded;
+               };
+               needed_t needed[6];
+               uint32_t count = 0;
+               needed[count++] = {silo::Symbol::N, N_SLOT, false};
+               /// Without variants the partition only contributes the N of this position
+               if (variants) {
+                  auto need = [&](silo::Symbol symbol, slot_t slot) {
+                     needed[count++] = {symbol, slot, position.flipped_bitmap != symbol};
+                  };
+                  if (pos_ref != 'C') {
+                     need(silo::Symbol::C, C_SLOT);
+                  }
+                  if (pos_ref != 'T') {
+                     need(silo::Symbol::T, T_SLOT);
+                  }
+                  if (pos_ref != 'A') {
+                     need(silo::Symbol::A, A_SLOT);
+                  }
+                  if (pos_ref != 'G') {
+                     need(silo::Symbol::G, G_SLOT);
+                  }
+                  if (pos_ref != '-') {
+                     need(silo::Symbol::gap, GAP_SLOT);
+                  }
                }
-            }
-            if (pos_ref != 'T') {
-               if (dbp.seq_store.positions[pos].flipped_bitmap != silo::Symbol::T) { /// everything fine
-                  T_per_pos[pos] += bm.and_cardinality(dbp.seq_store.positions[pos].bitmaps[silo::Symbol::T]);
-               } else { /// Bitmap was flipped
-                  T_per_pos[pos] +=
-                     roaring::api::roaring_bitmap_andnot_cardinality(&bm.roaring, &dbp.seq_store.positions[pos].bitmaps[silo::Symbol::T].roaring);
+               const uint32_t bounded_count = std::stable_partition(needed, needed + count, [](const needed_t& n) { return n.bounded; }) - needed;
+
+               /// All intersections with the filter in at most two passes over its containers
+               const Roaring* symbol_bms[6];
+               for (uint32_t s = 0; s < count; ++s) {
+                  symbol_bms[s] = &position.bitmaps[needed[s].symbol];
                }
-            }
-            if (pos_ref != 'A') {
-               if (dbp.seq_store.positions[pos].flipped_bitmap != silo::Symbol::A) { /// everything fine
-                  A_per_pos[pos] += bm.and_cardinality(dbp.seq_store.positions[pos].bitmaps[silo::Symbol::A]);
-               } else { /// Bitmap was flipped
-                  A_per_pos[pos] +=
-                     roaring::api::roaring_bitmap_andnot_cardinality(&bm.roaring, &dbp.seq_store.positions[pos].bitmaps[silo::Symbol::A].roaring);
+               uint64_t both[6];
+               if (bounded_count) {
+                  silo::roaring_containers::and_cardinalities(bm, symbol_bms, bounded_count, both, variants);
                }
-            }
-            if (pos_ref != 'G') {
-               if (dbp.seq_store.positions[pos].flipped_bitmap != silo::Symbol::G) { /// everything fine
-                  G_per_pos[pos] += bm.and_cardinality(dbp.seq_store.positions[pos].bitmaps[silo::Symbol::G]);
-               } else { /// Bitmap was flipped
-                  G_per_pos[pos] +=
-                     roaring::api::roaring_bitmap_andnot_cardinality(&bm.roaring, &dbp.seq_store.positions[pos].bitmaps[silo::Symbol::G].roaring);
+               silo::roaring_containers::and_cardinalities(bm, symbol_bms + bounded_count, count - bounded_count, both + bounded_count);
+
+               /// Number of filtered sequences with the symbol. Accounts for a flipped symbol bitmap
+               /// and for a complemented filter, which holds the sequences that are not in bm.
+               for (uint32_t s = 0; s < count; ++s) {
+                  const bool flipped = position.flipped_bitmap == needed[s].symbol;
+                  /// Edge gaps are not in the gap bitmap
+                  uint64_t edge_gaps = 0;
+                  if (needed[s].symbol == silo::Symbol::gap) {
+                     const size_t leading = dbp.seq_store.leading_gaps(pos);
+                     const size_t trailing = dbp.seq_store.trailing_gaps(pos);
+                     edge_gaps = leading + trailing;
+                     both[s] += edge_gap_filters[i].leading[leading] + edge_gap_filters[i].trailing[trailing];
+                  }
+                  uint64_t filtered;
+                  if (!filter.complemented) {
+                     filtered = flipped ? filter_cardinalities[i] - both[s] : both[s];
+                  } else if (!flipped) {
+                     filtered = symbol_bms[s]->cardinality() + edge_gaps - both[s];
+                  } else {
+                     filtered = dbp.sequenceCount - filter_cardinalities[i] - symbol_bms[s]->cardinality() + both[s];
+                  }
+                  local[c][needed[s].slot] += filtered;
                }
             }
-            if (pos_ref == '-') {
-               if (dbp.seq_store.positions[pos].flipped_bitmap != silo::Symbol::gap) { /// everything fine
-                  gap_per_pos[pos] += bm.and_cardinality(dbp.seq_store.positions[pos].bitmaps[silo::Symbol::gap]);
-               } else { /// Bitmap was flipped
-                  gap_per_pos[pos] +=
-                     roaring::api::roaring_bitmap_andnot_cardinality(&bm.roaring, &dbp.seq_store.positions[pos].bitmaps[silo::Symbol::gap].roaring);
+         }
+      });
+
+      tbb::parallel_for(tbb::blocked_range<size_t>(0, candidate_positions.size()), [&](const tbb::blocked_range<size_t>& range) {
+         for (const std::vector<counts_t>& local : local_counts) {
+            for (size_t c = range.begin(); c != range.end(); ++c) {
+               for (uint32_t slot = 0; slot < counts[c].size(); ++slot) {
+                  counts[c][slot] += local[c][slot];
                }
             }
          }
+         if (!n_runs_per_pos.empty()) {
+            for (size_t c = range.begin(); c != range.end(); ++c) {
+               counts[c][N_SLOT] += n_runs_per_pos[candidate_positions[c]];
+            }
+         }
       });
    }
    std::cerr << "Per pos calculation: " << std::to_string(microseconds) << std::endl;
 
    uint32_t sequence_count = 0;
    for (unsigned i = 0; i < db.partitions.size(); ++i) {
-      sequence_count += partition_filters[i].getAsConst()->cardinality();
+      sequence_count += partition_filters[i].cardinality(0, db.partitions[i].sequenceCount);
       partition_filters[i].free();
    }
 
@@ -97,37 +487,37 @@ std::vector<silo::mutation_proportion> silo::execute_mutations(const silo::Datab
    microseconds = 0;
    {
       BlockTimer timer(microseconds);
-      for (unsigned pos = 0; pos < silo::genomeLength; ++pos) {
+      for (size_t c = 0; c < candidate_positions.size(); ++c) {
+         const uint32_t pos = candidate_positions[c];
          char pos_ref = db.global_reference[0].at(pos);
-         std::vector<std::pair<char, uint32_t>> candidates;
-         uint32_t total = sequence_count - N_per_pos[pos];
+         uint32_t total = sequence_count - counts[c][N_SLOT];
          if (total == 0) {
             continue;
          }
          uint32_t threshold_count = std::ceil((double) total * (double) proportion_threshold) - 1;
          if (pos_ref != 'C') {
-            const uint32_t tmp = C_per_pos[pos];
+            const uint32_t tmp = counts[c][C_SLOT];
             if (tmp > threshold_count) {
                double proportion = (double) tmp / (double) total;
                ret.push_back({pos_ref, pos, 'C', proportion, tmp});
             }
          }
          if (pos_ref != 'T') {
-            const uint32_t tmp = T_per_pos[pos];
+            const uint32_t tmp = counts[c][T_SLOT];
             if (tmp > threshold_count) {
                double proportion = (double) tmp / (double) total;
                ret.push_back({pos_ref, pos, 'T', proportion, tmp});
             }
          }
          if (pos_ref != 'A') {
-            const uint32_t tmp = A_per_pos[pos];
+            const uint32_t tmp = counts[c][A_SLOT];
             if (tmp > threshold_count) {
                double proportion = (double) tmp / (double) total;
                ret.push_back({pos_ref, pos, 'A', proportion, tmp});
             }
          }
          if (pos_ref != 'G') {
-            const uint32_t tmp = G_per_pos[pos];
+            const uint32_t tmp = counts[c][G_SLOT];
             if (tmp > threshold_count) {
                double proportion = (double) tmp / (double) total;
                ret.push_back({pos_ref, pos, 'G', proportion, tmp});
@@ -135,7 +525,7 @@ std::vector<silo::mutation_proportion> silo::execute_mutations(const silo::Datab
          }
          /// This should always be the case. For future-proof-ness (gaps in reference), keep this check in.
          if (pos_ref != '-') {
-            const uint32_t tmp = gap_per_pos[pos];
+            const uint32_t tmp = counts[c][GAP_SLOT];
             if (tmp > threshold_count) {
                double proportion = (double) tmp / (double) total;
                ret.push_back({pos_ref, pos, '-', proportion, tmp});
@@ -146,4 +536,107 @@ std::vector<silo::mutation_proportion> silo::execute_mutations(const silo::Datab
    std::cerr << "Proportion / ret calculation: " << std::to_string(microseconds) << std::endl;
 
    return ret;
-}
\ No newline at end of file
+}
+void silo::execute_list(const silo::Database& db, std::vector<silo::filter_t>& partition_filters, const std::vector<std::string>& field_names,
+                        const std::string& order_by, uint64_t offset, uint64_t limit, JsonWriter& out) {
+   using roaring::Roaring;
+
+   std::vector<metadata_field_t> fields;
+   for (const std::string& name : field_names) {
+      fields.push_back(parse_field(db, name));
+   }
+   if (!order_by.empty() && order_by != "date") {
+      throw QueryParseException("orderBy must be date.");
+   }
+   tbb::parallel_for((size_t) 0, partition_filters.size(), [&](size_t i) {
+      partition_filters[i].materialize(0, db.partitions[i].sequenceCount);
+   });
+
+   out.begin_array();
+   uint64_t written = 0;
+   /// Writes the rows of bm from rank skip on, until the limit is reached
+   auto write_rows = [&](const DatabasePartition& dbp, const Roaring& bm, uint64_t skip) {
+      uint32_t first;
+      if (written >= limit || !bm.select(skip, &first)) {
+         return;
+      }
+      constexpr uint32_t BUFFER_SIZE = 1024;
+      uint32_t buffer[BUFFER_SIZE];
+      roaring::api::roaring_uint32_iterator_t it;
+      roaring::api::roaring_init_iterator(&bm.roaring, &it);
+      roaring::api::roaring_move_uint32_iterator_equalorlarger(&it, first);
+      while (uint32_t n = roaring::api::roaring_read_uint32_iterator(&it, buffer, (uint32_t) std::min<uint64_t>(BUFFER_SIZE, limit - written))) {
+         for (uint32_t r = 0; r < n; ++r) {
+            out.begin_object();
+            for (size_t f = 0; f < fields.size(); ++f) {
+               out.key(field_names[f]);
+               out.value(fields[f].value(db, fields[f].id(dbp, buffer[r])));
+            }
+            out.end_object();
+         }
+         written += n;
+         if (written >= limit) {
+            return;
+         }
+      }
+   };
+
+   if (order_by.empty()) {
+      /// In partition order, partitions before the offset are skipped by their cardinality
+      for (size_t i = 0; i < partition_filters.size() && written < limit; ++i) {
+         const Roaring& bm = *partition_filters[i].getAsConst();
+         const uint64_t cardinality = bm.cardinality();
+         if (offset >= cardinality) {
+            offset -= cardinality;
+            continue;
+         }
+         write_rows(db.partitions[i], bm, offset);
+         offset = 0;
+      }
+   } else {
+      /// Day by day over all partitions, using the cumulative day bitmaps. The rows of a day are only
+      /// materialized if they are in the window, and the iteration stops as soon as the limit is reached.
+      std::vector<uint32_t> days;
+      for (const auto& dbp : db.partitions) {
+         days.insert(days.end(), dbp.meta_store.sorted_days.begin(), dbp.meta_store.sorted_days.end());
+      }
+      std::sort(days.begin(), days.end());
+      days.erase(std::unique(days.begin(), days.end()), days.end());
+
+      /// Per partition: the next index into its sorted_days and the filtered rows until the previous day
+      std::vector<size_t> next_day(db.partitions.size(), 0);
+      std::vector<uint64_t> until_before(db.partitions.size(), 0);
+      for (uint32_t day : days) {
+         if (written >= limit) {
+            break;
+         }
+         for (size_t i = 0; i < db.partitions.size() && written < limit; ++i) {
+            const MetaStore& meta_store = db.partitions[i].meta_store;
+            const size_t d = next_day[i];
+            if (d >= meta_store.sorted_days.size() || meta_store.sorted_days[d] != day) {
+               continue;
+            }
+            ++next_day[i];
+            const Roaring& bm = *partition_filters[i].getAsConst();
+            const uint64_t until = bm.and_cardinality(meta_store.until_day_bitmaps[d]);
+            const uint64_t count = until - until_before[i];
+            until_before[i] = until;
+            if (offset >= count) {
+               offset -= count;
+               continue;
+            }
+            Roaring rows = bm & meta_store.until_day_bitmaps[d];
+            if (d > 0) {
+               rows -= meta_store.until_day_bitmaps[d - 1];
+            }
+            write_rows(db.partitions[i], rows, offset);
+            offset = 0;
+         }
+      }
+   }
+   out.end_array();
+
+   for (auto& filter : partition_filters) {
+      filter.free();
+   }
+}
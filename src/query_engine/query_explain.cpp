@@ -0,0 +1,200 @@
+#include <silo/common/PerfEvent.hpp>
+#include <silo/query_engine/query_engine.h>
+#include <sstream>
+
+using namespace silo;
+
+filter_t ProfiledEx::evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) {
+   filter_t ret;
+   int64_t microseconds = 0;
+   {
+      BlockTimer timer(microseconds);
+      ret = child->evaluate(db, dbp, slice);
+   }
+   roaring::api::roaring_statistics_t statistics;
+   roaring::api::roaring_bitmap_statistics(&ret.getAsConst()->roaring, &statistics);
+   const uint64_t cardinality = ret.cardinality(slice.begin, slice.end);
+   const uint64_t bytes_allocated = ret.mutable_res ? ret.mutable_res->getSizeInBytes() : 0;
+
+   std::lock_guard<std::mutex> guard(mutex);
+   ++stats.evaluations;
+   stats.microseconds += microseconds;
+   stats.cardinality += cardinality;
+   stats.array_containers += statistics.n_array_containers;
+   stats.bitset_containers += statistics.n_bitset_containers;
+   stats.run_containers += statistics.n_run_containers;
+   stats.bytes_allocated += bytes_allocated;
+   return ret;
+}
+
+std::unique_ptr<BoolExpression> silo::profile_subexpressions(std::unique_ptr<BoolExpression> ex) {
+   switch (ex->type()) {
+      case ExType::AND: {
+         auto and_ex = dynamic_cast<AndEx*>(ex.get());
+         for (auto& child : and_ex->children) {
+            child = profile_subexpressions(std::move(child));
+         }
+         for (auto& child : and_ex->negated_children) {
+            child = profile_subexpressions(std::move(child));
+         }
+         break;
+      }
+      case ExType::OR: {
+         auto or_ex = dynamic_cast<OrEx*>(ex.get());
+         for (auto& child : or_ex->children) {
+            child = profile_subexpressions(std::move(child));
+         }
+         break;
+      }
+      case ExType::NOF: {
+         auto nof_ex = dynamic_cast<NOfEx*>(ex.get());
+         for (auto& child : nof_ex->children) {
+            child = profile_subexpressions(std::move(child));
+         }
+         break;
+      }
+      case ExType::NEG: {
+         auto neg_ex = dynamic_cast<NegEx*>(ex.get());
+         neg_ex->child = profile_subexpressions(std::move(neg_ex->child));
+         break;
+      }
+      case ExType::CACHED: {
+         /// Profile the cached node itself and, for cache misses, the nodes below it
+         auto cached_ex = dynamic_cast<CachedEx*>(ex.get());
+         cached_ex->child = profile_subexpressions(std::move(cached_ex->child));
+         break;
+      }
+      default:
+         break;
+   }
+   return std::make_unique<ProfiledEx>(std::move(ex));
+}
+
+static std::string json_escape(const std::string& str) {
+   std::string ret;
+   for (char c : str) {
+      if (c == '"' || c == '\\') {
+         ret += '\\';
+         ret += c;
+      } else if ((unsigned char) c < 0x20) {
+         ret += ' ';
+      } else {
+         ret += c;
+      }
+   }
+   return ret;
+}
+
+std::string silo::operator_name(const BoolExpression& ex) {
+   switch (ex.type()) {
+      case ExType::AND:
+         return "And";
+      case ExType::OR:
+         return "Or";
+      case ExType::NOF:
+         return "N-Of";
+      case ExType::NEG:
+         return "Neg";
+      case ExType::EMPTY:
+         return "Empty";
+      case ExType::FULL:
+         return "Full";
+      default:
+         break;
+   }
+   if (dynamic_cast<const DateBetwEx*>(&ex)) return "DateBetw";
+   if (dynamic_cast<const NucEqEx*>(&ex)) return "NucEq";
+   if (dynamic_cast<const NucMbEx*>(&ex)) return "NucMaybe";
+   if (dynamic_cast<const CoveredEx*>(&ex)) return "Covered";
+   if (dynamic_cast<const PangoLineageEx*>(&ex)) return "PangoLineage";
+   if (dynamic_cast<const CountryEx*>(&ex)) return "Country";
+   if (dynamic_cast<const RegionEx*>(&ex)) return "Region";
+   if (dynamic_cast<const StrEqEx*>(&ex)) return "StrEq";
+   return "Unknown";
+}
+
+static void explain_children(std::vector<std::unique_ptr<BoolExpression>>& children, const std::string& name, const Database& db,
+                             const DatabasePartition& dbp, std::ostream& out);
+
+/// miss_stats are the statistics of the evaluations of a cached node that missed its cache
+static void explain_node(BoolExpression& ex, const Database& db, const DatabasePartition& dbp, std::ostream& out,
+                         const node_stats_t* stats = nullptr, bool cached = false, const node_stats_t* miss_stats = nullptr) {
+   if (ex.type() == ExType::PROFILED) {
+      auto& profiled_ex = dynamic_cast<ProfiledEx&>(ex);
+      explain_node(*profiled_ex.child, db, dbp, out, &profiled_ex.stats, cached);
+      return;
+   }
+   if (ex.type() == ExType::CACHED) {
+      /// Statistics of a ProfiledEx above the CachedEx include cache hits, those below only the misses.
+      /// The node reports the former, and the number of the latter as its cache misses.
+      auto& cached_ex = dynamic_cast<CachedEx&>(ex);
+      if (stats && cached_ex.child->type() == ExType::PROFILED) {
+         auto& profiled_ex = dynamic_cast<ProfiledEx&>(*cached_ex.child);
+         explain_node(*profiled_ex.child, db, dbp, out, stats, true, &profiled_ex.stats);
+         return;
+      }
+      explain_node(*cached_ex.child, db, dbp, out, stats, true);
+      return;
+   }
+
+   out << "{\"type\":\"" << operator_name(ex) << "\",\"expression\":\"" << json_escape(ex.to_string(db))
+       << "\",\"estimatedCardinality\":" << ex.estimate_cardinality(db, dbp);
+   if (cached) {
+      out << ",\"cached\":true";
+   }
+   if (stats) {
+      out << ",\"evaluations\":" << stats->evaluations << ",\"microseconds\":" << stats->microseconds
+          << ",\"cardinality\":" << stats->cardinality << ",\"containers\":{\"array\":" << stats->array_containers
+          << ",\"bitset\":" << stats->bitset_containers << ",\"run\":" << stats->run_containers
+          << "},\"bytesAllocated\":" << (miss_stats ? miss_stats : stats)->bytes_allocated;
+      if (miss_stats) {
+         /// Only misses allocate, the cache hands out the bitmaps it holds
+         out << ",\"cacheMisses\":" << miss_stats->evaluations;
+      }
+   }
+   switch (ex.type()) {
+      case ExType::AND: {
+         auto& and_ex = dynamic_cast<AndEx&>(ex);
+         explain_children(and_ex.children, "children", db, dbp, out);
+         explain_children(and_ex.negated_children, "negatedChildren", db, dbp, out);
+         break;
+      }
+      case ExType::OR:
+         explain_children(dynamic_cast<OrEx&>(ex).children, "children", db, dbp, out);
+         break;
+      case ExType::NOF: {
+         auto& nof_ex = dynamic_cast<NOfEx&>(ex);
+         out << ",\"n\":" << nof_ex.n << ",\"exactly\":" << (nof_ex.exactly ? "true" : "false") << ",\"impl\":";
+         if (nof_ex.impl == NOfEx::impl_auto) {
+            out << "\"auto\"";
+         } else {
+            out << nof_ex.impl;
+         }
+         explain_children(nof_ex.children, "children", db, dbp, out);
+         break;
+      }
+      case ExType::NEG:
+         out << ",\"child\":";
+         explain_node(*dynamic_cast<NegEx&>(ex).child, db, dbp, out);
+         break;
+      default:
+         break;
+   }
+   out << "}";
+}
+
+static void explain_children(std::vector<std::unique_ptr<BoolExpression>>& children, const std::string& name, const Database& db,
+                             const DatabasePartition& dbp, std::ostream& out) {
+   out << ",\"" << name << "\":[";
+   for (size_t i = 0; i < children.size(); ++i) {
+      if (i > 0) out << ",";
+      explain_node(*children[i], db, dbp, out);
+   }
+   out << "]";
+}
+
+std::string silo::explain(BoolExpression& filter, const Database& db, const DatabasePartition& dbp) {
+   std::ostringstream out;
+   explain_node(filter, db, dbp, out);
+   return out.str();
+}
@@ -0,0 +1,311 @@
+#include <bit>
+#include <cmath>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+
+uint32_t AndEx::estimate_cardinality(const Database& db, const DatabasePartition& dbp) const {
+   uint32_t ret = dbp.sequenceCount;
+   for (const auto& child : children) {
+      ret = std::min(ret, child->estimate_cardinality(db, dbp));
+   }
+   if (children.empty()) {
+      /// Only negated children: at most the complement of the largest one survives
+      uint32_t max_negated = 0;
+      for (const auto& child : negated_children) {
+         max_negated = std::max(max_negated, child->estimate_cardinality(db, dbp));
+      }
+      ret -= std::min(ret, max_negated);
+   }
+   return ret;
+}
+
+void AndEx::plan(const Database& db, const DatabasePartition& dbp) {
+   for (auto& child : children) {
+      child->plan(db, dbp);
+   }
+   for (auto& child : negated_children) {
+      child->plan(db, dbp);
+   }
+
+   std::vector<std::pair<uint32_t, std::unique_ptr<BoolExpression>>> estimated;
+   estimated.reserve(children.size());
+   for (auto& child : children) {
+      estimated.emplace_back(child->estimate_cardinality(db, dbp), std::move(child));
+   }
+   /// Sort ascending, such that intermediate results are kept small and empty intersections are detected early
+   std::stable_sort(estimated.begin(), estimated.end(),
+                    [](const auto& a, const auto& b) { return a.first < b.first; });
+   for (unsigned i = 0; i < estimated.size(); ++i) {
+      children[i] = std::move(estimated[i].second);
+   }
+
+   estimated.clear();
+   estimated.reserve(negated_children.size());
+   for (auto& child : negated_children) {
+      estimated.emplace_back(child->estimate_cardinality(db, dbp), std::move(child));
+   }
+   /// Sort negated children descending by size, the largest ones remove the most
+   std::stable_sort(estimated.begin(), estimated.end(),
+                    [](const auto& a, const auto& b) { return a.first > b.first; });
+   for (unsigned i = 0; i < estimated.size(); ++i) {
+      negated_children[i] = std::move(estimated[i].second);
+   }
+}
+
+uint32_t OrEx::estimate_cardinality(const Database& db, const DatabasePartition& dbp) const {
+   uint64_t sum = 0;
+   for (const auto& child : children) {
+      sum += child->estimate_cardinality(db, dbp);
+   }
+   return std::min<uint64_t>(sum, dbp.sequenceCount);
+}
+
+void OrEx::plan(const Database& db, const DatabasePartition& dbp) {
+   for (auto& child : children) {
+      child->plan(db, dbp);
+   }
+}
+
+uint32_t NOfEx::estimate_cardinality(const Database& db, const DatabasePartition& dbp) const {
+   uint64_t sum = 0;
+   for (const auto& child : children) {
+      sum += child->estimate_cardinality(db, dbp);
+   }
+   /// Every result needs to be contained in at least n children
+   return std::min<uint64_t>(n == 0 ? sum : sum / n, dbp.sequenceCount);
+}
+
+void NOfEx::plan(const Database& db, const DatabasePartition& dbp) {
+   child_estimates.clear();
+   for (auto& child : children) {
+      child->plan(db, dbp);
+      child_estimates.push_back(child->estimate_cardinality(db, dbp));
+   }
+}
+
+double NOfEx::estimate_cost(unsigned impl, const DatabasePartition& dbp, slice_t slice) const {
+   const double rows = slice.end - slice.begin;
+   const double fraction = dbp.sequenceCount ? rows / dbp.sequenceCount : 0;
+   /// Bitmap operations work on 64 rows at a time in dense containers, but per row in sparse ones
+   auto bitmap_op = [&](double cardinality) { return std::min(cardinality, rows / 16); };
+
+   std::vector<double> estimates;
+   double sum = 0;
+   for (unsigned i = 0; i < children.size(); ++i) {
+      /// Without estimates from plan(), assume the worst case
+      const double estimate = i < child_estimates.size() ? child_estimates[i] * fraction : rows;
+      estimates.push_back(estimate);
+      sum += estimate;
+   }
+
+   switch (impl) {
+      case 0: {
+         /// Counter per row, then every set bit of every child is visited
+         double cost = rows / 8 + sum;
+         if (exactly) cost += sum / n * std::log2(sum / n + 2);
+         return cost;
+      }
+      case 1: {
+         /// The i-th child is combined with up to min(i, n) dp bitmaps
+         double cost = 0;
+         for (unsigned i = 0; i < estimates.size(); ++i) {
+            cost += 2 * std::min(i + 1, n + exactly) * bitmap_op(estimates[i]);
+         }
+         return cost;
+      }
+      case 2:
+         /// Every set bit passes through the heap of iterators
+         return sum * (2 + 2 * std::log2(children.size() + 1));
+      case 3: {
+         /// The low planes are about as dense as all children together, the carries rarely
+         /// propagate beyond the second plane
+         const double plane = std::min(rows, sum) / 2;
+         double cost = std::bit_width(n) * 2 * bitmap_op(plane);
+         for (double estimate : estimates) {
+            cost += 2 * bitmap_op(estimate) + 4 * bitmap_op(plane);
+         }
+         return cost;
+      }
+      case impl_fused: {
+         /// Every child is loaded into a bitset and added to the planes 64 rows at a time, whether it is sparse or not
+         const double words = rows / 64;
+         return words * (4 * children.size() + 2 * std::bit_width(n));
+      }
+      default:
+         return std::numeric_limits<double>::infinity();
+   }
+}
+
+unsigned NOfEx::choose_impl(const DatabasePartition& dbp, slice_t slice, bool fusable) const {
+   unsigned best = 0;
+   double best_cost = estimate_cost(0, dbp, slice);
+   for (unsigned candidate = 1; candidate <= (fusable ? impl_fused : 3); ++candidate) {
+      const double cost = estimate_cost(candidate, dbp, slice);
+      if (cost < best_cost) {
+         best = candidate;
+         best_cost = cost;
+      }
+   }
+   return best;
+}
+
+uint32_t DateBetwEx::estimate_cardinality(const Database& /*db*/, const DatabasePartition& dbp) const {
+   const uint32_t first_day = open_from ? 0 : to_day(from);
+   const uint32_t last_day = open_to ? UINT32_MAX : to_day(to);
+   if (first_day > last_day) {
+      return 0;
+   }
+   const roaring::Roaring* until_to = rows_until_day(dbp.meta_store, last_day);
+   const roaring::Roaring* before_from = first_day > 0 ? rows_until_day(dbp.meta_store, first_day - 1) : nullptr;
+   return (until_to ? until_to->cardinality() : 0) - (before_from ? before_from->cardinality() : 0);
+}
+
+uint32_t NucMbEx::estimate_cardinality(const Database& /*db*/, const DatabasePartition& dbp) const {
+   if (const roaring::Roaring* precomputed = dbp.seq_store.bma_precomputed(position, value)) {
+      return precomputed->cardinality();
+   }
+   /// The exact matches (for a flipped bitmap the rows without the symbol), ignoring the rarer ambiguity codes
+   return dbp.seq_store.symbol_count(position, value);
+}
+
+static std::string join_sorted(std::vector<std::string>& keys, const std::string& sep) {
+   std::sort(keys.begin(), keys.end());
+   std::string res;
+   for (auto& key : keys) {
+      res += key;
+      res += sep;
+   }
+   return res;
+}
+
+std::string silo::canonical_key(BoolExpression& ex, const Database& db) {
+   std::string key;
+   switch (ex.type()) {
+      case ExType::CACHED:
+         return dynamic_cast<CachedEx&>(ex).key;
+      case ExType::AND: {
+         auto& and_ex = dynamic_cast<AndEx&>(ex);
+         std::vector<std::string> keys;
+         for (auto& child : and_ex.children) {
+            keys.push_back(canonical_key(*child, db));
+         }
+         std::vector<std::string> negated_keys;
+         for (auto& child : and_ex.negated_children) {
+            negated_keys.push_back(canonical_key(*child, db));
+         }
+         const std::string positive = join_sorted(keys, " & ");
+         const std::string negative = join_sorted(negated_keys, " &! ");
+         key.reserve(positive.size() + negative.size() + 5);
+         key.append("(").append(positive).append("&! ").append(negative).append(")");
+         return key;
+      }
+      case ExType::OR: {
+         auto& or_ex = dynamic_cast<OrEx&>(ex);
+         std::vector<std::string> keys;
+         for (auto& child : or_ex.children) {
+            keys.push_back(canonical_key(*child, db));
+         }
+         const std::string joined = join_sorted(keys, " | ");
+         key.reserve(joined.size() + 2);
+         key.append("(").append(joined).append(")");
+         return key;
+      }
+      case ExType::NOF: {
+         /// The implementation does not change the result and is therefore not part of the key
+         auto& nof_ex = dynamic_cast<NOfEx&>(ex);
+         std::vector<std::string> keys;
+         for (auto& child : nof_ex.children) {
+            keys.push_back(canonical_key(*child, db));
+         }
+         const std::string joined = join_sorted(keys, ", ");
+         key.reserve(joined.size() + 24);
+         key.append(nof_ex.exactly ? "[exactly-" : "[").append(std::to_string(nof_ex.n)).append("-of:").append(joined).append("]");
+         return key;
+      }
+      case ExType::NEG: {
+         const std::string child = canonical_key(*dynamic_cast<NegEx&>(ex).child, db);
+         key.reserve(child.size() + 1);
+         key.append("!").append(child);
+         return key;
+      }
+      default: {
+         const std::string name = operator_name(ex);
+         const std::string value = ex.to_string(db);
+         key.reserve(name.size() + value.size() + 8);
+         key.append(std::to_string(ex.type())).append(":").append(name).append(":").append(value);
+         if (auto mb_ex = dynamic_cast<NucMbEx*>(&ex); mb_ex && mb_ex->negated) {
+            key.append("~");
+         }
+         return key;
+      }
+   }
+}
+
+/// Only results that are computed during evaluation are worth caching,
+/// the bitmaps of the other leaves are returned from the database without copying.
+static bool worth_caching(const BoolExpression& ex) {
+   switch (ex.type()) {
+      case ExType::AND:
+      case ExType::OR:
+      case ExType::NOF:
+      case ExType::NEG:
+      case ExType::PRED:
+         return true;
+      case ExType::INDEX_FILTER:
+         return dynamic_cast<const DateBetwEx*>(&ex) || dynamic_cast<const NucMbEx*>(&ex) || dynamic_cast<const CoveredEx*>(&ex);
+      default:
+         return false;
+   }
+}
+
+std::unique_ptr<BoolExpression> silo::cache_subexpressions(std::unique_ptr<BoolExpression> ex, const Database& db, uint32_t partition,
+                                                           const std::function<ResultCache*(const std::string&)>& cache_of) {
+   /// Wrap bottom-up, such that the keys of the children are computed only once
+   switch (ex->type()) {
+      case ExType::AND: {
+         auto and_ex = dynamic_cast<AndEx*>(ex.get());
+         for (auto& child : and_ex->children) {
+            child = cache_subexpressions(std::move(child), db, partition, cache_of);
+         }
+         for (auto& child : and_ex->negated_children) {
+            child = cache_subexpressions(std::move(child), db, partition, cache_of);
+         }
+         break;
+      }
+      case ExType::OR: {
+         auto or_ex = dynamic_cast<OrEx*>(ex.get());
+         for (auto& child : or_ex->children) {
+            child = cache_subexpressions(std::move(child), db, partition, cache_of);
+         }
+         break;
+      }
+      case ExType::NOF: {
+         auto nof_ex = dynamic_cast<NOfEx*>(ex.get());
+         for (auto& child : nof_ex->children) {
+            child = cache_subexpressions(std::move(child), db, partition, cache_of);
+         }
+         break;
+      }
+      case ExType::NEG: {
+         auto neg_ex = dynamic_cast<NegEx*>(ex.get());
+         neg_ex->child = cache_subexpressions(std::move(neg_ex->child), db, partition, cache_of);
+         break;
+      }
+      default:
+         break;
+   }
+   if (!worth_caching(*ex)) {
+      return ex;
+   }
+   std::string key = canonical_key(*ex, db);
+   ResultCache* cache = cache_of(key);
+   if (!cache) {
+      return ex;
+   }
+   return std::make_unique<CachedEx>(std::move(ex), std::move(key), partition, cache);
+}
+
+std::unique_ptr<BoolExpression> silo::cache_subexpressions(std::unique_ptr<BoolExpression> ex, const Database& db, uint32_t partition) {
+   return cache_subexpressions(std::move(ex), db, partition, [&](const std::string&) { return db.result_cache.get(); });
+}
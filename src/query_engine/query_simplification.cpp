@@ -111,7 +111,7 @@ std::unique_ptr<BoolExpression> NOfEx::simplify(const Database& db, const Databa
          return std::make_unique<NegEx>(std::move(new_ret));
       }
       else{
-         return std::make_unique<EmptyEx>();
+         return std::make_unique<FullEx>();
       }
    }
    if(ret->n == 1 && !ret->exactly){
@@ -130,3 +130,36 @@ std::unique_ptr<BoolExpression> NOfEx::simplify(const Database& db, const Databa
    return ret;
 }
 
+
+std::unique_ptr<BoolExpression> DateBetwEx::simplify(const Database& /*db*/, const DatabasePartition& dbp) const {
+   const std::vector<uint32_t>& sorted_days = dbp.meta_store.sorted_days;
+   const uint32_t first_day = open_from ? 0 : to_day(from);
+   const uint32_t last_day = open_to ? UINT32_MAX : to_day(to);
+   if (sorted_days.empty() || first_day > last_day || last_day < sorted_days.front() || first_day > sorted_days.back()) {
+      return std::make_unique<EmptyEx>();
+   }
+   if (first_day <= sorted_days.front() && last_day >= sorted_days.back()) {
+      return std::make_unique<FullEx>();
+   }
+   return std::make_unique<DateBetwEx>(from, open_from, to, open_to);
+}
+
+/// Empty if the id is not in the sorted ids of the partition, full if it is the only one
+template <typename Ex>
+static std::unique_ptr<BoolExpression> simplify_by_presence(uint32_t key, const std::vector<uint32_t>& sorted_ids) {
+   if (!std::binary_search(sorted_ids.begin(), sorted_ids.end(), key)) {
+      return std::make_unique<EmptyEx>();
+   }
+   if (sorted_ids.size() == 1) {
+      return std::make_unique<FullEx>();
+   }
+   return std::make_unique<Ex>(key);
+}
+
+std::unique_ptr<BoolExpression> CountryEx::simplify(const Database& /*db*/, const DatabasePartition& dbp) const {
+   return simplify_by_presence<CountryEx>(countryKey, dbp.sorted_countries);
+}
+
+std::unique_ptr<BoolExpression> RegionEx::simplify(const Database& /*db*/, const DatabasePartition& dbp) const {
+   return simplify_by_presence<RegionEx>(regionKey, dbp.sorted_regions);
+}
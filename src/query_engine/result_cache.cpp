@@ -0,0 +1,65 @@
+#include <silo/common/silo_symbols.h>
+#include <silo/query_engine/result_cache.h>
+
+using namespace silo;
+
+void ResultCache::evict_until(size_t bytes) {
+   while (size_in_bytes > bytes && !lru.empty()) {
+      const entry_t& victim = lru.back();
+      size_in_bytes -= victim.bytes;
+      lookup.erase(victim.key);
+      lru.pop_back();
+   }
+}
+
+cached_result_t ResultCache::get(const std::string& key, uint32_t partition, uint32_t slice) {
+   std::lock_guard<std::mutex> guard(mutex);
+   auto it = lookup.find(partition_key(key, partition, slice));
+   if (it == lookup.end()) {
+      ++misses;
+      return {};
+   }
+   ++hits;
+   lru.splice(lru.begin(), lru, it->second);
+   return {it->second->bitmap, it->second->complemented};
+}
+
+void ResultCache::put(const std::string& key, uint32_t partition, uint32_t slice, std::shared_ptr<const roaring::Roaring> bitmap,
+                      bool complemented) {
+   std::string full_key = partition_key(key, partition, slice);
+   const size_t bytes = bitmap->getSizeInBytes() + full_key.size();
+   std::lock_guard<std::mutex> guard(mutex);
+   if (bytes > max_bytes) {
+      return;
+   }
+   auto it = lookup.find(full_key);
+   if (it != lookup.end()) {
+      /// Another thread was faster, keep the existing entry
+      lru.splice(lru.begin(), lru, it->second);
+      return;
+   }
+   evict_until(max_bytes - bytes);
+   lru.push_front({full_key, std::move(bitmap), complemented, bytes});
+   lookup[full_key] = lru.begin();
+   size_in_bytes += bytes;
+}
+
+void ResultCache::clear() {
+   std::lock_guard<std::mutex> guard(mutex);
+   lru.clear();
+   lookup.clear();
+   size_in_bytes = 0;
+}
+
+void ResultCache::set_max_bytes(size_t bytes) {
+   std::lock_guard<std::mutex> guard(mutex);
+   max_bytes = bytes;
+   evict_until(max_bytes);
+}
+
+void ResultCache::info(std::ostream& io) const {
+   std::lock_guard<std::mutex> guard(mutex);
+   io << "result cache entries: " << number_fmt(lru.size()) << std::endl;
+   io << "result cache size: " << number_fmt(size_in_bytes) << " of " << number_fmt(max_bytes) << std::endl;
+   io << "result cache hits: " << number_fmt(hits) << ", misses: " << number_fmt(misses) << std::endl;
+}
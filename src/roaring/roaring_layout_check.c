@@ -0,0 +1,37 @@
+/* Compile-time check of silo/roaring/roaring_container_layout.h against the vendored roaring.c.
+ * This includes roaring.c, so it is built as an object library that is never linked. */
+
+#include "roaring.c"
+
+#include <stddef.h>
+
+#include "silo/roaring/roaring_container_layout.h"
+
+#define SILO_SAME_MEMBER(ours, theirs, member)                                   \
+   (offsetof(ours, member) == offsetof(theirs, member) &&                       \
+    sizeof(((ours*) 0)->member) == sizeof(((theirs*) 0)->member))
+
+_Static_assert(SILO_ROARING_BITSET_TYPE == BITSET_CONTAINER_TYPE, "bitset typecode differs from roaring.c");
+_Static_assert(SILO_ROARING_ARRAY_TYPE == ARRAY_CONTAINER_TYPE, "array typecode differs from roaring.c");
+_Static_assert(SILO_ROARING_RUN_TYPE == RUN_CONTAINER_TYPE, "run typecode differs from roaring.c");
+_Static_assert(SILO_ROARING_SHARED_TYPE == SHARED_CONTAINER_TYPE, "shared typecode differs from roaring.c");
+
+_Static_assert(sizeof(silo_bitset_container_t) == sizeof(bitset_container_t) &&
+                  SILO_SAME_MEMBER(silo_bitset_container_t, bitset_container_t, cardinality) &&
+                  SILO_SAME_MEMBER(silo_bitset_container_t, bitset_container_t, words),
+               "bitset container layout differs from roaring.c");
+_Static_assert(sizeof(silo_array_container_t) == sizeof(array_container_t) &&
+                  SILO_SAME_MEMBER(silo_array_container_t, array_container_t, cardinality) &&
+                  SILO_SAME_MEMBER(silo_array_container_t, array_container_t, array),
+               "array container layout differs from roaring.c");
+_Static_assert(sizeof(silo_rle16_t) == sizeof(rle16_t) && SILO_SAME_MEMBER(silo_rle16_t, rle16_t, value) &&
+                  SILO_SAME_MEMBER(silo_rle16_t, rle16_t, length),
+               "rle16 layout differs from roaring.c");
+_Static_assert(sizeof(silo_run_container_t) == sizeof(run_container_t) &&
+                  SILO_SAME_MEMBER(silo_run_container_t, run_container_t, n_runs) &&
+                  SILO_SAME_MEMBER(silo_run_container_t, run_container_t, runs),
+               "run container layout differs from roaring.c");
+_Static_assert(sizeof(silo_shared_container_t) == sizeof(shared_container_t) &&
+                  SILO_SAME_MEMBER(silo_shared_container_t, shared_container_t, container) &&
+                  SILO_SAME_MEMBER(silo_shared_container_t, shared_container_t, typecode),
+               "shared container layout differs from roaring.c");
@@ -0,0 +1,40 @@
+#include <silo/storage/lineage_tree.h>
+
+using namespace silo;
+
+lineage_tree_t lineage_tree_t::build(const Dictionary& dict) {
+   const uint32_t pango_count = dict.get_pango_count();
+   lineage_tree_t ret;
+   ret.parent.resize(pango_count, UINT32_MAX);
+   ret.children.resize(pango_count);
+
+   for (uint32_t pango = 0; pango < pango_count; ++pango) {
+      const std::string& lineage = dict.get_pango(pango);
+      /// Strip one component after another, until a prefix is a lineage of the dictionary
+      for (size_t dot = lineage.rfind('.'); dot != std::string::npos && dot > 0; dot = lineage.rfind('.', dot - 1)) {
+         const uint32_t prefix = dict.get_pangoid(lineage.substr(0, dot));
+         if (prefix != UINT32_MAX) {
+            ret.parent[pango] = prefix;
+            ret.children[prefix].push_back(pango);
+            break;
+         }
+      }
+   }
+
+   /// Depths top-down, from the roots
+   std::vector<uint32_t> frontier;
+   for (uint32_t pango = 0; pango < pango_count; ++pango) {
+      if (ret.parent[pango] == UINT32_MAX) {
+         frontier.push_back(pango);
+      }
+   }
+   while (!frontier.empty()) {
+      std::vector<uint32_t> next;
+      for (uint32_t pango : frontier) {
+         next.insert(next.end(), ret.children[pango].begin(), ret.children[pango].end());
+      }
+      ret.levels.push_back(std::move(frontier));
+      frontier = std::move(next);
+   }
+   return ret;
+}
@@ -2,17 +2,81 @@
 // Created by Alexander Taepper on 01.09.22.
 //
 
+#include <ctime>
+#include <map>
 #include <silo/storage/meta_store.h>
 
+std::string silo::day_to_string(uint32_t day) {
+   const time_t time = (time_t) day * 24 * 60 * 60;
+   struct std::tm tm {};
+   gmtime_r(&time, &tm);
+   char buffer[16];
+   strftime(buffer, sizeof(buffer), "%Y-%m-%d", &tm);
+   return buffer;
+}
+
 void silo::inputSequenceMeta(MetaStore& mdb, uint64_t epi, time_t date, uint32_t pango_lineage,
                              uint32_t region, uint32_t country, const std::vector<uint64_t>& vals) {
    mdb.sid_to_epi.push_back(epi);
    mdb.sid_to_lineage.push_back(pango_lineage);
 
-   mdb.sid_to_date.push_back(date);
+   mdb.sid_to_day.push_back(to_day(date));
    mdb.sid_to_country.push_back(country);
    mdb.sid_to_region.push_back(region);
+   if (mdb.cols.empty()) {
+      mdb.cols.resize(vals.size());
+   }
    for (unsigned i = 0; i < mdb.cols.size(); ++i) {
       mdb.cols[i].push_back(vals[i]);
    }
 }
+
+void silo::build_date_index(MetaStore& mdb) {
+   std::map<uint32_t, std::vector<uint32_t>> group_by_day;
+   for (uint32_t sid = 0; sid < mdb.sid_to_day.size(); ++sid) {
+      group_by_day[mdb.sid_to_day[sid]].push_back(sid);
+   }
+   mdb.sorted_days.clear();
+   mdb.until_day_bitmaps.clear();
+   roaring::Roaring until_day;
+   for (auto& [day, sids] : group_by_day) {
+      until_day.addMany(sids.size(), sids.data());
+      mdb.sorted_days.push_back(day);
+      mdb.until_day_bitmaps.push_back(until_day);
+      mdb.until_day_bitmaps.back().runOptimize();
+      mdb.until_day_bitmaps.back().shrinkToFit();
+   }
+}
+
+const roaring::Roaring* silo::rows_until_day(const MetaStore& mdb, uint32_t day) {
+   auto it = std::upper_bound(mdb.sorted_days.begin(), mdb.sorted_days.end(), day);
+   if (it == mdb.sorted_days.begin()) {
+      return nullptr;
+   }
+   return &mdb.until_day_bitmaps[it - mdb.sorted_days.begin() - 1];
+}
+
+void silo::build_col_indexes(MetaStore& mdb, const std::vector<uint32_t>& columns, double max_distinct_share) {
+   mdb.col_bitmaps.clear();
+   mdb.col_bitmaps.resize(mdb.cols.size());
+   for (uint32_t col : columns) {
+      if (col >= mdb.cols.size()) {
+         continue;
+      }
+      const std::vector<uint64_t>& values = mdb.cols[col];
+      const double max_distinct = max_distinct_share * values.size();
+      std::unordered_map<uint64_t, std::vector<uint32_t>> group_by_value;
+      uint32_t sid = 0;
+      for (; sid < values.size() && group_by_value.size() <= max_distinct; ++sid) {
+         group_by_value[values[sid]].push_back(sid);
+      }
+      if (sid < values.size() || group_by_value.size() > max_distinct) {
+         continue;
+      }
+      auto& index = mdb.col_bitmaps[col].emplace();
+      for (auto& [value, sids] : group_by_value) {
+         index[value].addMany(sids.size(), sids.data());
+         index[value].runOptimize();
+      }
+   }
+}
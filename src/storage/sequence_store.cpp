@@ -2,7 +2,13 @@
 // Created by Alexander Taepper on 01.09.22.
 //
 
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <fstream>
 #include <syncstream>
+#include <tuple>
+#include <silo/common/bitmap_view.h>
 #include <silo/storage/sequence_store.h>
 #include <tbb/blocked_range.h>
 #include <tbb/enumerable_thread_specific.h>
@@ -10,83 +16,501 @@
 
 using namespace silo;
 
-roaring::Roaring* SequenceStore::bma(size_t pos, Symbol r) const {
-   switch (r) {
-      case A: {
-         const roaring::Roaring* tmp[8] = {bm(pos, A),
-                                           bm(pos, R), bm(pos, W), bm(pos, M),
-                                           bm(pos, D), bm(pos, H), bm(pos, V)};
-         roaring::Roaring* ret = new roaring::Roaring(roaring::Roaring::fastunion(8, tmp));
-         return ret;
-      }
-      case C: {
-         const roaring::Roaring* tmp[8] = {bm(pos, C),
-                                           bm(pos, Y), bm(pos, S), bm(pos, M),
-                                           bm(pos, B), bm(pos, H), bm(pos, V)};
-         roaring::Roaring* ret = new roaring::Roaring(roaring::Roaring::fastunion(8, tmp));
-         return ret;
-      }
-      case G: {
-         const roaring::Roaring* tmp[8] = {bm(pos, G),
-                                           bm(pos, R), bm(pos, S), bm(pos, K),
-                                           bm(pos, D), bm(pos, B), bm(pos, V)};
-         roaring::Roaring* ret = new roaring::Roaring(roaring::Roaring::fastunion(8, tmp));
-         return ret;
-      }
-      case T: {
-         const roaring::Roaring* tmp[8] = {bm(pos, T),
-                                           bm(pos, Y), bm(pos, W), bm(pos, K),
-                                           bm(pos, D), bm(pos, H), bm(pos, B)};
-         roaring::Roaring* ret = new roaring::Roaring(roaring::Roaring::fastunion(8, tmp));
-         return ret;
-      }
-      default: {
-         return new roaring::Roaring(*bm(pos, r));
-      }
-   }
-}
-
-roaring::Roaring* SequenceStore::bma_neg(size_t pos, Symbol r) const {
-   auto tmp1 = bm(pos, r);
-   roaring::api::roaring_bitmap_flip(&tmp1->roaring, 0, sequence_count);
+/// The symbols that may indicate the residue r, including r itself
+static const std::vector<Symbol>& ambiguous_symbols(Symbol r) {
+   static const std::vector<Symbol> a = {A, R, W, M, D, H, V};
+   static const std::vector<Symbol> c = {C, Y, S, M, B, H, V};
+   static const std::vector<Symbol> g = {G, R, S, K, D, B, V};
+   static const std::vector<Symbol> t = {T, Y, W, K, D, H, B};
+   static const std::vector<std::vector<Symbol>> others = [] {
+      std::vector<std::vector<Symbol>> ret;
+      for (unsigned s = 0; s < symbolCount; ++s) {
+         ret.push_back({(Symbol) s});
+      }
+      return ret;
+   }();
    switch (r) {
-      case A: {
-         const roaring::Roaring* tmp[8] = {tmp1,
-                                           bm(pos, R), bm(pos, W), bm(pos, M),
-                                           bm(pos, D), bm(pos, H), bm(pos, V)};
-         roaring::Roaring* ret = new roaring::Roaring(roaring::Roaring::fastunion(8, tmp));
-         return ret;
+      case A:
+         return a;
+      case C:
+         return c;
+      case G:
+         return g;
+      case T:
+         return t;
+      default:
+         return others[r];
+   }
+}
+
+roaring::Roaring* SequenceStore::bma(size_t pos, Symbol r, uint32_t begin, uint32_t end) const {
+   std::vector<std::shared_ptr<const roaring::Roaring>> views;
+   std::vector<const roaring::Roaring*> tmp;
+   for (Symbol s : ambiguous_symbols(r)) {
+      views.push_back(bitmap_view(*bm(pos, s), begin, end));
+      tmp.push_back(views.back().get());
+   }
+   auto ret = new roaring::Roaring(roaring::Roaring::fastunion(tmp.size(), tmp.data()));
+   if (r == gap) {
+      add_edge_gaps(pos, *ret, begin, end);
+   } else if (r == N) {
+      add_n_runs(pos, *ret, begin, end);
+   }
+   return ret;
+}
+
+roaring::Roaring* SequenceStore::bma_neg(size_t pos, Symbol r, uint32_t begin, uint32_t end) const {
+   /// The bitmap of r is flipped, it holds the rows that do not have r. Without the rows of the
+   /// other symbols indicating r, this is the complement of bma(pos, r) in the range.
+   std::vector<std::shared_ptr<const roaring::Roaring>> views;
+   std::vector<const roaring::Roaring*> tmp;
+   for (Symbol s : ambiguous_symbols(r)) {
+      if (s != r) {
+         views.push_back(bitmap_view(*bm(pos, s), begin, end));
+         tmp.push_back(views.back().get());
+      }
+   }
+   auto flipped = bitmap_view(*bm(pos, r), begin, end);
+   roaring::Roaring* ret = new roaring::Roaring(*flipped);
+   if (!tmp.empty()) {
+      *ret -= roaring::Roaring::fastunion(tmp.size(), tmp.data());
+   }
+   return ret;
+}
+
+const roaring::Roaring* SequenceStore::bma_precomputed(size_t pos, Symbol r) const {
+   if (has_extents(pos, r)) {
+      return nullptr;
+   }
+   if (r < A || r > T) {
+      return bm(pos, r);
+   }
+   auto it = ambiguity_index.find(pos - 1);
+   if (it != ambiguity_index.end()) {
+      return &it->second[r - A];
+   }
+   /// Without ambiguous symbols at this position, both bma and bma_neg return the bitmap of r
+   for (Symbol s : ambiguous_symbols(r)) {
+      if (s != r && !bm(pos, s)->isEmpty()) {
+         return nullptr;
+      }
+   }
+   return bm(pos, r);
+}
+
+void SequenceStore::build_ambiguity_index(double min_density) {
+   ambiguity_index.clear();
+   /// Scanning the positions would load all of a lazily mapped store, bma_precomputed then checks per position
+   if (min_density > 1 || lazy) {
+      return;
+   }
+   std::vector<std::unique_ptr<std::array<roaring::Roaring, 4>>> entries(genomeLength);
+   tbb::parallel_for((unsigned) 0, genomeLength, [&](unsigned p) {
+      uint64_t ambiguous = 0;
+      for (Symbol s : {R, Y, S, W, K, M, B, D, H, V}) {
+         ambiguous += positions[p].bitmaps[s].cardinality();
+      }
+      /// Positions without ambiguous symbols are answered by bma_precomputed without an index
+      if (ambiguous == 0 || ambiguous < min_density * sequence_count) {
+         return;
+      }
+      auto entry = std::make_unique<std::array<roaring::Roaring, 4>>();
+      for (Symbol r : {A, C, G, T}) {
+         std::unique_ptr<roaring::Roaring> res(positions[p].flipped_bitmap == r ? bma_neg(p + 1, r) : bma(p + 1, r));
+         res->runOptimize();
+         res->shrinkToFit();
+         (*entry)[r - A] = std::move(*res);
+      }
+      entries[p] = std::move(entry);
+   });
+   for (unsigned p = 0; p < genomeLength; ++p) {
+      if (entries[p]) {
+         ambiguity_index.emplace(p, std::move(*entries[p]));
+      }
+   }
+}
+
+void SequenceStore::build_variant_index(const std::string& reference) {
+   std::vector<std::unique_ptr<roaring::Roaring>> variants(genomeLength);
+   tbb::parallel_for((unsigned) 0, genomeLength, [&](unsigned p) {
+      const Symbol ref = to_symbol(reference.at(p));
+      std::vector<roaring::Roaring> unflipped;
+      std::vector<const roaring::Roaring*> parts;
+      for (Symbol s : {A, C, G, T, gap}) {
+         if (s == ref) {
+            continue;
+         }
+         if (positions[p].flipped_bitmap == s) {
+            /// Only if the most common symbol differs from the reference
+            unflipped.emplace_back(positions[p].bitmaps[s]);
+            unflipped.back().flip(0, sequence_count);
+         } else if (!positions[p].bitmaps[s].isEmpty()) {
+            parts.push_back(&positions[p].bitmaps[s]);
+         }
+      }
+      for (const roaring::Roaring& bitmap : unflipped) {
+         parts.push_back(&bitmap);
+      }
+      auto res = std::make_unique<roaring::Roaring>(roaring::Roaring::fastunion(parts.size(), parts.data()));
+      if (res->isEmpty()) {
+         return;
+      }
+      res->runOptimize();
+      res->shrinkToFit();
+      variants[p] = std::move(res);
+   });
+   variant_positions.clear();
+   variant_bitmaps.clear();
+   for (unsigned p = 0; p < genomeLength; ++p) {
+      if (variants[p]) {
+         variant_positions.push_back(p);
+         variant_bitmaps.push_back(std::move(*variants[p]));
+      }
+   }
+}
+
+void SequenceStore::add_edge_gaps(size_t pos, roaring::Roaring& bitmap, uint32_t begin, uint32_t end) const {
+   std::vector<uint32_t> rows;
+   auto add = [&](const std::vector<uint32_t>& order, size_t count) {
+      for (size_t i = 0; i < count; ++i) {
+         if (order[i] >= begin && order[i] < end) {
+            rows.push_back(order[i]);
+         }
+      }
+   };
+   add(start_gap_order, leading_gaps(pos - 1));
+   add(end_gap_order, trailing_gaps(pos - 1));
+   std::sort(rows.begin(), rows.end());
+   bitmap.addMany(rows.size(), rows.data());
+}
+
+void SequenceStore::compress_edge_gaps() {
+   start_gaps.assign(sequence_count, 0);
+   end_gaps.assign(sequence_count, 0);
+   {
+      /// The sequences whose leading gaps reach position p
+      roaring::Roaring candidates;
+      candidates.addRange(0, sequence_count);
+      for (unsigned p = 0; p < genomeLength && !candidates.isEmpty(); ++p) {
+         candidates &= positions[p].bitmaps[gap];
+         for (uint32_t sid : candidates) {
+            ++start_gaps[sid];
+         }
+      }
+   }
+   {
+      roaring::Roaring candidates;
+      candidates.addRange(0, sequence_count);
+      for (unsigned p = genomeLength; p-- > 0 && !candidates.isEmpty();) {
+         candidates &= positions[p].bitmaps[gap];
+         for (uint32_t sid : candidates) {
+            ++end_gaps[sid];
+         }
+      }
+   }
+   start_gap_order.clear();
+   end_gap_order.clear();
+   for (uint32_t sid = 0; sid < sequence_count; ++sid) {
+      /// A sequence of only gaps is covered by its leading gaps
+      end_gaps[sid] = std::min(end_gaps[sid], genomeLength - start_gaps[sid]);
+      if (start_gaps[sid] > 0) {
+         start_gap_order.push_back(sid);
+      }
+      if (end_gaps[sid] > 0) {
+         end_gap_order.push_back(sid);
+      }
+   }
+   std::stable_sort(start_gap_order.begin(), start_gap_order.end(), [&](uint32_t a, uint32_t b) { return start_gaps[a] > start_gaps[b]; });
+   std::stable_sort(end_gap_order.begin(), end_gap_order.end(), [&](uint32_t a, uint32_t b) { return end_gaps[a] > end_gaps[b]; });
+
+   tbb::parallel_for((unsigned) 0, genomeLength, [&](unsigned p) {
+      roaring::Roaring edge_gaps;
+      add_edge_gaps(p + 1, edge_gaps);
+      if (edge_gaps.isEmpty()) {
+         return;
+      }
+      roaring::Roaring& gaps = positions[p].bitmaps[gap];
+      gaps -= edge_gaps;
+      gaps.runOptimize();
+      gaps.shrinkToFit();
+   });
+}
+
+void SequenceStore::add_n_runs(size_t pos, roaring::Roaring& bitmap, uint32_t begin, uint32_t end) const {
+   std::vector<uint32_t> rows;
+   for_each_n_run(pos - 1, [&](const n_run_t& run) {
+      if (run.sid >= begin && run.sid < end) {
+         rows.push_back(run.sid);
+      }
+   });
+   std::sort(rows.begin(), rows.end());
+   bitmap.addMany(rows.size(), rows.data());
+}
+
+roaring::Roaring* SequenceStore::uncovered(size_t from, size_t to, uint32_t begin, uint32_t end) const {
+   std::vector<std::shared_ptr<const roaring::Roaring>> views;
+   std::vector<const roaring::Roaring*> tmp;
+   for (size_t pos = from; pos <= to; ++pos) {
+      const roaring::Roaring& n = *bm(pos, N);
+      if (!n.isEmpty()) {
+         views.push_back(bitmap_view(n, begin, end));
+         tmp.push_back(views.back().get());
+      }
+   }
+   auto ret = new roaring::Roaring(roaring::Roaring::fastunion(tmp.size(), tmp.data()));
+   /// The runs overlapping the range either cover its first position or start within it
+   std::vector<uint32_t> rows;
+   auto add = [&](const n_run_t& run) {
+      if (run.sid >= begin && run.sid < end) {
+         rows.push_back(run.sid);
+      }
+   };
+   for_each_n_run(from - 1, add);
+   auto it = std::upper_bound(n_runs.begin(), n_runs.end(), (uint32_t) from - 1, [](uint32_t v, const n_run_t& run) { return v < run.start; });
+   for (; it != n_runs.end() && it->start <= to - 1; ++it) {
+      add(*it);
+   }
+   std::sort(rows.begin(), rows.end());
+   ret->addMany(rows.size(), rows.data());
+   return ret;
+}
+
+void SequenceStore::compress_n_runs(uint32_t min_length) {
+   n_runs.clear();
+   {
+      /// Sweeps the positions, the runs of a sequence open and close where its N bitmap membership changes
+      std::vector<uint32_t> run_start(sequence_count);
+      roaring::Roaring open;
+      auto close = [&](const roaring::Roaring& ended, uint32_t p) {
+         for (uint32_t sid : ended) {
+            if (p - run_start[sid] >= min_length) {
+               n_runs.push_back({run_start[sid], p, sid});
+            }
+         }
+      };
+      for (unsigned p = 0; p < genomeLength; ++p) {
+         const roaring::Roaring& n = positions[p].bitmaps[N];
+         close(open - n, p);
+         for (uint32_t sid : n - open) {
+            run_start[sid] = p;
+         }
+         open = n;
+      }
+      close(open, genomeLength);
+   }
+   std::sort(n_runs.begin(), n_runs.end(), [](const n_run_t& a, const n_run_t& b) { return std::tie(a.start, a.sid) < std::tie(b.start, b.sid); });
+   n_runs.shrink_to_fit();
+   build_n_run_index();
+
+   tbb::parallel_for((unsigned) 0, genomeLength, [&](unsigned p) {
+      roaring::Roaring runs;
+      add_n_runs(p + 1, runs);
+      if (runs.isEmpty()) {
+         return;
+      }
+      roaring::Roaring& n = positions[p].bitmaps[N];
+      n -= runs;
+      n.runOptimize();
+      n.shrinkToFit();
+   });
+}
+
+void SequenceStore::build_n_run_index() {
+   n_run_checkpoints.assign(n_runs.empty() ? 0 : (genomeLength + n_run_stride - 1) / n_run_stride, {});
+   for (uint32_t r = 0; r < n_runs.size(); ++r) {
+      /// The checkpoints in [start, end)
+      for (uint32_t c = (n_runs[r].start + n_run_stride - 1) / n_run_stride; c * n_run_stride < n_runs[r].end; ++c) {
+         n_run_checkpoints[c].push_back(r);
+      }
+   }
+   for (auto& checkpoint : n_run_checkpoints) {
+      checkpoint.shrink_to_fit();
+   }
+}
+
+static constexpr char positions_file_magic[8] = {'S', 'I', 'L', 'O', 'P', 'O', 'S', '\0'};
+
+/// Frozen bitmaps must start at 32 byte boundaries
+static uint64_t align_frozen(uint64_t offset) {
+   return (offset + 31) & ~uint64_t{31};
+}
+
+static uint64_t positions_entries_offset() {
+   return align_frozen(sizeof(positions_file_header_t));
+}
+
+static uint64_t positions_flipped_offset() {
+   return positions_entries_offset() + sizeof(positions_file_entry_t) * genomeLength * symbolCount;
+}
+
+static uint64_t positions_data_offset() {
+   return align_frozen(positions_flipped_offset() + sizeof(uint32_t) * genomeLength);
+}
+
+void SequenceStore::save_positions(const std::string& filename) const {
+   std::ofstream out(filename, std::ios::binary);
+   if (!out) {
+      throw std::runtime_error("Cannot open positions file for saving: " + filename);
+   }
+   positions_file_header_t header{};
+   std::copy(std::begin(positions_file_magic), std::end(positions_file_magic), header.magic);
+   header.version = positions_file_version;
+   header.genome_length = genomeLength;
+   header.symbol_count = symbolCount;
+   header.sequence_count = sequence_count;
+
+   std::vector<positions_file_entry_t> entries(genomeLength * symbolCount);
+   std::vector<uint32_t> flipped(genomeLength);
+   uint64_t offset = positions_data_offset();
+   for (unsigned p = 0; p < genomeLength; ++p) {
+      flipped[p] = positions[p].flipped_bitmap;
+      for (unsigned s = 0; s < symbolCount; ++s) {
+         const uint64_t length = position(p).bitmaps[s].getFrozenSizeInBytes();
+         entries[p * symbolCount + s] = {offset, length};
+         offset = align_frozen(offset + length);
       }
-      case C: {
-         const roaring::Roaring* tmp[8] = {tmp1,
-                                           bm(pos, Y), bm(pos, S), bm(pos, M),
-                                           bm(pos, B), bm(pos, H), bm(pos, V)};
-         roaring::Roaring* ret = new roaring::Roaring(roaring::Roaring::fastunion(8, tmp));
-         return ret;
+   }
+
+   uint64_t written = 0;
+   auto write = [&](const void* data, uint64_t length) {
+      out.write(static_cast<const char*>(data), length);
+      written += length;
+   };
+   auto pad_to = [&](uint64_t target) {
+      static constexpr char zeros[32] = {};
+      write(zeros, target - written);
+   };
+   write(&header, sizeof(header));
+   pad_to(positions_entries_offset());
+   write(entries.data(), sizeof(positions_file_entry_t) * entries.size());
+   write(flipped.data(), sizeof(uint32_t) * flipped.size());
+   std::vector<char> buffer;
+   for (unsigned p = 0; p < genomeLength; ++p) {
+      for (unsigned s = 0; s < symbolCount; ++s) {
+         const positions_file_entry_t& entry = entries[p * symbolCount + s];
+         pad_to(entry.offset);
+         buffer.resize(entry.length);
+         position(p).bitmaps[s].writeFrozen(buffer.data());
+         write(buffer.data(), entry.length);
       }
-      case G: {
-         const roaring::Roaring* tmp[8] = {tmp1,
-                                           bm(pos, R), bm(pos, S), bm(pos, K),
-                                           bm(pos, D), bm(pos, B), bm(pos, V)};
-         roaring::Roaring* ret = new roaring::Roaring(roaring::Roaring::fastunion(8, tmp));
-         return ret;
+   }
+   if (!out) {
+      throw std::runtime_error("Cannot write positions file: " + filename);
+   }
+}
+
+/// Serves the bitmaps of the position as views of their entries in the mapped data. Returns the number of mapped bytes,
+/// throws std::runtime_error for a corrupt bitmap.
+static size_t map_position(Position& position, const char* data, const positions_file_entry_t* entries) {
+   size_t bytes = 0;
+   for (unsigned s = 0; s < symbolCount; ++s) {
+      const positions_file_entry_t& entry = entries[s];
+      /// Like Roaring::frozenView, which returns a const Roaring that could only be copied
+      const roaring::api::roaring_bitmap_t* view = roaring::api::roaring_bitmap_frozen_view(data + entry.offset, entry.length);
+      if (!view) {
+         throw std::runtime_error("Corrupt bitmap in positions file");
       }
-      case T: {
-         const roaring::Roaring* tmp[8] = {tmp1,
-                                           bm(pos, Y), bm(pos, W), bm(pos, K),
-                                           bm(pos, D), bm(pos, H), bm(pos, B)};
-         roaring::Roaring* ret = new roaring::Roaring(roaring::Roaring::fastunion(8, tmp));
-         return ret;
+      roaring::Roaring& bitmap = position.bitmaps[s];
+      /// Cleared bitmaps own no containers
+      assert(bitmap.isEmpty() && !(bitmap.roaring.high_low_container.flags & ROARING_FLAG_FROZEN));
+      roaring::api::roaring_bitmap_clear(&bitmap.roaring);
+      bitmap.roaring = *view;
+      bytes += entry.length;
+   }
+   return bytes;
+}
+
+void SequenceStore::map_positions(const std::string& filename, bool lazy_mapping) {
+   auto file = std::make_shared<const MappedFile>(filename);
+   const char* data = file->data();
+   if (file->size() < positions_data_offset()) {
+      throw std::runtime_error("Positions file too short: " + filename);
+   }
+   positions_file_header_t header;
+   memcpy(&header, data, sizeof(header));
+   if (!std::equal(std::begin(positions_file_magic), std::end(positions_file_magic), header.magic) || header.version != positions_file_version) {
+      throw std::runtime_error("Not a positions file of version " + std::to_string(positions_file_version) + ": " + filename);
+   }
+   if (header.genome_length != genomeLength || header.symbol_count != symbolCount || header.sequence_count != sequence_count) {
+      throw std::runtime_error("Positions file does not match the partition: " + filename);
+   }
+   const auto entries = reinterpret_cast<const positions_file_entry_t*>(data + positions_entries_offset());
+   const auto flipped = reinterpret_cast<const uint32_t*>(data + positions_flipped_offset());
+   for (unsigned i = 0; i < genomeLength * symbolCount; ++i) {
+      if (entries[i].offset % 32 != 0 || entries[i].offset > file->size() || entries[i].length > file->size() - entries[i].offset) {
+         throw std::runtime_error("Corrupt positions file: " + filename);
+      }
+   }
+   for (unsigned p = 0; p < genomeLength; ++p) {
+      positions[p].flipped_bitmap = flipped[p];
+   }
+
+   /// Set first, such that views mapped before a failure stay valid
+   positions_file = file;
+   if (lazy_mapping) {
+      lazy = std::make_unique<lazy_positions_t>();
+      lazy->entries = entries;
+      return;
+   }
+   lazy.reset();
+   tbb::parallel_for((unsigned) 0, genomeLength, [&](unsigned p) {
+      map_position(positions[p], data, entries + p * symbolCount);
+   });
+}
+
+void SequenceStore::load_position(uint32_t p) const {
+   std::lock_guard<std::mutex> lock(lazy->load_mutex[p % lazy_positions_t::load_stripes]);
+   if (lazy->loaded[p].load(std::memory_order_acquire)) {
+      return;
+   }
+   /// Mapping does not change the content of the position, only whether it is backed
+   auto& position = const_cast<Position&>(positions[p]);
+   lazy->loaded_bytes += map_position(position, positions_file->data(), lazy->entries + p * symbolCount);
+   lazy->loaded[p].store(true, std::memory_order_release);
+}
+
+size_t SequenceStore::evict_positions(size_t budget) const {
+   if (!lazy) {
+      return 0;
+   }
+   size_t released = 0;
+   /// Clock: a referenced position gets a second chance, two rounds visit every position unreferenced
+   for (uint32_t step = 0; step < 2 * genomeLength && lazy->loaded_bytes > budget; ++step) {
+      const uint32_t p = lazy->clock_hand;
+      lazy->clock_hand = (p + 1) % genomeLength;
+      if (!lazy->loaded[p] || lazy->referenced[p].exchange(false)) {
+         continue;
       }
-      default: {
-         return new roaring::Roaring(*bm(pos, r));
+      auto& position = const_cast<Position&>(positions[p]);
+      const positions_file_entry_t* entries = lazy->entries + p * symbolCount;
+      size_t bytes = 0;
+      for (unsigned s = 0; s < symbolCount; ++s) {
+         /// The destructor frees the view of a frozen bitmap, assignment would not
+         position.bitmaps[s].~Roaring();
+         new (&position.bitmaps[s]) roaring::Roaring();
+         bytes += entries[s].length;
       }
+      const uint64_t begin = entries[0].offset;
+      const uint64_t end = entries[symbolCount - 1].offset + entries[symbolCount - 1].length;
+      positions_file->release(begin, end - begin);
+      lazy->loaded[p] = false;
+      lazy->loaded_bytes -= bytes;
+      released += bytes;
    }
+   return released;
 }
 
 int SequenceStore::db_info(std::ostream& io) const {
    std::osyncstream(io) << "partition sequence count: " << number_fmt(this->sequence_count) << std::endl;
    std::osyncstream(io) << "partition size: " << number_fmt(this->computeSize()) << std::endl;
+   std::osyncstream(io) << "ambiguity index positions: " << number_fmt(ambiguity_index.size()) << std::endl;
+   std::osyncstream(io) << "variant positions: " << number_fmt(variant_positions.size()) << std::endl;
+   if (!n_runs.empty()) {
+      std::osyncstream(io) << "runs of N: " << number_fmt(n_runs.size()) << std::endl;
+   }
+   if (lazy) {
+      std::osyncstream(io) << "loaded position bytes: " << number_fmt(loaded_position_bytes()) << std::endl;
+   }
    return 0;
 }
 
@@ -117,6 +541,10 @@ void SequenceStore::interpret(const std::vector<std::string>& genomes) {
 }
 
 [[maybe_unused]] unsigned silo::runOptimize(SequenceStore& db) {
+   /// Mapped bitmaps are read-only, they were written as they were optimized before saving
+   if (db.positions_mapped()) {
+      return 0;
+   }
    std::atomic<unsigned> count_true = 0;
    tbb::blocked_range<Position*> r(std::begin(db.positions), std::end(db.positions));
    tbb::parallel_for(r, [&](const decltype(r) local) {
@@ -130,6 +558,9 @@ void SequenceStore::interpret(const std::vector<std::string>& genomes) {
 }
 
 [[maybe_unused]] unsigned silo::shrinkToFit(SequenceStore& db) {
+   if (db.positions_mapped()) {
+      return 0;
+   }
    std::atomic<size_t> saved = 0;
    tbb::blocked_range<Position*> r(std::begin(db.positions), std::end(db.positions));
    tbb::parallel_for(r, [&](const decltype(r) local) {
@@ -143,83 +574,3 @@ void SequenceStore::interpret(const std::vector<std::string>& genomes) {
    });
    return saved;
 }
-
-CompressedSequenceStore::CompressedSequenceStore(const SequenceStore& seq_store) {
-   using roaring::Roaring;
-
-   for (unsigned i = 0; i < genomeLength; i++) {
-      positions[i].flipped_bitmap = seq_store.positions[i].flipped_bitmap;
-      for (uint16_t s = 0; s < symbolCount; s++) {
-         positions[i].bitmaps[s] = seq_store.positions[i].bitmaps[s];
-      }
-   }
-   {
-      Roaring current_gap_extension_candidates;
-      current_gap_extension_candidates.addRange(0, seq_store.sequence_count);
-      for (unsigned i = 0; i < genomeLength / 4; i++) {
-         current_gap_extension_candidates &= seq_store.positions[i].bitmaps[Symbol::gap];
-         roaring::api::roaring_bitmap_andnot_inplace(&this->positions[i].bitmaps[Symbol::gap].roaring, &current_gap_extension_candidates.roaring);
-         uint32_t flipped_bitmap = this->positions[i].flipped_bitmap;
-         if (flipped_bitmap != UINT32_MAX)
-            roaring::api::roaring_bitmap_andnot_inplace(&this->positions[i].bitmaps[flipped_bitmap].roaring, &current_gap_extension_candidates.roaring);
-         for (unsigned gap_pos : current_gap_extension_candidates) {
-            this->start_gaps[gap_pos]++;
-         }
-      }
-   }
-   {
-      Roaring current_gap_extension_candidates;
-      current_gap_extension_candidates.addRange(0, seq_store.sequence_count);
-      for (unsigned i = genomeLength - 1; i >= genomeLength - genomeLength / 4; i--) {
-         current_gap_extension_candidates &= seq_store.positions[i].bitmaps[Symbol::gap];
-         roaring::api::roaring_bitmap_andnot_inplace(&this->positions[i].bitmaps[Symbol::gap].roaring, &current_gap_extension_candidates.roaring);
-         uint32_t flipped_bitmap = this->positions[i].flipped_bitmap;
-         if (flipped_bitmap != UINT32_MAX)
-            roaring::api::roaring_bitmap_andnot_inplace(&this->positions[i].bitmaps[flipped_bitmap].roaring, &current_gap_extension_candidates.roaring);
-         for (unsigned gap_pos : current_gap_extension_candidates) {
-            this->end_gaps[gap_pos]++;
-         }
-      }
-   }
-}
-
-SequenceStore::SequenceStore(const CompressedSequenceStore& c_seq_store) {
-   using roaring::Roaring;
-
-   for (unsigned i = 0; i < genomeLength; ++i) {
-      positions[i].flipped_bitmap = c_seq_store.positions[i].flipped_bitmap;
-      for (uint16_t s = 0; s < symbolCount; s++) {
-         positions[i].bitmaps[s] = c_seq_store.positions[i].bitmaps[s];
-      }
-   }
-   {
-      std::vector<std::vector<uint32_t>> gaps_per_pos(genomeLength / 4);
-      for (unsigned seq_id = 0; seq_id < sequence_count; ++seq_id) {
-         for (unsigned pos = 0; pos < c_seq_store.start_gaps[seq_id]; ++pos) {
-            gaps_per_pos[pos].push_back(seq_id);
-         }
-      }
-      for (unsigned i = 0; i < genomeLength / 4; i++) {
-         const Roaring tmp(gaps_per_pos[i].size(), gaps_per_pos[i].data());
-         roaring::api::roaring_bitmap_or_inplace(&this->positions[i].bitmaps[Symbol::gap].roaring, &tmp.roaring);
-         uint32_t flipped_bitmap = this->positions[i].flipped_bitmap;
-         if (flipped_bitmap != UINT32_MAX)
-            roaring::api::roaring_bitmap_or_inplace(&this->positions[i].bitmaps[flipped_bitmap].roaring, &tmp.roaring);
-      }
-   }
-   {
-      std::vector<std::vector<uint32_t>> gaps_per_pos(genomeLength / 4);
-      for (unsigned seq_id = 0; seq_id < sequence_count; ++seq_id) {
-         for (unsigned pos = 0; pos < c_seq_store.end_gaps[seq_id]; ++pos) {
-            gaps_per_pos[pos].push_back(seq_id);
-         }
-      }
-      for (unsigned i = genomeLength - 1; i >= genomeLength - genomeLength / 4; i--) {
-         const Roaring tmp(gaps_per_pos[genomeLength - i - 1].size(), gaps_per_pos[genomeLength - i - 1].data());
-         roaring::api::roaring_bitmap_or_inplace(&this->positions[i].bitmaps[Symbol::gap].roaring, &tmp.roaring);
-         uint32_t flipped_bitmap = this->positions[i].flipped_bitmap;
-         if (flipped_bitmap != UINT32_MAX)
-            roaring::api::roaring_bitmap_or_inplace(&this->positions[i].bitmaps[flipped_bitmap].roaring, &tmp.roaring);
-      }
-   }
-}
\ No newline at end of file
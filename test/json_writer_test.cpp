@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+#include <silo/common/json_writer.h>
+
+#include <limits>
+#include <sstream>
+
+using silo::JsonWriter;
+
+TEST(JsonWriter, SeparatesElements) {
+   std::stringstream out;
+   {
+      JsonWriter writer(out);
+      writer.begin_array();
+      writer.begin_object();
+      writer.key("a");
+      writer.value(1);
+      writer.key("b");
+      writer.begin_array();
+      writer.end_array();
+      writer.key("c");
+      writer.begin_object();
+      writer.end_object();
+      writer.end_object();
+      writer.value("x");
+      writer.value(uint64_t{18446744073709551615ull});
+      writer.value(int64_t{-3});
+      writer.end_array();
+   }
+   EXPECT_EQ(out.str(), R"([{"a":1,"b":[],"c":{}},"x",18446744073709551615,-3])");
+}
+
+TEST(JsonWriter, EscapesStrings) {
+   std::stringstream out;
+   {
+      JsonWriter writer(out);
+      writer.value(std::string_view("a\"b\\c\nd\x01", 8));
+   }
+   EXPECT_EQ(out.str(), R"("a\"b\\c\u000ad\u0001")");
+}
+
+TEST(JsonWriter, WritesShortestDoubles) {
+   std::stringstream out;
+   {
+      JsonWriter writer(out);
+      writer.begin_array();
+      writer.value(0.1);
+      writer.value(0.75);
+      writer.value(1e-7);
+      writer.value(std::numeric_limits<double>::infinity());
+      writer.value(std::numeric_limits<double>::quiet_NaN());
+      writer.end_array();
+   }
+   EXPECT_EQ(out.str(), "[0.1,0.75,1e-07,null,null]");
+}
+
+TEST(JsonWriter, FlushesBeyondBuffer) {
+   const std::string long_value(100000, 'x');
+   std::stringstream out;
+   {
+      JsonWriter writer(out);
+      writer.begin_array();
+      for (int i = 0; i < 3; ++i) {
+         writer.value(long_value);
+      }
+      for (int i = 0; i < 20000; ++i) {
+         writer.value(i);
+      }
+      writer.end_array();
+   }
+   std::string expected = "[";
+   for (int i = 0; i < 3; ++i) {
+      expected += "\"" + long_value + "\",";
+   }
+   for (int i = 0; i < 20000; ++i) {
+      expected += std::to_string(i) + (i + 1 < 20000 ? "," : "");
+   }
+   expected += "]";
+   EXPECT_EQ(out.str(), expected);
+}
@@ -0,0 +1,77 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <silo/storage/lineage_tree.h>
+
+using namespace silo;
+using namespace silo::test;
+
+namespace {
+
+/// B.1.617 and B.1.1.529 are not lineages of the database, C.5.3 has no ancestor in it
+const std::vector<std::string> lineages = {"B.1.1.7", "B", "B.11", "B.1", "B.1.617.2", "B.1.1", "BA.2", "C.5.3"};
+
+std::unique_ptr<Database> make_lineage_database() {
+   std::vector<test_sequence_t> sequences;
+   for (size_t i = 0; i < lineages.size(); ++i) {
+      sequences.push_back({"EPI_ISL_" + std::to_string(i), lineages[i], "2021-01-01", "Europe", "Switzerland", "Bern"});
+   }
+   return make_test_database({sequences});
+}
+
+/// The parent of the lineage in the tree, empty for a root
+std::string parent_of(const Dictionary& dict, const lineage_tree_t& tree, const std::string& lineage) {
+   const uint32_t parent = tree.parent.at(dict.get_pangoid(lineage));
+   return parent == UINT32_MAX ? "" : dict.get_pango(parent);
+}
+
+} // namespace
+
+TEST(LineageTree, ParentIsLongestLineagePrefix) {
+   auto db = make_lineage_database();
+   const Dictionary& dict = *db->dict;
+   const lineage_tree_t tree = lineage_tree_t::build(dict);
+   EXPECT_EQ(parent_of(dict, tree, "B"), "");
+   EXPECT_EQ(parent_of(dict, tree, "B.1"), "B");
+   EXPECT_EQ(parent_of(dict, tree, "B.1.1"), "B.1");
+   /// A prefix ends before a dot, B.1 is not a prefix of B.11
+   EXPECT_EQ(parent_of(dict, tree, "B.11"), "B");
+   EXPECT_EQ(parent_of(dict, tree, "B.1.1.7"), "B.1.1");
+   /// Missing intermediate lineages are skipped
+   EXPECT_EQ(parent_of(dict, tree, "B.1.617.2"), "B.1");
+   EXPECT_EQ(parent_of(dict, tree, "B.1.1.529.2"), "B.1.1");
+   EXPECT_EQ(parent_of(dict, tree, "C.5.3"), "");
+}
+
+TEST(LineageTree, LevelsByDepth) {
+   auto db = make_lineage_database();
+   const Dictionary& dict = *db->dict;
+   const lineage_tree_t tree = lineage_tree_t::build(dict);
+   std::vector<std::vector<std::string>> levels;
+   for (const auto& level : tree.levels) {
+      std::vector<std::string>& names = levels.emplace_back();
+      for (uint32_t pango : level) {
+         names.push_back(dict.get_pango(pango));
+      }
+      std::sort(names.begin(), names.end());
+   }
+   EXPECT_EQ(levels, (std::vector<std::vector<std::string>>{
+                        {"B", "C.5.3"}, {"B.1", "B.11"}, {"B.1.1", "B.1.617.2"}, {"B.1.1.529.2", "B.1.1.7"}}));
+   for (uint32_t pango = 0; pango < tree.children.size(); ++pango) {
+      for (uint32_t child : tree.children[pango]) {
+         EXPECT_EQ(tree.parent[child], pango);
+      }
+   }
+}
+
+TEST(LineageTree, SubLineagesFollowTree) {
+   auto db = make_lineage_database();
+   auto list = [&](const std::string& lineage, bool include_sub_lineages) {
+      return query_result(*db, R"({"action": {"type": "List", "fields": ["pango_lineage"]}, "filter": {"type": "PangoLineage", "value": ")" +
+                                  lineage + R"(", "includeSubLineages": )" + (include_sub_lineages ? "true" : "false") + "}}");
+   };
+   EXPECT_EQ(list("B.1", true), R"([{"pango_lineage":"B.1.1.7"},{"pango_lineage":"B.1"},{"pango_lineage":"B.1.617.2"},)"
+                                R"({"pango_lineage":"B.1.1"},{"pango_lineage":"B.1.1.529.2"}])");
+   EXPECT_EQ(list("B.1", false), R"([{"pango_lineage":"B.1"}])");
+   EXPECT_EQ(list("B.11", true), R"([{"pango_lineage":"B.11"}])");
+}
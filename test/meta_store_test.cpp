@@ -0,0 +1,164 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+using namespace silo::test;
+
+namespace {
+
+std::string division_query(const std::string& value) {
+   return R"({"action": {"type": "List", "fields": ["gisaid_epi_isl"]}, "filter": {"type": "StrEq", "column": "division", "value": ")" +
+      value + R"("}})";
+}
+
+/// Indexes division, which has five distinct values for the six sample sequences
+void index_division(Database& db) {
+   db.col_index_max_distinct_share = 1.0;
+}
+
+test_sequence_t dated(int id, const std::string& date) {
+   return {"EPI_ISL_" + std::to_string(id), "B.1", date, "Europe", "Switzerland", "Bern"};
+}
+
+/// One partition of three chunks, the dates of the last chunk overlap those of the first two
+std::unique_ptr<Database> make_dated_database() {
+   return make_chunked_database({{
+      {dated(1, "2021-01-01"), dated(2, "2021-01-02")},
+      {dated(3, "2021-01-03"), dated(4, "2021-01-05")},
+      {dated(5, "2021-01-02"), dated(6, "2021-01-07")},
+   }});
+}
+
+time_t day_time(uint32_t day) {
+   return (time_t) day * 24 * 60 * 60;
+}
+
+} // namespace
+
+TEST(ColumnIndex, LooksUpIndexedValues) {
+   auto db = make_sample_database(1, index_division);
+   const DatabasePartition& dbp = db->partitions[0];
+   const uint32_t col = db->dict->get_colid("division");
+   ASSERT_LT(col, dbp.meta_store.col_bitmaps.size());
+   ASSERT_TRUE(dbp.meta_store.col_bitmaps[col]);
+   EXPECT_EQ(dbp.meta_store.col_bitmaps[col]->size(), 5u);
+
+   StrEqEx bern("division", "Bern");
+   const roaring::Roaring* bm = bern.index_lookup(*db, dbp);
+   ASSERT_NE(bm, nullptr);
+   EXPECT_EQ(*bm, roaring::Roaring::bitmapOf(2, 0, 4));
+   EXPECT_EQ(bern.estimate_cardinality(*db, dbp), 2u);
+   const slice_t slice{0, dbp.sequenceCount};
+   filter_t result = bern.evaluate(*db, dbp, slice);
+   EXPECT_EQ(result.mutable_res, nullptr);
+   EXPECT_EQ(rows(result, slice), (std::vector<uint32_t>{0, 4}));
+   result.free();
+
+   /// Values that are not in the partition are simplified away
+   StrEqEx unknown("division", "Nowhere");
+   ASSERT_NE(unknown.index_lookup(*db, dbp), nullptr);
+   EXPECT_TRUE(unknown.index_lookup(*db, dbp)->isEmpty());
+   EXPECT_EQ(unknown.simplify(*db, dbp)->type(), ExType::EMPTY);
+}
+
+TEST(ColumnIndex, ScansColumnsWithManyValues) {
+   auto db = make_sample_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   StrEqEx bern("division", "Bern");
+   EXPECT_EQ(bern.index_lookup(*db, dbp), nullptr);
+   EXPECT_EQ(bern.estimate_cardinality(*db, dbp), dbp.sequenceCount);
+   const slice_t slice{0, dbp.sequenceCount};
+   filter_t result = bern.evaluate(*db, dbp, slice);
+   EXPECT_EQ(rows(result, slice), (std::vector<uint32_t>{0, 4}));
+   result.free();
+
+   /// The index follows the configuration when it is rebuilt
+   db->col_index_max_distinct_share = 1.0;
+   db->build_indexes();
+   EXPECT_NE(bern.index_lookup(*db, dbp), nullptr);
+   db->indexed_columns.clear();
+   db->build_indexes();
+   EXPECT_EQ(bern.index_lookup(*db, dbp), nullptr);
+}
+
+TEST(ColumnIndex, IndexedMatchesScanned) {
+   auto indexed = make_sample_database(2, index_division);
+   auto scanned = make_sample_database(2);
+   for (const std::string value : {"Bern", "Berlin", "Mumbai", "Nowhere"}) {
+      EXPECT_EQ(query_result(*indexed, division_query(value)), query_result(*scanned, division_query(value))) << value;
+   }
+   EXPECT_EQ(query_result(*indexed, division_query("Bern")), R"([{"gisaid_epi_isl":"EPI_ISL_1"},{"gisaid_epi_isl":"EPI_ISL_5"}])");
+}
+
+TEST(DateIndex, BuildsCumulativeBitmaps) {
+   auto db = make_dated_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   const MetaStore& mdb = dbp.meta_store;
+   ASSERT_EQ(mdb.sid_to_day.size(), 6u);
+   const uint32_t first = mdb.sid_to_day[0];
+   EXPECT_EQ(day_to_string(first), "2021-01-01");
+   EXPECT_EQ(mdb.sid_to_day, (std::vector<uint32_t>{first, first + 1, first + 2, first + 4, first + 1, first + 6}));
+   EXPECT_EQ(mdb.sorted_days, (std::vector<uint32_t>{first, first + 1, first + 2, first + 4, first + 6}));
+   ASSERT_EQ(mdb.until_day_bitmaps.size(), 5u);
+   EXPECT_EQ(mdb.until_day_bitmaps[1], roaring::Roaring::bitmapOf(3, 0, 1, 4));
+
+   EXPECT_EQ(rows_until_day(mdb, first - 1), nullptr);
+   EXPECT_EQ(*rows_until_day(mdb, first), roaring::Roaring::bitmapOf(1, 0));
+   /// Days without rows have the rows of the day before
+   EXPECT_EQ(*rows_until_day(mdb, first + 3), roaring::Roaring::bitmapOf(4, 0, 1, 2, 4));
+   EXPECT_EQ(rows_until_day(mdb, first + 100)->cardinality(), 6u);
+
+   const std::vector<chunk_t>& chunks = dbp.get_chunks();
+   ASSERT_EQ(chunks.size(), 3u);
+   EXPECT_EQ(std::make_pair(chunks[0].min_day, chunks[0].max_day), std::make_pair(first, first + 1));
+   EXPECT_EQ(std::make_pair(chunks[1].min_day, chunks[1].max_day), std::make_pair(first + 2, first + 4));
+   EXPECT_EQ(std::make_pair(chunks[2].min_day, chunks[2].max_day), std::make_pair(first + 1, first + 6));
+}
+
+TEST(DateIndex, DateBetwMatchesDays) {
+   auto db = make_dated_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   const std::vector<uint32_t>& days = dbp.meta_store.sid_to_day;
+   const uint32_t first = days[0];
+   const slice_t slice{0, dbp.sequenceCount};
+   /// Every range of days from before the first to after the last row, including ranges with from > to,
+   /// ranges that end at the boundaries of the zone maps, and open ends
+   for (uint32_t from = first - 1; from <= first + 8; ++from) {
+      for (uint32_t to = first - 1; to <= first + 8; ++to) {
+         for (int open = 0; open < 4; ++open) {
+            const bool open_from = open & 1;
+            const bool open_to = open & 2;
+            std::vector<uint32_t> expected;
+            for (uint32_t sid = 0; sid < days.size(); ++sid) {
+               if ((open_from || days[sid] >= from) && (open_to || days[sid] <= to)) {
+                  expected.push_back(sid);
+               }
+            }
+            DateBetwEx date_betw(day_time(from), open_from, day_time(to), open_to);
+            const std::string range = std::to_string(from - first) + " " + std::to_string(to - first) + " open " + std::to_string(open);
+            filter_t result = date_betw.evaluate(*db, dbp, slice);
+            EXPECT_EQ(rows(result, slice), expected) << range;
+            result.free();
+            EXPECT_EQ(date_betw.estimate_cardinality(*db, dbp), expected.size()) << range;
+            auto simplified = date_betw.simplify(*db, dbp);
+            filter_t simplified_result = simplified->evaluate(*db, dbp, slice);
+            EXPECT_EQ(rows(simplified_result, slice), expected) << range;
+            simplified_result.free();
+         }
+      }
+   }
+}
+
+TEST(DateIndex, DateBetwQueries) {
+   auto db = make_dated_database();
+   auto count = [&](const std::string& from, const std::string& to) {
+      return query_result(*db, R"({"action": {"type": "Aggregated"}, "filter": {"type": "DateBetw", "from": )" + from + R"(, "to": )" + to + "}}");
+   };
+   EXPECT_EQ(count(R"("2021-01-02")", R"("2021-01-05")"), R"({"count":4})");
+   EXPECT_EQ(count(R"("2021-01-05")", R"("2021-01-02")"), R"({"count":0})");
+   EXPECT_EQ(count("null", R"("2021-01-02")"), R"({"count":3})");
+   EXPECT_EQ(count(R"("2021-01-03")", "null"), R"({"count":3})");
+   EXPECT_EQ(count("null", "null"), R"({"count":6})");
+}
@@ -0,0 +1,84 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+using namespace silo::test;
+
+namespace {
+
+/// Every sequence has a T at a different subset of the positions 1, 5, 9, 13 and 17
+std::unique_ptr<Database> make_subsets_database() {
+   std::vector<test_sequence_t> sequences;
+   for (uint32_t subset = 0; subset < 32; ++subset) {
+      test_sequence_t sequence{"EPI_ISL_" + std::to_string(subset + 1), "B.1", "2021-01-01", "Europe", "Switzerland", "Bern"};
+      for (uint32_t bit = 0; bit < 5; ++bit) {
+         if (subset & (1u << bit)) {
+            sequence.mutations.emplace_back(1 + 4 * bit, 'T');
+         }
+      }
+      sequences.push_back(sequence);
+   }
+   return make_test_database({sequences});
+}
+
+std::unique_ptr<NOfEx> n_of(unsigned n, bool exactly, unsigned impl) {
+   auto ret = std::make_unique<NOfEx>(n, impl, exactly);
+   for (uint32_t bit = 0; bit < 5; ++bit) {
+      ret->children.push_back(nuc_eq(1 + 4 * bit, 'T'));
+   }
+   return ret;
+}
+
+} // namespace
+
+TEST(NOf, ImplementationsAgree) {
+   auto db = make_subsets_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   const slice_t slice{0, dbp.sequenceCount};
+   for (unsigned n = 0; n <= 6; ++n) {
+      for (bool exactly : {false, true}) {
+         std::vector<uint32_t> expected;
+         for (uint32_t subset = 0; subset < 32; ++subset) {
+            const auto count = (unsigned) std::popcount(subset);
+            if (exactly ? count == n : count >= n) {
+               expected.push_back(subset);
+            }
+         }
+         for (unsigned impl = 0; impl <= 3; ++impl) {
+            auto nof_ex = n_of(n, exactly, impl);
+            filter_t result = nof_ex->evaluate(*db, dbp, slice);
+            EXPECT_EQ(rows(result, slice), expected) << "n " << n << " exactly " << exactly << " impl " << impl;
+            result.free();
+         }
+         auto fused = n_of(n, exactly, NOfEx::impl_fused);
+         filter_t result = evaluate_compiled(*fused, *db, dbp, slice);
+         EXPECT_EQ(rows(result, slice), expected) << "n " << n << " exactly " << exactly << " fused";
+         result.free();
+         ASSERT_EQ(fused->decisions.size(), 1u);
+         EXPECT_EQ(fused->decisions[0].impl, NOfEx::impl_fused);
+      }
+   }
+}
+
+TEST(NOf, ChoosesImplementationByCost) {
+   auto db = make_subsets_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   const slice_t slice{0, dbp.sequenceCount};
+   auto nof_ex = n_of(2, false, NOfEx::impl_auto);
+   nof_ex->plan(*db, dbp);
+   const unsigned chosen = nof_ex->choose_impl(dbp, slice);
+   EXPECT_LE(chosen, 3u);
+   for (unsigned impl = 0; impl <= 3; ++impl) {
+      EXPECT_LE(nof_ex->estimate_cost(chosen, dbp, slice), nof_ex->estimate_cost(impl, dbp, slice));
+   }
+   const unsigned chosen_fusable = nof_ex->choose_impl(dbp, slice, true);
+   EXPECT_LE(nof_ex->estimate_cost(chosen_fusable, dbp, slice), nof_ex->estimate_cost(NOfEx::impl_fused, dbp, slice));
+
+   filter_t result = nof_ex->evaluate(*db, dbp, slice);
+   result.free();
+   ASSERT_EQ(nof_ex->decisions.size(), 1u);
+   EXPECT_EQ(nof_ex->decisions[0].impl, chosen);
+   EXPECT_TRUE(nof_ex->decisions[0].automatic);
+}
@@ -0,0 +1,66 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+using namespace silo::test;
+
+namespace {
+
+const std::string count_by_country_since =
+   R"({"action": {"type": "Aggregated"}, "filter": {"type": "And", "children": [)"
+   R"({"type": "StrEq", "column": "country", "value": {"param": "country"}}, )"
+   R"({"type": "DateBetw", "from": {"param": "from"}, "to": null}]}})";
+
+std::string execute(const Database& db, prepared_query_t& prepared, const query_params_t& params, bool compile_filter = false) {
+   std::stringstream res, perf;
+   execute_prepared(db, prepared, params, res, perf, compile_filter);
+   return res.str();
+}
+
+} // namespace
+
+TEST(PreparedQuery, MatchesUnpreparedQuery) {
+   auto db = make_sample_database(2);
+   auto prepared = prepare_query(*db, count_by_country_since);
+   const std::pair<query_params_t, std::string> cases[] = {
+      {{{"country", "Switzerland"}, {"from", "2021-02-01"}}, R"("Switzerland"}, {"type": "DateBetw", "from": "2021-02-01", "to": null})"},
+      /// An empty value binds an open bound
+      {{{"country", "Switzerland"}, {"from", ""}}, R"("Switzerland"}, {"type": "DateBetw", "from": null, "to": null})"},
+      {{{"country", "India"}, {"from", "2022-01-01"}}, R"("India"}, {"type": "DateBetw", "from": "2022-01-01", "to": null})"},
+      {{{"country", "Atlantis"}, {"from", ""}}, R"("Atlantis"}, {"type": "DateBetw", "from": null, "to": null})"},
+   };
+   const std::string expected_counts[] = {R"({"count":2})", R"({"count":3})", R"({"count":1})", R"({"count":0})"};
+   for (size_t i = 0; i < std::size(cases); ++i) {
+      const std::string unprepared = R"({"action": {"type": "Aggregated"}, "filter": {"type": "And", "children": [)"
+                                     R"({"type": "StrEq", "column": "country", "value": )" + cases[i].second + "]}}";
+      EXPECT_EQ(query_result(*db, unprepared), expected_counts[i]);
+      /// The same prepared query is bound again for every execution
+      EXPECT_EQ(execute(*db, *prepared, cases[i].first), expected_counts[i]) << i;
+      EXPECT_EQ(execute(*db, *prepared, cases[i].first, true), expected_counts[i]) << i;
+   }
+}
+
+TEST(PreparedQuery, BindsLineageParameter) {
+   auto db = make_sample_database(2);
+   auto prepared = prepare_query(*db, R"({"action": {"type": "Aggregated"}, "filter": )"
+                                      R"({"type": "PangoLineage", "value": {"param": "lineage"}, "includeSubLineages": true}})");
+   EXPECT_EQ(execute(*db, *prepared, {{"lineage", "B.1.1.7"}}), R"({"count":2})");
+   EXPECT_EQ(execute(*db, *prepared, {{"lineage", "BA.2"}}), R"({"count":2})");
+   EXPECT_EQ(execute(*db, *prepared, {{"lineage", "BA.1"}}), R"({"count":1})");
+}
+
+TEST(PreparedQuery, ThrowsOnMissingParameter) {
+   auto db = make_sample_database(2);
+   auto prepared = prepare_query(*db, count_by_country_since);
+   EXPECT_THROW(execute(*db, *prepared, {{"country", "Switzerland"}}), QueryParseException);
+   EXPECT_THROW(execute(*db, *prepared, {}), QueryParseException);
+   /// A failed binding leaves the prepared query usable
+   EXPECT_EQ(execute(*db, *prepared, {{"country", "Germany"}, {"from", ""}}), R"({"count":1})");
+}
+
+TEST(PreparedQuery, RejectsParametersOfUnpreparedQuery) {
+   auto db = make_sample_database();
+   EXPECT_THROW(query_result(*db, count_by_country_since), QueryParseException);
+}
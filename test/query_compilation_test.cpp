@@ -0,0 +1,144 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+using namespace silo::test;
+
+TEST(QueryCompilation, MatchesTheInterpreter) {
+   auto db = make_sample_database();
+   const std::string filters[] = {
+      R"({"type": "And", "children": [{"type": "NucEq", "position": 241, "value": "T"}, {"type": "Neg", "child": {"type": "NucEq", "position": 14409, "value": "T"}}]})",
+      R"({"type": "Or", "children": [{"type": "StrEq", "column": "country", "value": "India"}, {"type": "NucEq", "position": 3037, "value": "T"}]})",
+      R"({"type": "N-Of", "n": 2, "exactly": false, "children": [{"type": "NucEq", "position": 241, "value": "T"}, {"type": "NucEq", "position": 3037, "value": "T"}, {"type": "NucEq", "position": 14409, "value": "T"}]})",
+      R"({"type": "N-Of", "n": 2, "exactly": true, "children": [{"type": "NucEq", "position": 241, "value": "T"}, {"type": "NucEq", "position": 3037, "value": "T"}, {"type": "NucEq", "position": 14409, "value": "T"}]})",
+      R"({"type": "Neg", "child": {"type": "Or", "children": [{"type": "NucEq", "position": 241, "value": "T"}, {"type": "NucEq", "position": 23405, "value": "G"}]}})",
+   };
+   for (const auto& filter : filters) {
+      const std::string query = R"({"action": {"type": "List", "fields": ["gisaid_epi_isl"]}, "filter": )" + filter + "}";
+      std::stringstream interpreted, compiled, perf;
+      execute_query(*db, query, interpreted, perf, false);
+      execute_query(*db, query, compiled, perf, true);
+      EXPECT_EQ(interpreted.str(), compiled.str()) << filter;
+   }
+}
+
+TEST(QueryCompilation, PutsInteriorCachedSubexpressions) {
+   auto db = make_sample_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   ResultCache cache;
+   auto or_ex = std::make_unique<OrEx>();
+   or_ex->children.push_back(nuc_eq(3037, 'T'));
+   or_ex->children.push_back(nuc_eq(14409, 'T'));
+   auto and_ex = std::make_unique<AndEx>();
+   and_ex->children.push_back(nuc_eq(241, 'T'));
+   and_ex->children.push_back(std::move(or_ex));
+   std::unique_ptr<BoolExpression> filter = cache_subexpressions(std::move(and_ex), *db, 0, [&](const std::string&) { return &cache; });
+
+   const slice_t slice{0, dbp.sequenceCount};
+   filter_t result = evaluate_compiled(*filter, *db, dbp, slice);
+   EXPECT_EQ(rows(result, slice), (std::vector<uint32_t>{0, 3}));
+   result.free();
+
+   auto& outer = dynamic_cast<CachedEx&>(*filter);
+   auto& inner = dynamic_cast<CachedEx&>(*dynamic_cast<AndEx&>(*outer.child).children[1]);
+   ASSERT_TRUE(cache.get(outer.key, 0, 0));
+   auto inner_result = cache.get(inner.key, 0, 0);
+   ASSERT_TRUE(inner_result);
+   EXPECT_EQ(inner_result.bitmap->cardinality(), 4u);
+}
+
+TEST(QueryCompilation, FusesCachedSubexpressions) {
+   auto db = make_sample_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   ResultCache cache;
+   auto or_ex = std::make_unique<OrEx>();
+   or_ex->children.push_back(nuc_eq(241, 'T'));
+   or_ex->children.push_back(nuc_eq(3037, 'T'));
+   auto cached = std::make_unique<CachedEx>(std::make_unique<NegEx>(std::move(or_ex)), "neg", 0, &cache);
+   CachedEx& cached_ref = *cached;
+   auto other = std::make_unique<OrEx>();
+   other->children.push_back(nuc_eq(14409, 'T'));
+   other->children.push_back(nuc_eq(3037, 'T'));
+   AndEx and_ex;
+   and_ex.children.push_back(std::move(cached));
+   and_ex.children.push_back(std::move(other));
+
+   const slice_t slice{0, dbp.sequenceCount};
+   for (int i = 0; i < 2; ++i) {
+      filter_t result = evaluate_compiled(and_ex, *db, dbp, slice);
+      EXPECT_EQ(rows(result, slice), (std::vector<uint32_t>{5}));
+      result.free();
+      /// The negation at the top of the fused subexpression is kept as the complement of the captured rows
+      const cached_result_t entry = cache.get(cached_ref.key, 0, 0);
+      ASSERT_TRUE(entry);
+      EXPECT_TRUE(entry.complemented);
+      EXPECT_EQ(*entry.bitmap, roaring::Roaring::bitmapOf(4, 0, 1, 2, 3));
+   }
+}
+
+TEST(QueryCompilation, CapturesChunksWithoutLeaves) {
+   auto db = make_sample_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   ResultCache cache;
+   /// No sample sequence has a C or T at 23405, all leaves are empty in the only chunk
+   auto empty = std::make_unique<OrEx>();
+   empty->children.push_back(nuc_eq(23405, 'C'));
+   empty->children.push_back(nuc_eq(23405, 'T'));
+   auto full = std::make_unique<OrEx>();
+   full->children.push_back(std::make_unique<NegEx>(nuc_eq(23405, 'C')));
+   full->children.push_back(nuc_eq(23405, 'T'));
+   AndEx and_ex;
+   and_ex.children.push_back(std::move(empty));
+   and_ex.children.push_back(std::make_unique<CachedEx>(std::move(full), "full", 0, &cache));
+
+   const slice_t slice{0, dbp.sequenceCount};
+   filter_t result = evaluate_compiled(and_ex, *db, dbp, slice);
+   EXPECT_TRUE(rows(result, slice).empty());
+   result.free();
+   /// The chunk is not skipped, the captured subexpression is full in it
+   const cached_result_t entry = cache.get("full", 0, 0);
+   ASSERT_TRUE(entry);
+   EXPECT_FALSE(entry.complemented);
+   EXPECT_EQ(entry.bitmap->cardinality(), 6u);
+}
+
+TEST(QueryCompilation, StopsAndAtEmptyOperand) {
+   auto db = make_sample_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   uint32_t evaluations = 0;
+   auto and_ex = std::make_unique<AndEx>();
+   and_ex->children.push_back(nuc_eq(23405, 'C'));
+   and_ex->children.push_back(std::make_unique<counting_ex_t>(nuc_eq(241, 'T'), &evaluations));
+   auto or_ex = std::make_unique<OrEx>();
+   or_ex->children.push_back(std::move(and_ex));
+   or_ex->children.push_back(nuc_eq(14409, 'T'));
+
+   const slice_t slice{0, dbp.sequenceCount};
+   filter_t result = evaluate_compiled(*or_ex, *db, dbp, slice);
+   EXPECT_EQ(rows(result, slice), (std::vector<uint32_t>{2, 3, 5}));
+   result.free();
+   EXPECT_EQ(evaluations, 0u);
+}
+
+TEST(QueryCompilation, ReportsNOfDecisions) {
+   auto db = make_sample_database();
+   auto n_of_query = [](const std::string& impl) {
+      return R"({"action": {"type": "Aggregated"}, "filter": {"type": "N-Of", "n": 2, "exactly": false, )" + impl +
+         R"("children": [{"type": "NucEq", "position": 241, "value": "T"}, {"type": "NucEq", "position": 3037, "value": "T"}, {"type": "NucEq", "position": 14409, "value": "T"}]}})";
+   };
+   const std::pair<std::string, std::string> cases[] = {
+      {"", "(auto)"},
+      {R"("impl": 2, )", "impl 2 (fixed)"},
+      {R"("impl": 4, )", "impl fused (fixed)"},
+   };
+   for (const auto& [impl, decision] : cases) {
+      /// The implementation is not part of the cache key
+      db->result_cache->clear();
+      std::stringstream res, perf;
+      execute_query(*db, n_of_query(impl), res, perf, true);
+      EXPECT_EQ(res.str(), R"({"count":3})");
+      EXPECT_NE(perf.str().find(decision), std::string::npos) << perf.str();
+   }
+}
@@ -0,0 +1,123 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+using namespace silo::test;
+
+namespace {
+
+std::string query(const std::string& action, const std::string& filter) {
+   return R"({"action": )" + action + R"(, "filter": )" + filter + "}";
+}
+
+const std::string count = R"({"type": "Aggregated"})";
+const std::string not_241_t = R"({"type": "Neg", "child": {"type": "NucEq", "position": 241, "value": "T"}})";
+const std::string not_3037_t = R"({"type": "Neg", "child": {"type": "NucEq", "position": 3037, "value": "T"}})";
+const std::string not_14409_t = R"({"type": "Neg", "child": {"type": "NucEq", "position": 14409, "value": "T"}})";
+/// No sample sequence has a C at 23405
+const std::string all = R"({"type": "Neg", "child": {"type": "NucEq", "position": 23405, "value": "C"}})";
+
+std::string country(const std::string& value) {
+   return R"({"type": "StrEq", "column": "country", "value": ")" + value + R"("})";
+}
+
+std::string list(const std::string& options) {
+   return R"({"type": "List", "fields": ["gisaid_epi_isl"])" + options + "}";
+}
+
+std::string epi_isls(std::initializer_list<int> ids) {
+   std::string ret = "[";
+   for (int id : ids) {
+      ret += (ret.size() > 1 ? "," : "") + std::string(R"({"gisaid_epi_isl":"EPI_ISL_)") + std::to_string(id) + "\"}";
+   }
+   return ret + "]";
+}
+
+} // namespace
+
+TEST(QueryEngine, CountsComplementedFilters) {
+   auto db = make_sample_database(2);
+   const std::pair<std::string, std::string> cases[] = {
+      {not_241_t, R"({"count":3})"},
+      {R"({"type": "And", "children": [)" + country("Switzerland") + ", " + not_241_t + "]}", R"({"count":1})"},
+      {R"({"type": "And", "children": [)" + not_241_t + ", " + not_14409_t + "]}", R"({"count":1})"},
+      {R"({"type": "Or", "children": [)" + not_241_t + ", " + country("Germany") + "]}", R"({"count":4})"},
+      {R"({"type": "Or", "children": [)" + not_241_t + ", " + not_3037_t + "]}", R"({"count":4})"},
+      {R"({"type": "Neg", "child": {"type": "And", "children": [)" + not_241_t + ", " + not_14409_t + "]}}", R"({"count":5})"},
+   };
+   for (const auto& [filter, expected] : cases) {
+      EXPECT_EQ(query_result(*db, query(count, filter)), expected) << filter;
+      EXPECT_EQ(query_result(*db, query(count, filter), true), expected) << filter;
+   }
+}
+
+TEST(QueryEngine, NegEvaluatesToComplement) {
+   auto db = make_sample_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   const slice_t slice{0, dbp.sequenceCount};
+   NegEx neg(nuc_eq(241, 'T'));
+   filter_t result = neg.evaluate(*db, dbp, slice);
+   EXPECT_TRUE(result.complemented);
+   EXPECT_EQ(result.cardinality(slice.begin, slice.end), 3u);
+   EXPECT_EQ(rows(result, slice), (std::vector<uint32_t>{2, 4, 5}));
+   result.free();
+}
+
+TEST(QueryEngine, CountsGroups) {
+   auto db = make_sample_database(2);
+   EXPECT_EQ(query_result(*db, query(R"({"type": "Aggregated", "groupByFields": ["country"]})", all)),
+             R"([{"country":"Switzerland","count":3},{"country":"Germany","count":1},{"country":"India","count":2}])");
+   EXPECT_EQ(query_result(*db, query(R"({"type": "Aggregated", "groupByFields": ["region", "country"]})", not_241_t)),
+             R"([{"region":"Europe","country":"Switzerland","count":1},{"region":"Asia","country":"India","count":2}])");
+   EXPECT_EQ(query_result(*db, query(R"({"type": "Aggregated", "groupByFields": ["date"]})", not_14409_t)),
+             R"([{"date":"2021-01-03","count":1},{"date":"2021-02-10","count":1},{"date":"2021-03-15","count":1}])");
+}
+
+TEST(QueryEngine, ListsWindowOfSequences) {
+   auto db = make_sample_database(2);
+   EXPECT_EQ(query_result(*db, query(list(""), all)), epi_isls({1, 2, 3, 4, 5, 6}));
+   EXPECT_EQ(query_result(*db, query(list(R"(, "offset": 2, "limit": 3)"), all)), epi_isls({3, 4, 5}));
+   EXPECT_EQ(query_result(*db, query(list(R"(, "offset": 5)"), all)), epi_isls({6}));
+   EXPECT_EQ(query_result(*db, query(list(R"(, "offset": 6)"), all)), "[]");
+   EXPECT_EQ(query_result(*db, query(list(R"(, "limit": 0)"), all)), "[]");
+   EXPECT_EQ(query_result(*db, query(list(R"(, "orderBy": "date")"), all)), epi_isls({1, 2, 5, 3, 4, 6}));
+   EXPECT_EQ(query_result(*db, query(list(R"(, "orderBy": "date", "offset": 1, "limit": 3)"), all)), epi_isls({2, 5, 3}));
+   EXPECT_EQ(query_result(*db, query(list(R"(, "orderBy": "date", "offset": 1)"), not_14409_t)), epi_isls({2, 5}));
+}
+
+TEST(QueryEngine, MutationsOfComplementedFilter) {
+   auto db = make_sample_database(2);
+   const std::string complemented = R"({"type": "Neg", "child": )" + country("India") + "}";
+   const std::string positive = R"({"type": "Or", "children": [)" + country("Switzerland") + ", " + country("Germany") + "]}";
+   const std::string mutations = R"({"type": "Mutations", "minProportion": 0.01})";
+   const std::string expected = query_result(*db, query(mutations, positive));
+   EXPECT_EQ(expected, R"([{"mutation":"A240T","proportion":0.75,"count":3},{"mutation":"A3036T","proportion":0.5,"count":2},)"
+                       R"({"mutation":"A14408T","proportion":0.25,"count":1}])");
+   EXPECT_EQ(query_result(*db, query(mutations, complemented)), expected);
+   EXPECT_EQ(query_result(*db, query(mutations, complemented), true), expected);
+}
+
+TEST(QueryEngine, SharesSubexpressionsOfBatch) {
+   auto db = make_sample_database();
+   const std::string n_of = R"({"type": "N-Of", "n": 2, "exactly": false, "children": [{"type": "NucEq", "position": 241, "value": "T"}, )"
+                            R"({"type": "NucEq", "position": 3037, "value": "T"}, {"type": "NucEq", "position": 14409, "value": "T"}]})";
+   const std::vector<std::string> queries = {
+      query(count, R"({"type": "And", "children": [)" + country("Switzerland") + ", " + n_of + "]}"),
+      query(count, R"({"type": "Or", "children": [)" + country("Germany") + ", " + n_of + "]}"),
+   };
+   for (bool compile_filter : {false, true}) {
+      db->result_cache->clear();
+      std::stringstream perf;
+      std::vector<result_s> results = execute_queries(*db, queries, perf, compile_filter);
+      EXPECT_EQ(results[0].return_message, R"({"count":2})");
+      EXPECT_EQ(results[1].return_message, R"({"count":4})");
+      /// Every evaluation of the N-Of reports its decision
+      size_t evaluations = 0;
+      for (size_t pos = perf.str().find("N-Of ("); pos != std::string::npos; pos = perf.str().find("N-Of (", pos + 1)) {
+         ++evaluations;
+      }
+      EXPECT_EQ(evaluations, 1u) << "compile_filter " << compile_filter << "\n" << perf.str();
+   }
+}
@@ -0,0 +1,68 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <regex>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+using namespace silo::test;
+
+namespace {
+
+const std::string filter = R"({"type": "And", "children": [{"type": "Or", "children": [{"type": "NucEq", "position": 3037, "value": "T"}, )"
+                           R"({"type": "NucEq", "position": 14409, "value": "T"}]}, {"type": "NucEq", "position": 241, "value": "T"}]})";
+
+/// The explained filter of the only partition, without the times, which differ from run to run
+std::string explained_filter(const Database& db, const std::string& mode) {
+   const std::string result = query_result(db, R"({"action": {"type": "Aggregated"}, "explain": ")" + mode + R"(", "filter": )" + filter + "}");
+   const std::string prefix = R"(,"partitions":[{"partition":0,"sequenceCount":6,"filter":)";
+   const size_t begin = result.find(prefix);
+   EXPECT_NE(begin, std::string::npos) << result;
+   EXPECT_EQ(result.substr(result.size() - 3), "}]}");
+   const std::string ret = result.substr(begin + prefix.size(), result.size() - begin - prefix.size() - 3);
+   return std::regex_replace(ret, std::regex(R"("microseconds":\d+)"), R"("microseconds":0)");
+}
+
+} // namespace
+
+TEST(QueryExplain, ExplainsPlan) {
+   auto db = make_sample_database();
+   /// The planner puts the more selective child first, the interior nodes are cached
+   EXPECT_EQ(explained_filter(*db, "plan"),
+             R"j({"type":"And","expression":"( & 241T & (3037T | 14409T | ))","estimatedCardinality":3,"cached":true,"children":[)j"
+             R"({"type":"NucEq","expression":"241T","estimatedCardinality":3},)"
+             R"j({"type":"Or","expression":"(3037T | 14409T | )","estimatedCardinality":6,"cached":true,"children":[)j"
+             R"({"type":"NucEq","expression":"3037T","estimatedCardinality":3},{"type":"NucEq","expression":"14409T","estimatedCardinality":3}]}],)"
+             R"("negatedChildren":[]})");
+}
+
+TEST(QueryExplain, AnalyzesEveryNode) {
+   auto db = make_sample_database();
+   const std::string leaf_stats = R"("evaluations":1,"microseconds":0,"cardinality":3,"containers":{"array":1,"bitset":0,"run":0},"bytesAllocated":0)";
+   /// Bitmaps of the database are not allocated by the query
+   EXPECT_EQ(explained_filter(*db, "analyze"),
+             R"j({"type":"And","expression":"( & 241T & (3037T | 14409T | ))","estimatedCardinality":3,"cached":true,)j"
+             R"("evaluations":1,"microseconds":0,"cardinality":2,"containers":{"array":1,"bitset":0,"run":0},"bytesAllocated":20,"cacheMisses":1,"children":[)"
+             R"({"type":"NucEq","expression":"241T","estimatedCardinality":3,)" + leaf_stats + "}," +
+             R"j({"type":"Or","expression":"(3037T | 14409T | )","estimatedCardinality":6,"cached":true,)j"
+             R"("evaluations":1,"microseconds":0,"cardinality":4,"containers":{"array":1,"bitset":0,"run":0},"bytesAllocated":24,"cacheMisses":1,"children":[)"
+             R"({"type":"NucEq","expression":"3037T","estimatedCardinality":3,)" + leaf_stats + "}," +
+             R"({"type":"NucEq","expression":"14409T","estimatedCardinality":3,)" + leaf_stats + "}]}]," +
+             R"("negatedChildren":[]})");
+}
+
+TEST(QueryExplain, AnalyzesCacheHits) {
+   auto db = make_sample_database();
+   explained_filter(*db, "analyze");
+   const std::string result = explained_filter(*db, "analyze");
+   /// The root is served from the cache, the nodes below it are not evaluated
+   const std::string root = R"j({"type":"And","expression":"( & 241T & (3037T | 14409T | ))","estimatedCardinality":3,"cached":true,)j"
+                            R"("evaluations":1,"microseconds":0,"cardinality":2,"containers":{"array":1,"bitset":0,"run":0},"bytesAllocated":0,"cacheMisses":0,)";
+   EXPECT_EQ(result.substr(0, root.size()), root);
+   EXPECT_NE(result.find(R"({"type":"NucEq","expression":"241T","estimatedCardinality":3,"evaluations":0,)"), std::string::npos) << result;
+}
+
+TEST(QueryExplain, RejectsUnknownMode) {
+   auto db = make_sample_database();
+   EXPECT_THROW(query_result(*db, R"({"action": {"type": "Aggregated"}, "explain": "verbose", "filter": )" + filter + "}"), QueryParseException);
+}
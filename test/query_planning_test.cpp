@@ -0,0 +1,46 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+using namespace silo::test;
+
+TEST(QueryPlanning, OrdersAndChildrenBySelectivity) {
+   auto db = make_sample_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   AndEx and_ex;
+   and_ex.children.push_back(nuc_eq(241, 'T'));
+   and_ex.children.push_back(nuc_eq(23405, 'G'));
+   and_ex.children.push_back(nuc_eq(3037, 'T'));
+   and_ex.negated_children.push_back(nuc_eq(23405, 'G'));
+   and_ex.negated_children.push_back(nuc_eq(14409, 'T'));
+   and_ex.plan(*db, dbp);
+
+   std::vector<uint32_t> estimates;
+   for (const auto& child : and_ex.children) {
+      estimates.push_back(child->estimate_cardinality(*db, dbp));
+   }
+   EXPECT_EQ(estimates, (std::vector<uint32_t>{1, 3, 3}));
+   EXPECT_EQ(dynamic_cast<NucEqEx&>(*and_ex.children[0]).position, 23405u);
+   EXPECT_EQ(dynamic_cast<NucEqEx&>(*and_ex.children[1]).position, 241u);
+   /// The largest negated children come first
+   EXPECT_EQ(dynamic_cast<NucEqEx&>(*and_ex.negated_children[0]).position, 14409u);
+}
+
+TEST(QueryPlanning, AndStopsAtEmptyIntersection) {
+   auto db = make_sample_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   uint32_t evaluations = 0;
+   AndEx and_ex;
+   and_ex.children.push_back(nuc_eq(23405, 'G'));
+   and_ex.children.push_back(nuc_eq(241, 'T'));
+   and_ex.children.push_back(std::make_unique<counting_ex_t>(nuc_eq(3037, 'T'), &evaluations));
+   and_ex.negated_children.push_back(std::make_unique<counting_ex_t>(nuc_eq(14409, 'T'), &evaluations));
+
+   const slice_t slice{0, dbp.sequenceCount};
+   filter_t result = and_ex.evaluate(*db, dbp, slice);
+   EXPECT_TRUE(rows(result, slice).empty());
+   result.free();
+   EXPECT_EQ(evaluations, 0u);
+}
@@ -0,0 +1,76 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+using namespace silo::test;
+
+namespace {
+
+/// Three partitions: Switzerland in January 2021, India and Germany in June 2021, India in January 2022
+std::unique_ptr<Database> make_pruning_database() {
+   return make_test_database({
+      {{"EPI_ISL_1", "B.1", "2021-01-03", "Europe", "Switzerland", "Bern"}, {"EPI_ISL_2", "B.1", "2021-01-10", "Europe", "Switzerland", "Bern"}},
+      {{"EPI_ISL_3", "B.1", "2021-06-01", "Asia", "India", "Delhi"}, {"EPI_ISL_4", "B.1", "2021-06-05", "Europe", "Germany", "Berlin"}},
+      {{"EPI_ISL_5", "B.1", "2022-01-01", "Asia", "India", "Mumbai"}},
+   });
+}
+
+time_t date(int year, int month, int day) {
+   std::tm tm{};
+   tm.tm_year = year - 1900;
+   tm.tm_mon = month - 1;
+   tm.tm_mday = day;
+   return timegm(&tm);
+}
+
+/// What the expression simplifies to in each partition: E for EmptyEx, F for FullEx and K if the leaf is kept
+std::string simplified_types(const Database& db, const BoolExpression& ex) {
+   std::string ret;
+   for (const DatabasePartition& dbp : db.partitions) {
+      const ExType type = ex.simplify(db, dbp)->type();
+      ret += type == ExType::EMPTY ? 'E' : type == ExType::FULL ? 'F' : 'K';
+   }
+   return ret;
+}
+
+} // namespace
+
+TEST(PartitionPruning, FoldsDateBetw) {
+   auto db = make_pruning_database();
+   /// Closed ranges
+   EXPECT_EQ(simplified_types(*db, DateBetwEx(date(2021, 1, 1), false, date(2021, 1, 31), false)), "FEE");
+   EXPECT_EQ(simplified_types(*db, DateBetwEx(date(2021, 1, 5), false, date(2021, 6, 1), false)), "KKE");
+   /// The bounds are inclusive
+   EXPECT_EQ(simplified_types(*db, DateBetwEx(date(2021, 1, 10), false, date(2022, 1, 1), false)), "KFF");
+   EXPECT_EQ(simplified_types(*db, DateBetwEx(date(2021, 1, 11), false, date(2021, 12, 31), false)), "EFE");
+   /// Open ends
+   EXPECT_EQ(simplified_types(*db, DateBetwEx(0, true, date(2021, 6, 3), false)), "FKE");
+   EXPECT_EQ(simplified_types(*db, DateBetwEx(date(2021, 6, 3), false, 0, true)), "EKF");
+   EXPECT_EQ(simplified_types(*db, DateBetwEx(0, true, 0, true)), "FFF");
+   /// An empty range
+   EXPECT_EQ(simplified_types(*db, DateBetwEx(date(2021, 6, 5), false, date(2021, 6, 1), false)), "EEE");
+}
+
+TEST(PartitionPruning, FoldsCountryAndRegion) {
+   auto db = make_pruning_database();
+   EXPECT_EQ(simplified_types(*db, CountryEx(db->dict->get_countryid("Switzerland"))), "FEE");
+   EXPECT_EQ(simplified_types(*db, CountryEx(db->dict->get_countryid("India"))), "EKF");
+   EXPECT_EQ(simplified_types(*db, RegionEx(db->dict->get_regionid("Europe"))), "FKE");
+   EXPECT_EQ(simplified_types(*db, RegionEx(db->dict->get_regionid("Asia"))), "EKF");
+}
+
+TEST(PartitionPruning, PrunedQueriesMatch) {
+   auto db = make_pruning_database();
+   auto list = [&](const std::string& filter) {
+      return query_result(*db, R"({"action": {"type": "List", "fields": ["gisaid_epi_isl"]}, "filter": )" + filter + "}");
+   };
+   EXPECT_EQ(list(R"({"type": "DateBetw", "from": "2021-01-05", "to": "2021-06-01"})"),
+             R"([{"gisaid_epi_isl":"EPI_ISL_2"},{"gisaid_epi_isl":"EPI_ISL_3"}])");
+   EXPECT_EQ(list(R"({"type": "And", "children": [{"type": "StrEq", "column": "region", "value": "Asia"}, )"
+                  R"({"type": "DateBetw", "from": null, "to": "2021-12-31"}]})"),
+             R"([{"gisaid_epi_isl":"EPI_ISL_3"}])");
+   EXPECT_EQ(list(R"({"type": "Neg", "child": {"type": "StrEq", "column": "country", "value": "India"}})"),
+             R"([{"gisaid_epi_isl":"EPI_ISL_1"},{"gisaid_epi_isl":"EPI_ISL_2"},{"gisaid_epi_isl":"EPI_ISL_4"}])");
+}
@@ -0,0 +1,113 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+using namespace silo::test;
+
+namespace {
+
+std::unique_ptr<BoolExpression> or_of(std::unique_ptr<BoolExpression> a, std::unique_ptr<BoolExpression> b) {
+   auto ret = std::make_unique<OrEx>();
+   ret->children.push_back(std::move(a));
+   ret->children.push_back(std::move(b));
+   return ret;
+}
+
+} // namespace
+
+TEST(ResultCache, CanonicalKeysIgnoreOrderOfChildren) {
+   auto db = make_sample_database();
+   auto a = or_of(nuc_eq(241, 'T'), nuc_eq(3037, 'T'));
+   auto b = or_of(nuc_eq(3037, 'T'), nuc_eq(241, 'T'));
+   EXPECT_EQ(canonical_key(*a, *db), canonical_key(*b, *db));
+
+   NucEqEx exact(241, Symbol::T);
+   NucMbEx ambiguous(241, Symbol::T);
+   EXPECT_NE(canonical_key(exact, *db), canonical_key(ambiguous, *db));
+   auto c = or_of(nuc_eq(241, 'T'), nuc_eq(14409, 'T'));
+   EXPECT_NE(canonical_key(*a, *db), canonical_key(*c, *db));
+}
+
+TEST(ResultCache, HitsUntilCleared) {
+   auto db = make_sample_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   ResultCache cache;
+   uint32_t evaluations = 0;
+   CachedEx cached(std::make_unique<counting_ex_t>(or_of(nuc_eq(241, 'T'), nuc_eq(3037, 'T')), &evaluations), "key", 0, &cache);
+
+   const slice_t slice{0, dbp.sequenceCount};
+   for (int i = 0; i < 2; ++i) {
+      filter_t result = cached.evaluate(*db, dbp, slice);
+      EXPECT_EQ(rows(result, slice), (std::vector<uint32_t>{0, 1, 2, 3}));
+      result.free();
+   }
+   EXPECT_EQ(evaluations, 1u);
+   EXPECT_FALSE(cache.get("key", 1, 0));
+   EXPECT_FALSE(cache.get("key", 0, 1));
+
+   cache.clear();
+   filter_t result = cached.evaluate(*db, dbp, slice);
+   result.free();
+   EXPECT_EQ(evaluations, 2u);
+}
+
+TEST(ResultCache, KeepsComplementedResults) {
+   auto db = make_sample_database();
+   const DatabasePartition& dbp = db->partitions[0];
+   ResultCache cache;
+   uint32_t evaluations = 0;
+   CachedEx cached(std::make_unique<NegEx>(std::make_unique<counting_ex_t>(or_of(nuc_eq(241, 'T'), nuc_eq(3037, 'T')), &evaluations)),
+                   "key", 0, &cache);
+
+   const slice_t slice{0, dbp.sequenceCount};
+   for (int i = 0; i < 2; ++i) {
+      filter_t result = cached.evaluate(*db, dbp, slice);
+      /// The negation is neither materialized on a miss nor on a hit
+      EXPECT_TRUE(result.complemented);
+      EXPECT_EQ(result.getAsConst()->cardinality(), 4u);
+      EXPECT_EQ(rows(result, slice), (std::vector<uint32_t>{4, 5}));
+      result.free();
+   }
+   EXPECT_EQ(evaluations, 1u);
+   const cached_result_t entry = cache.get("key", 0, 0);
+   ASSERT_TRUE(entry);
+   EXPECT_TRUE(entry.complemented);
+   EXPECT_EQ(*entry.bitmap, roaring::Roaring::bitmapOf(4, 0, 1, 2, 3));
+
+   /// Queries with the database cache on count the rows of the complement
+   const std::string query = R"({"action": {"type": "Aggregated"}, "filter": {"type": "Neg", "child": {"type": "Or", "children": [)"
+                             R"({"type": "NucEq", "position": 241, "value": "T"}, {"type": "NucEq", "position": 3037, "value": "T"}]}}})";
+   ASSERT_TRUE(db->result_cache->enabled());
+   for (int i = 0; i < 2; ++i) {
+      EXPECT_EQ(query_result(*db, query), R"({"count":2})");
+      EXPECT_EQ(query_result(*db, query, true), R"({"count":2})");
+   }
+}
+
+TEST(ResultCache, EvictsLeastRecentlyUsed) {
+   auto bitmap = std::make_shared<const roaring::Roaring>(roaring::Roaring::bitmapOf(3, 1, 2, 3));
+   const size_t entry_bytes = bitmap->getSizeInBytes() + std::string("0.0:a").size();
+   ResultCache cache(2 * entry_bytes);
+   cache.put("a", 0, 0, bitmap);
+   cache.put("b", 0, 0, bitmap);
+   EXPECT_TRUE(cache.get("a", 0, 0));
+   cache.put("c", 0, 0, bitmap);
+   EXPECT_TRUE(cache.get("a", 0, 0));
+   EXPECT_FALSE(cache.get("b", 0, 0));
+   EXPECT_TRUE(cache.get("c", 0, 0));
+
+   cache.set_max_bytes(0);
+   EXPECT_FALSE(cache.enabled());
+   EXPECT_FALSE(cache.get("a", 0, 0));
+}
+
+TEST(ResultCache, InvalidatedWithIndexes) {
+   auto db = make_sample_database();
+   auto bitmap = std::make_shared<const roaring::Roaring>(roaring::Roaring::bitmapOf(1, 1));
+   db->result_cache->put("key", 0, 0, bitmap);
+   ASSERT_TRUE(db->result_cache->get("key", 0, 0));
+   db->build_indexes();
+   EXPECT_FALSE(db->result_cache->get("key", 0, 0));
+}
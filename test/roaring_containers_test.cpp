@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+#include <silo/roaring/roaring_containers.h>
+
+#include <vector>
+
+using namespace silo::roaring_containers;
+
+namespace {
+
+/// A bitmap with an array, a bitset and a run container, in this order
+roaring::Roaring mixed_bitmap() {
+   roaring::Roaring ret;
+   for (uint32_t v = 3; v < 60000; v += 997) {
+      ret.add(v);
+   }
+   for (uint32_t v = 1u << 16; v < (2u << 16); v += 3) {
+      ret.add(v);
+   }
+   ret.addRange((2u << 16) + 100, (2u << 16) + 40000);
+   ret.addRange((2u << 16) + 50000, (2u << 16) + 50001);
+   ret.runOptimize();
+   return ret;
+}
+
+/// Number of containers of each resolved typecode
+std::vector<uint32_t> typecode_counts(const roaring::Roaring& bitmap) {
+   const roaring::api::roaring_array_t& ra = bitmap.roaring.high_low_container;
+   std::vector<uint32_t> ret(SHARED_TYPE + 1);
+   for (int32_t i = 0; i < ra.size; ++i) {
+      ++ret[resolve_container(ra, i).second];
+   }
+   return ret;
+}
+
+/// Decodes every container and compares it with the values of the bitmap
+void expect_round_trip(const roaring::Roaring& bitmap) {
+   const roaring::api::roaring_array_t& ra = bitmap.roaring.high_low_container;
+   std::vector<uint32_t> decoded;
+   alignas(64) uint64_t words[bitset_words];
+   for (int32_t i = 0; i < ra.size; ++i) {
+      load_container(ra, i, words);
+      for (uint32_t v = 0; v < (1u << 16); ++v) {
+         if ((words[v / 64] >> (v % 64)) & 1) {
+            decoded.push_back((uint32_t) ra.keys[i] << 16 | v);
+         }
+      }
+      const auto [container, typecode] = resolve_container(ra, i);
+      const uint32_t cardinality = count_range(words, 0, 1u << 16);
+      EXPECT_EQ(and_cardinality(words, container, typecode), cardinality) << "container " << i;
+   }
+   std::vector<uint32_t> expected(bitmap.cardinality());
+   bitmap.toUint32Array(expected.data());
+   EXPECT_EQ(decoded, expected);
+}
+
+} // namespace
+
+TEST(RoaringContainers, TypecodesMatchStatistics) {
+   const roaring::Roaring bitmap = mixed_bitmap();
+   roaring::api::roaring_statistics_t stats;
+   roaring::api::roaring_bitmap_statistics(&bitmap.roaring, &stats);
+   const std::vector<uint32_t> counts = typecode_counts(bitmap);
+   EXPECT_EQ(counts[ARRAY_TYPE], stats.n_array_containers);
+   EXPECT_EQ(counts[BITSET_TYPE], stats.n_bitset_containers);
+   EXPECT_EQ(counts[RUN_TYPE], stats.n_run_containers);
+   EXPECT_EQ(counts[SHARED_TYPE], 0u);
+   EXPECT_EQ(stats.n_array_containers, 1u);
+   EXPECT_EQ(stats.n_bitset_containers, 1u);
+   EXPECT_EQ(stats.n_run_containers, 1u);
+}
+
+TEST(RoaringContainers, LoadsEveryContainerType) {
+   expect_round_trip(mixed_bitmap());
+
+   /// Copies of a copy on write bitmap share their containers
+   roaring::Roaring original = mixed_bitmap();
+   original.setCopyOnWrite(true);
+   const roaring::Roaring copy(original);
+   const roaring::api::roaring_array_t& ra = copy.roaring.high_low_container;
+   ASSERT_EQ(ra.size, 3);
+   for (int32_t i = 0; i < ra.size; ++i) {
+      EXPECT_EQ(ra.typecodes[i], SHARED_TYPE);
+   }
+   EXPECT_EQ(typecode_counts(copy), typecode_counts(mixed_bitmap()));
+   expect_round_trip(copy);
+}
+
+TEST(RoaringContainers, AndCardinalitiesMatchIntersections) {
+   roaring::Roaring filter = mixed_bitmap();
+   filter.addRange(5u << 16, (5u << 16) + 10);
+   std::vector<roaring::Roaring> others;
+   others.push_back(mixed_bitmap());
+   others.push_back(roaring::Roaring::bitmapOf(4, 3u, 1000u, (1u << 16) + 3, (2u << 16) + 99));
+   roaring::Roaring sparse;
+   for (uint32_t v = 0; v < (6u << 16); v += 7) {
+      sparse.add(v);
+   }
+   others.push_back(sparse);
+   roaring::Roaring runs;
+   runs.addRange(50, 70000);
+   runs.addRange((2u << 16) + 30000, (5u << 16) + 5);
+   runs.runOptimize();
+   others.push_back(runs);
+   others.emplace_back();
+
+   std::vector<const roaring::Roaring*> bitmaps;
+   for (const roaring::Roaring& other : others) {
+      bitmaps.push_back(&other);
+   }
+   std::vector<uint64_t> out(bitmaps.size());
+   and_cardinalities(filter, bitmaps.data(), bitmaps.size(), out.data());
+   for (size_t b = 0; b < bitmaps.size(); ++b) {
+      EXPECT_EQ(out[b], filter.and_cardinality(*bitmaps[b])) << "bitmap " << b;
+   }
+
+   /// Restricted to the containers of within, exact for the bitmaps that are subsets of within
+   const roaring::Roaring within = runs;
+   and_cardinalities(filter, bitmaps.data() + 3, 1, out.data(), &within);
+   EXPECT_EQ(out[0], filter.and_cardinality(runs));
+}
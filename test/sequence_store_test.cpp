@@ -0,0 +1,199 @@
+#include "test_util.h"
+
+#include <gtest/gtest.h>
+#include <silo/query_engine/query_engine.h>
+
+using namespace silo;
+using namespace silo::test;
+
+namespace {
+
+std::string list_query(const std::string& filter) {
+   return R"({"action": {"type": "List", "fields": ["gisaid_epi_isl"]}, "filter": )" + filter + "}";
+}
+
+std::string nuc_eq_filter(unsigned position, char symbol) {
+   return R"({"type": "NucEq", "position": )" + std::to_string(position) + R"(, "value": ")" + symbol + R"("})";
+}
+
+/// Queries touching the mutated positions of the sample sequences, and their mutations
+std::vector<std::string> sample_queries() {
+   return {
+      list_query(nuc_eq_filter(241, 'T')),
+      list_query(R"({"type": "Neg", "child": )" + nuc_eq_filter(14409, 'T') + "}"),
+      list_query(R"({"type": "N-Of", "n": 2, "exactly": false, "children": [)" + nuc_eq_filter(241, 'T') + ", " +
+                 nuc_eq_filter(3037, 'T') + ", " + nuc_eq_filter(23405, 'G') + "]}"),
+      R"({"action": {"type": "Mutations", "minProportion": 0.01}, "filter": {"type": "Neg", "child": )" + nuc_eq_filter(23405, 'C') + "}}",
+   };
+}
+
+void set_range(test_sequence_t& sequence, unsigned from, unsigned to, char symbol) {
+   for (unsigned position = from; position <= to; ++position) {
+      sequence.mutations.emplace_back(position, symbol);
+   }
+}
+
+/// Sequences with leading and trailing gaps of different lengths
+std::vector<test_sequence_t> gapped_sequences() {
+   std::vector<test_sequence_t> ret;
+   for (int i = 1; i <= 5; ++i) {
+      ret.push_back({"EPI_ISL_" + std::to_string(i), "B.1", "2021-01-0" + std::to_string(i), "Europe", "Switzerland", "Bern"});
+   }
+   set_range(ret[0], 1, 100, '-');
+   set_range(ret[0], 29800, genomeLength, '-');
+   set_range(ret[1], 1, 50, '-');
+   set_range(ret[1], 300, 300, '-');
+   set_range(ret[2], 241, 241, 'T');
+   set_range(ret[3], 29850, genomeLength, '-');
+   set_range(ret[3], 241, 241, 'T');
+   return ret;
+}
+
+/// The gapped sequences with runs of N of different lengths
+std::vector<test_sequence_t> n_run_sequences() {
+   std::vector<test_sequence_t> ret = gapped_sequences();
+   set_range(ret[0], 500, 520, 'N');
+   set_range(ret[0], 600, 600, 'N');
+   set_range(ret[1], 505, 509, 'N');
+   set_range(ret[2], 1000, 1100, 'N');
+   return ret;
+}
+
+} // namespace
+
+TEST(SequenceStore, PositionsFileRoundTrip) {
+   auto db = make_sample_database(2);
+   const std::string save_dir = make_temp_dir();
+   db->save(save_dir);
+   for (bool lazy : {false, true}) {
+      Database loaded(db->wd);
+      loaded.lazy_positions = lazy;
+      loaded.load(save_dir);
+      ASSERT_EQ(loaded.partitions.size(), 2u);
+      for (const DatabasePartition& dbp : loaded.partitions) {
+         EXPECT_TRUE(dbp.seq_store.positions_mapped());
+         EXPECT_EQ(dbp.seq_store.positions_lazy(), lazy);
+      }
+      for (const std::string& query : sample_queries()) {
+         EXPECT_EQ(query_result(loaded, query), query_result(*db, query)) << query;
+      }
+   }
+}
+
+TEST(SequenceStore, RejectsOtherPositionsFileVersion) {
+   auto db = make_sample_database();
+   const std::string save_dir = make_temp_dir();
+   db->save(save_dir);
+   std::string file;
+   {
+      std::ifstream in(save_dir + "P0.pos", std::ios::binary);
+      file.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+   }
+   ASSERT_GE(file.size(), sizeof(positions_file_header_t));
+
+   std::string other_version = file;
+   const uint32_t version = SequenceStore::positions_file_version + 1;
+   memcpy(other_version.data() + offsetof(positions_file_header_t, version), &version, sizeof(version));
+   std::ofstream(save_dir + "other_version.pos", std::ios::binary) << other_version;
+   std::string other_magic = file;
+   other_magic[0] = 'X';
+   std::ofstream(save_dir + "other_magic.pos", std::ios::binary) << other_magic;
+
+   SequenceStore& seq_store = db->partitions[0].seq_store;
+   EXPECT_THROW(seq_store.map_positions(save_dir + "other_version.pos"), std::runtime_error);
+   EXPECT_THROW(seq_store.map_positions(save_dir + "other_magic.pos"), std::runtime_error);
+   EXPECT_FALSE(seq_store.positions_mapped());
+
+   /// A partition rejecting its positions file is not loaded
+   std::ofstream(save_dir + "P0.pos", std::ios::binary) << other_version;
+   Database loaded(db->wd);
+   loaded.load(save_dir);
+   EXPECT_TRUE(loaded.partitions.empty());
+}
+
+TEST(SequenceStore, EvictsPositionsUnderBudget) {
+   auto db = make_sample_database(2);
+   const std::string save_dir = make_temp_dir();
+   db->save(save_dir);
+   Database loaded(db->wd);
+   loaded.lazy_positions = true;
+   loaded.load(save_dir);
+
+   auto loaded_bytes = [&]() {
+      size_t ret = 0;
+      for (const DatabasePartition& dbp : loaded.partitions) {
+         ret += dbp.seq_store.loaded_position_bytes();
+      }
+      return ret;
+   };
+   const std::vector<std::string> queries = sample_queries();
+   EXPECT_EQ(query_result(loaded, queries[0]), query_result(*db, queries[0]));
+   const size_t after_first = loaded_bytes();
+   EXPECT_GT(after_first, 0u);
+   EXPECT_EQ(query_result(loaded, queries[2]), query_result(*db, queries[2]));
+   EXPECT_GT(loaded_bytes(), after_first);
+
+   loaded.position_budget_bytes = after_first;
+   loaded.trim_positions();
+   EXPECT_LE(loaded_bytes(), after_first);
+   loaded.position_budget_bytes = 0;
+   loaded.trim_positions();
+   EXPECT_EQ(loaded_bytes(), 0u);
+
+   /// Evicted positions are mapped again on their next access
+   for (const std::string& query : queries) {
+      EXPECT_EQ(query_result(loaded, query), query_result(*db, query)) << query;
+   }
+}
+
+TEST(SequenceStore, EdgeGapExtentsMatchBitmaps) {
+   auto plain = make_test_database({gapped_sequences()});
+   auto compressed = make_test_database({gapped_sequences()}, [](Database& db) { db.compress_edge_gaps = true; });
+   const SequenceStore& seq_store = compressed->partitions[0].seq_store;
+   EXPECT_FALSE(seq_store.start_gap_order.empty());
+   EXPECT_FALSE(seq_store.end_gap_order.empty());
+   EXPECT_LT(seq_store.bm(1, Symbol::gap)->cardinality(), plain->partitions[0].seq_store.bm(1, Symbol::gap)->cardinality());
+
+   EXPECT_EQ(query_result(*compressed, list_query(nuc_eq_filter(51, '-'))), R"([{"gisaid_epi_isl":"EPI_ISL_1"}])");
+
+   std::vector<std::string> queries;
+   for (unsigned position : {1u, 50u, 51u, 100u, 101u, 300u, 29799u, 29800u, 29849u, 29850u, genomeLength}) {
+      queries.push_back(list_query(nuc_eq_filter(position, '-')));
+      queries.push_back(list_query(R"({"type": "Maybe", "child": )" + nuc_eq_filter(position, test_reference()[position - 1]) + "}"));
+   }
+   for (auto [from, to] : {std::pair{1u, 100u}, {101u, 29799u}, {29850u, genomeLength}}) {
+      queries.push_back(list_query(R"({"type": "Covered", "from": )" + std::to_string(from) + R"(, "to": )" + std::to_string(to) + "}"));
+   }
+   queries.push_back(R"({"action": {"type": "Mutations", "minProportion": 0.01}, "filter": )" + nuc_eq_filter(241, 'T') + "}");
+   for (const std::string& query : queries) {
+      EXPECT_EQ(query_result(*compressed, query), query_result(*plain, query)) << query;
+      EXPECT_EQ(query_result(*compressed, query, true), query_result(*plain, query)) << query;
+   }
+}
+
+TEST(SequenceStore, NRunIntervalsMatchBitmaps) {
+   auto plain = make_test_database({n_run_sequences()});
+   auto compressed = make_test_database({n_run_sequences()}, [](Database& db) {
+      db.compress_edge_gaps = true;
+      db.n_run_min_length = 5;
+   });
+   /// The run of a single N stays in the bitmaps
+   EXPECT_EQ(compressed->partitions[0].seq_store.n_runs.size(), 3u);
+
+   EXPECT_EQ(query_result(*compressed, list_query(nuc_eq_filter(507, 'N'))), R"([{"gisaid_epi_isl":"EPI_ISL_1"},{"gisaid_epi_isl":"EPI_ISL_2"}])");
+
+   std::vector<std::string> queries;
+   for (unsigned position : {499u, 500u, 505u, 509u, 510u, 520u, 521u, 600u, 1000u, 1100u, 1101u}) {
+      queries.push_back(list_query(nuc_eq_filter(position, 'N')));
+      queries.push_back(list_query(R"({"type": "Maybe", "child": )" + nuc_eq_filter(position, 'T') + "}"));
+      queries.push_back(list_query(R"({"type": "Neg", "child": {"type": "Maybe", "child": )" +
+                                   nuc_eq_filter(position, test_reference()[position - 1]) + "}}"));
+   }
+   for (auto [from, to] : {std::pair{1u, 100u}, {400u, 700u}, {505u, 509u}, {1000u, 1000u}}) {
+      queries.push_back(list_query(R"({"type": "Covered", "from": )" + std::to_string(from) + R"(, "to": )" + std::to_string(to) + "}"));
+   }
+   for (const std::string& query : queries) {
+      EXPECT_EQ(query_result(*compressed, query), query_result(*plain, query)) << query;
+      EXPECT_EQ(query_result(*compressed, query, true), query_result(*plain, query)) << query;
+   }
+}
@@ -0,0 +1,182 @@
+#ifndef SILO_TEST_UTIL_H
+#define SILO_TEST_UTIL_H
+
+#include <silo/database.h>
+#include <silo/query_engine/query_engine.h>
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+namespace silo::test {
+
+/// A sequence of a test database, given by its metadata and its differences from test_reference()
+struct test_sequence_t {
+   std::string epi_isl;
+   std::string pango_lineage;
+   std::string date;
+   std::string region;
+   std::string country;
+   std::string division;
+   /// 1-based positions and the symbols at them
+   std::vector<std::pair<unsigned, char>> mutations = {};
+};
+
+/// The reference genome of the test databases, ACGT repeated
+inline std::string test_reference() {
+   std::string ret(genomeLength, 'A');
+   for (unsigned i = 0; i < genomeLength; ++i) {
+      ret[i] = "ACGT"[i % 4];
+   }
+   return ret;
+}
+
+/// A new empty directory, with a trailing slash as expected by Database
+inline std::string make_temp_dir() {
+   std::string path = (std::filesystem::temp_directory_path() / "silo_test_XXXXXX").string();
+   if (!mkdtemp(path.data())) {
+      throw std::runtime_error("Cannot create a temporary directory.");
+   }
+   return path + "/";
+}
+
+/// Builds a database through Database::build, with one partition per element of chunks and one chunk per element of a partition.
+/// configure is called before the database is finalized.
+inline std::unique_ptr<Database> make_chunked_database(const std::vector<std::vector<std::vector<test_sequence_t>>>& chunks,
+                                                       const std::function<void(Database&)>& configure = {}) {
+   const std::string wd = make_temp_dir();
+   std::ofstream(wd + "reference_genome.txt") << test_reference() << "\n";
+   std::ofstream(wd + "pango_alias.txt") << "BA\tB.1.1.529\n";
+
+   auto db = std::make_unique<Database>(wd);
+   const std::string header = "gisaid_epi_isl\tpango_lineage\tdate\tregion\tcountry\tdivision\n";
+   auto meta_rows = [](const std::vector<test_sequence_t>& sequences) {
+      std::string ret;
+      for (const auto& sequence : sequences) {
+         ret += sequence.epi_isl + "\t" + sequence.pango_lineage + "\t" + sequence.date + "\t" + sequence.region + "\t" +
+            sequence.country + "\t" + sequence.division + "\n";
+      }
+      return ret;
+   };
+
+   std::string all_rows;
+   db->part_def = std::make_unique<partitioning_descriptor_t>();
+   const std::string reference = test_reference();
+   for (unsigned i = 0; i < chunks.size(); ++i) {
+      partition_t& partition = db->part_def->partitions.emplace_back(partition_t{"P" + std::to_string(i), 0, {}});
+      for (unsigned j = 0; j < chunks[i].size(); ++j) {
+         std::string fasta;
+         for (const auto& sequence : chunks[i][j]) {
+            std::string genome = reference;
+            for (const auto& [position, symbol] : sequence.mutations) {
+               genome[position - 1] = symbol;
+            }
+            fasta += ">" + sequence.epi_isl + "\n" + genome + "\n";
+         }
+         std::ofstream(wd + chunk_string(i, j) + ".fasta") << fasta;
+         std::ofstream(wd + chunk_string(i, j) + ".tsv") << header << meta_rows(chunks[i][j]);
+         all_rows += meta_rows(chunks[i][j]);
+         const auto count = (uint32_t) chunks[i][j].size();
+         partition.chunks.push_back({chunk_string(i, j), count, partition.count, {}});
+         partition.count += count;
+      }
+   }
+   std::istringstream dict_in(header + all_rows);
+   db->dict = std::make_unique<Dictionary>();
+   db->dict->update_dict(dict_in, db->alias_key);
+
+   if (configure) {
+      configure(*db);
+   }
+   db->build(wd, ".tsv", ".fasta");
+   return db;
+}
+
+/// Builds a database with one partition of a single chunk per element of partitions
+inline std::unique_ptr<Database> make_test_database(const std::vector<std::vector<test_sequence_t>>& partitions,
+                                                    const std::function<void(Database&)>& configure = {}) {
+   std::vector<std::vector<std::vector<test_sequence_t>>> chunks;
+   for (const auto& sequences : partitions) {
+      chunks.push_back({sequences});
+   }
+   return make_chunked_database(chunks, configure);
+}
+
+/// Six sequences with a few mutations against test_reference(), at positions where it has an A
+inline std::vector<test_sequence_t> sample_sequences() {
+   return {
+      {"EPI_ISL_1", "B.1.1.7", "2021-01-03", "Europe", "Switzerland", "Bern", {{241, 'T'}, {3037, 'T'}}},
+      {"EPI_ISL_2", "B.1.1.7", "2021-02-10", "Europe", "Germany", "Berlin", {{241, 'T'}}},
+      {"EPI_ISL_3", "B.1.617.2", "2021-06-21", "Asia", "India", "Delhi", {{3037, 'T'}, {14409, 'T'}}},
+      {"EPI_ISL_4", "BA.1", "2022-01-05", "Europe", "Switzerland", "Zurich", {{241, 'T'}, {3037, 'T'}, {14409, 'T'}}},
+      {"EPI_ISL_5", "BA.2", "2021-03-15", "Europe", "Switzerland", "Bern", {}},
+      {"EPI_ISL_6", "BA.2", "2022-04-01", "Asia", "India", "Mumbai", {{14409, 'T'}, {23405, 'G'}}},
+   };
+}
+
+/// The sample sequences, split in order into partition_count partitions of about the same size
+inline std::unique_ptr<Database> make_sample_database(size_t partition_count = 1, const std::function<void(Database&)>& configure = {}) {
+   const std::vector<test_sequence_t> sequences = sample_sequences();
+   std::vector<std::vector<test_sequence_t>> partitions(partition_count);
+   for (size_t i = 0; i < sequences.size(); ++i) {
+      partitions[i * partition_count / sequences.size()].push_back(sequences[i]);
+   }
+   return make_test_database(partitions, configure);
+}
+
+/// A leaf that counts how often it is evaluated
+struct counting_ex_t : public BoolExpression {
+   std::unique_ptr<BoolExpression> child;
+   uint32_t* evaluations;
+
+   counting_ex_t(std::unique_ptr<BoolExpression> child, uint32_t* evaluations) : child(std::move(child)), evaluations(evaluations) {}
+
+   ExType type() const override {
+      return ExType::PRED;
+   }
+
+   filter_t evaluate(const Database& db, const DatabasePartition& dbp, slice_t slice) override {
+      ++*evaluations;
+      return child->evaluate(db, dbp, slice);
+   }
+
+   std::string to_string(const Database& db) override {
+      return child->to_string(db);
+   }
+
+   std::unique_ptr<BoolExpression> simplify(const Database& db, const DatabasePartition& dbp) const override {
+      return child->simplify(db, dbp);
+   }
+
+   uint32_t estimate_cardinality(const Database& db, const DatabasePartition& dbp) const override {
+      return child->estimate_cardinality(db, dbp);
+   }
+};
+
+inline std::unique_ptr<BoolExpression> nuc_eq(unsigned position, char symbol) {
+   return std::make_unique<NucEqEx>(position, to_symbol(symbol));
+}
+
+/// The rows of the result in the slice, complemented results are flipped
+inline std::vector<uint32_t> rows(const filter_t& filter, slice_t slice) {
+   roaring::Roaring bitmap = *filter.getAsConst();
+   if (filter.complemented) {
+      bitmap.flip(slice.begin, slice.end);
+   }
+   std::vector<uint32_t> ret(bitmap.cardinality());
+   bitmap.toUint32Array(ret.data());
+   return ret;
+}
+
+/// Executes the query and returns what it writes to res_out
+inline std::string query_result(const Database& db, const std::string& query, bool compile_filter = false) {
+   std::stringstream res, perf;
+   execute_query(db, query, res, perf, compile_filter);
+   return res.str();
+}
+
+} // namespace silo::test
+
+#endif //SILO_TEST_UTIL_H